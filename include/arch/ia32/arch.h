@@ -8,11 +8,13 @@
 #define WORD_SIZE 4
 #define VERS_PTR_SIZE 8
 #define PAGE_SIZE 4096
+#define PAGE_SHIFT 12
+#define HUGE_PAGE_SIZE 0x200000
 #define CONTEXT_SIZE 24
 #define STACK_DIRECTION -1
 #define STACK_ALIGN 16
 #define SLICE_TAB_SIZE 0x100
 #define SLICE_MIN_SIZE 0x1000
-#define SLICE_MAX_SIZE 0x40000
+#define SLICE_MAX_SIZE 0x80000000
 
 #endif
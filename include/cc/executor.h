@@ -5,6 +5,7 @@
 
 #include "cc_stat.h"
 #include "cc/thread.h"
+#include "mm/gc_thread.h"
 
 
 /*!
@@ -127,6 +128,28 @@ internal void executor_raise(unsigned int exec, unsigned int sigs);
 internal unsigned int executor_self(void);
 
 
+/*!
+ * This function gets the thread currently running on an executor.
+ * This must only be called from the executor itself.
+ *
+ * \brief Get the current thread of an executor.
+ * \arg exec The executor ID.
+ * \return The current thread.
+ */
+internal thread_t* executor_curr_thread(unsigned int exec);
+
+
+/*!
+ * This function gets the garbage collector closure for an executor.
+ * This must only be called from the executor itself.
+ *
+ * \brief Get the GC closure of an executor.
+ * \arg exec The executor ID.
+ * \return The GC closure.
+ */
+internal gc_closure_t* executor_gc_closure(unsigned int exec);
+
+
 /*!
  * This function attempts to restart a single idle executor to consume
  * threads which have been placed in workshare, or that have just been
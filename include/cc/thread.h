@@ -64,6 +64,14 @@ enum thread_sched_stat_t {
 #define T_STAT_MASK 0xf
 #define T_REF 0x10
 
+/*!
+ * This is the size of the thread table if no maximum number of
+ * threads is given.
+ *
+ * \brief The default size of the thread table.
+ */
+#define THREAD_TAB_DEFAULT_SIZE 0x4000
+
 
 /*!
  * This code denotes that no executor is currently running the thread
@@ -87,7 +95,7 @@ extern const unsigned int thread_mbox_null_executor;
 typedef char thread_mbox_t[sizeof(void*) + sizeof(void*) +
 			   sizeof(unsigned int) + sizeof(void*) +
 			   sizeof(unsigned int) + sizeof(void*) +
-			   sizeof(void*)];
+			   sizeof(void*) + sizeof(unsigned int)];
 
 typedef void (*retaddr_t)(void);
 
@@ -161,7 +169,7 @@ thread_mbox_sigptr(volatile thread_mbox_t mbox);
  * mailbox.
  *
  * This is the next valid index in the gc write log.  If this is equal
- * to GC_WRITE_LOG_LENGTH, then the write log is full.
+ * to the write log limit, then the write log is full.
  *
  * \brief Get a pointer to the write log index.
  * \arg mbox The mailbox for which to get an offset.
@@ -201,6 +209,22 @@ internal pure volatile gc_allocator_t* volatile *
 thread_mbox_allocators(volatile thread_mbox_t mbox);
 
 
+/*!
+ * This function gets a pointer to the gc write log limit slot in the
+ * mailbox.
+ *
+ * This is the number of entries in the write log the thread may use.
+ * The write log is full when the write log index reaches this.  The
+ * runtime grows this for executors whose logs fill up often.
+ *
+ * \brief Get a pointer to the write log limit.
+ * \arg mbox The mailbox for which to get an offset.
+ * \return A pointer to the write log limit in the mailbox.
+ */
+internal pure volatile unsigned int*
+thread_mbox_write_log_limit(volatile thread_mbox_t mbox);
+
+
 /*!
  * This structure contains user-visible and modifiable thread data.
  * This structure is used to set or retrieve information about a
@@ -348,12 +372,123 @@ struct thread_t {
    */
   void (*t_destroy)(thread_t* thread);
 
+  /*!
+   * This is the index of this thread in the thread table.  This is
+   * set when the thread is initialized, and is only reused after the
+   * thread is destroyed.
+   *
+   * \brief The thread's slot in the thread table.
+   */
+  unsigned int t_slot;
+
+  /*!
+   * This is the state of the garbage collector's stack barrier for
+   * this thread.  When the collector scans only the top of a thread's
+   * stack, it replaces the return address into the first unscanned
+   * frame with a trampoline, which scans more of the stack when the
+   * thread returns into it.  Only the collector uses this.
+   *
+   * \brief The stack barrier state.
+   */
+  volatile atomic_uint_t t_gc_barrier;
+
+  /*!
+   * This is the return address slot which holds the trampoline, or
+   * NULL if there is none.
+   *
+   * \brief The patched return address slot.
+   */
+  const void** volatile t_gc_barrier_slot;
+
+  /*!
+   * This is the return address which the trampoline replaced.
+   *
+   * \brief The original return address.
+   */
+  const void* volatile t_gc_barrier_retaddr;
+
+  /*!
+   * This is the first unscanned frame.
+   *
+   * \brief The first unscanned frame.
+   */
+  char* volatile t_gc_barrier_frame;
+
+  /*!
+   * This is the next pointer for the collector's list of threads
+   * whose stacks are only partly scanned.
+   *
+   * \brief The next thread with a partly scanned stack.
+   */
+  thread_t* t_gc_barrier_next;
+
+  /*!
+   * This tells whether the top of the thread's stack has been scanned
+   * in the current phase of a collection, or is being scanned.  The
+   * top is scanned either by a collector or by the executor which
+   * resumes the thread, whichever claims it first.  Only the
+   * collector uses this.
+   *
+   * \brief The stack scan state.
+   */
+  volatile atomic_uint_t t_gc_scan;
+
+  /*!
+   * This is the next pointer for the collector's list of threads
+   * which were destroyed during a collection.
+   *
+   * \brief The next dead thread.
+   */
+  thread_t* t_gc_dead_next;
+
   thread_t* t_rlist_next;
   thread_t* t_queue_next;
 
 };
 
 
+/*!
+ * This function calculates the amount of static memory needed for the
+ * thread table.  Every live thread has an entry in the table, which
+ * allows the garbage collector to find all threads.
+ *
+ * \brief Request static memory for the thread table.
+ * \arg size The number of entries in the table.
+ * \return The size of memory required by the thread table.
+ */
+internal unsigned int thread_tab_request(unsigned int size);
+
+/*!
+ * This function initializes the thread table in the memory reserved
+ * by thread_tab_request.  This must be called before any thread is
+ * initialized.
+ *
+ * \brief Initialize the thread table.
+ * \arg size The number of entries in the table.
+ * \arg mem The static memory for the table.
+ * \return The new free space.
+ */
+internal void* thread_tab_init(unsigned int size, void* mem);
+
+/*!
+ * This function gets the number of thread table entries which have
+ * ever been used.  All live threads have entries below this, though
+ * some of the entries may be empty.
+ *
+ * \brief Get the number of used thread table entries.
+ * \return The number of used entries.
+ */
+internal unsigned int thread_tab_count(void);
+
+/*!
+ * This function gets the thread in a thread table entry.
+ *
+ * \brief Get a thread from the thread table.
+ * \arg index The index of the entry.
+ * \return The thread, or NULL if the entry is empty.
+ */
+internal thread_t* thread_tab_get(unsigned int index);
+
 /*!
  * This function initializes a thread structure, preparing it for use.
  * The mailbox that is passed in is copied into the thread's mailbox.
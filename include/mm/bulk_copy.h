@@ -0,0 +1,24 @@
+/* Copyright (c) 2008 Eric McCorkle.  All rights reserved. */
+
+#ifndef BULK_COPY_H
+#define BULK_COPY_H
+
+#include "definitions.h"
+
+/*!
+ * This function copies a large block of memory, bypassing the cache
+ * on the destination where the architecture allows it.  This is for
+ * copies which are large enough to push everything else out of the
+ * cache, and which won't be read back soon.  The destination and
+ * source must not overlap.  All stores are visible to other
+ * processors by the time this returns.
+ *
+ * \brief Copy a large block of memory.
+ * \arg dst The destination.
+ * \arg src The source.
+ * \arg size The number of bytes to copy.
+ */
+internal void bulk_copy(void* restrict dst, const void* restrict src,
+			unsigned int size);
+
+#endif
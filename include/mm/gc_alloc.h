@@ -4,8 +4,72 @@
 #define GC_ALLOC_H
 
 #include "definitions.h"
+#include "mm/gc_card.h"
 #include "mm/gc_thread.h"
 
+/*!
+ * This is the size at which blocks are allocated in the large object
+ * space.  Each large block gets a slice to itself, and is marked in
+ * place by the collector instead of being copied.  Its slice is given
+ * back once it is found dead.
+ *
+ * \brief The minimum size of a large object.
+ */
+#define GC_LARGE_OBJECT_SIZE 0x100000
+
+/*!
+ * This is the free space kept for reuse after a collection, as a
+ * percentage of the recent size of the heap after collections.  Free
+ * space above this is discarded, and free space above twice this is
+ * given back to the system.  This is set by the launcher.
+ *
+ * \brief The free space target.
+ */
+extern unsigned int mm_gc_free_target;
+
+/*!
+ * This is the percentage by which the recent size of the heap after
+ * collections decays each collection.  A larger value shrinks the heap
+ * faster after a spike.  This is set by the launcher, and must be no
+ * more than 100.
+ *
+ * \brief The decay of the free space target.
+ */
+extern unsigned int mm_gc_shrink_decay;
+
+/*!
+ * This is the number of slices each executor finishes releasing right
+ * after a collection.  The rest are released as allocators need them,
+ * or before the next collection starts.
+ *
+ * \brief The number of slices released at once.
+ */
+#define GC_RELEASE_BATCH 16
+
+/*!
+ * This function calculates the size of memory required by the GC
+ * allocator's per-executor structures.
+ *
+ * \brief Calculate memory required by the GC allocator.
+ * \arg execs The number of executors.
+ * \arg gens The number of generations.
+ * \return The size of memory required by the GC allocator.
+ */
+internal pure unsigned int gc_allocator_request(unsigned int execs,
+					       unsigned int gens);
+
+/*!
+ * This function initializes the GC allocator's per-executor
+ * structures in memory set aside for them.
+ *
+ * \brief Initialize the GC allocator.
+ * \arg mem The memory to use.
+ * \arg execs The number of executors.
+ * \arg gens The number of generations.
+ * \return The first byte after the memory used.
+ */
+internal void* gc_allocator_init(void* mem, unsigned int execs,
+				 unsigned int gens);
 
 /*!
  * This function refreshes alloc with a new block of at least min
@@ -27,9 +91,50 @@ extern bool gc_allocator_refresh(gc_allocator_t* allocators, unsigned int min,
 
 
 /*!
- * This function allocates size bytes from alloc.  This is intended
- * for internal use only.  External resources should update the
- * allocators for an executor themselves.
+ * This function gets the size the allocator actually takes for an
+ * object of a given size.  When cards are marked, object starts are
+ * recorded by cache line, so every object is rounded up to a whole
+ * number of cache lines.  Otherwise, this is the size itself.
+ *
+ * \brief Get the allocated size of an object.
+ * \arg size The size of the object.
+ * \return The number of bytes allocated for it.
+ */
+static inline unsigned int gc_allocator_obj_size(const unsigned int size) {
+
+  return GC_CARD_MARKING_ON == mm_card_marking ?
+    ((size - 1) & ~(CACHE_LINE_SIZE - 1)) + CACHE_LINE_SIZE : size;
+
+}
+
+
+/*!
+ * This function gets a new block for an allocator and allocates size
+ * bytes from it, or allocates a large object.  This is the slow path
+ * of gc_allocator_alloc, and is only called when the allocator's
+ * current block is too small, or size is at least
+ * GC_LARGE_OBJECT_SIZE.  Compiled code which inlines the fast path
+ * itself must call this in the same cases.  When cards are marked, it
+ * must also round sizes with gc_allocator_obj_size, and note the start
+ * of what it allocates with gc_card_note_object.
+ *
+ * \brief Refill an allocator and allocate from it.
+ * \arg allocator The allocator to use.
+ * \arg size The number of bytes to allocate.
+ * \arg gen The generation store from which to allocate.
+ * \return The allocated memory, or NULL if the call fails.
+ */
+internal void* gc_allocator_refill(gc_allocator_t allocator,
+				   unsigned int size,
+				   unsigned int gen);
+
+
+/*!
+ * This function allocates size bytes from alloc.  This bumps the
+ * allocation pointer if the current block has room, and calls
+ * gc_allocator_refill otherwise.  External resources should update
+ * the allocators for an executor themselves, the same way.  When
+ * cards are marked, the memory is noted as the start of an object.
  *
  * \brief Allocate garbage-collected memory.
  * \arg allocator The allocator to use.
@@ -37,9 +142,55 @@ extern bool gc_allocator_refresh(gc_allocator_t* allocators, unsigned int min,
  * \arg gen The generation store from which to allocate.
  * \return The allocated memory, or NULL if the call fails.
  */
-internal void* gc_allocator_alloc(gc_allocator_t allocator,
-				  unsigned int size,
-				  unsigned int gen);
+static inline void* gc_allocator_alloc(gc_allocator_t allocator,
+				       const unsigned int size,
+				       const unsigned int gen) {
+
+  const unsigned int real_size = gc_allocator_obj_size(size);
+  char* const newptr = (char*)(allocator[0]) + real_size;
+  void* out;
+
+  if(GC_LARGE_OBJECT_SIZE > real_size && newptr <= (char*)allocator[1]) {
+
+    out = allocator[0];
+    allocator[0] = newptr;
+
+    if(GC_CARD_MARKING_ON == mm_card_marking)
+      gc_card_note_object(out);
+
+  }
+
+  else
+    out = gc_allocator_refill(allocator, real_size, gen);
+
+  return out;
+
+}
+
+
+/*!
+ * This function allocates a number of objects of the same normal
+ * type, and initializes all their headers.  The objects are
+ * unclaimed, and have a count of 0.  Their fields must all be set
+ * before the next safepoint.
+ *
+ * \brief Allocate several objects of one type.
+ * \arg allocator The allocator to use.
+ * \arg type The type of the objects.
+ * \arg flags The flags field of the objects.
+ * \arg gen The generation store from which to allocate.
+ * \arg next_gen The next generation field of the objects.
+ * \arg num The number of objects.
+ * \arg objs Set to the objects' headers.
+ * \return Whether all the objects were allocated.
+ */
+internal bool gc_allocator_alloc_batch(gc_allocator_t allocator,
+				       const unsigned int* type,
+				       unsigned char flags,
+				       unsigned int gen,
+				       unsigned char next_gen,
+				       unsigned int num,
+				       void** restrict objs);
 
 
 /*!
@@ -78,9 +229,44 @@ internal void gc_allocator_gc_postalloc(gc_closure_t* restrict closure,
 
 
 /*!
- * This function releases all slices which were marked as used, moving
- * them to the free status.  The new-space slices are moved to being
- * in the used status.
+ * This function tells whether an object is in the large object space.
+ * Only objects of at least half GC_LARGE_OBJECT_SIZE are looked up, so
+ * objects must be allocated at the size given by their headers.
+ *
+ * \brief Check for a large object.
+ * \arg obj The object.
+ * \return Whether the object is in the large object space.
+ */
+internal bool gc_allocator_large(volatile void* obj);
+
+
+/*!
+ * This function records that a large object is live, so that its
+ * slice is kept at the end of the collection.
+ *
+ * \brief Mark a large object live.
+ * \arg obj The object.
+ */
+internal void gc_allocator_mark_large(volatile void* obj);
+
+
+/*!
+ * This function adds all of the calling executor's changes to the
+ * space counters into the shared counters.  Each executor does this
+ * before passing the final barrier, as the executor releasing slices
+ * must not touch other executors' changes.
+ *
+ * \brief Add the executor's space changes to the shared counters.
+ */
+internal void gc_allocator_fold_deltas(void);
+
+
+/*!
+ * This function releases all slices which were marked as used.  They
+ * are spliced onto the released slices in constant time, and moved to
+ * the free status later by gc_allocator_release_deferred.  The
+ * new-space slices are moved to being in the used status.  Large
+ * objects which were not marked live have their slices freed.
  *
  * This function is not atomic.  It is called only by the executor
  * which is the last to pass the final barrier, so it may access
@@ -91,4 +277,20 @@ internal void gc_allocator_gc_postalloc(gc_closure_t* restrict closure,
  */
 internal void gc_allocator_release_slices(unsigned int gen);
 
+
+/*!
+ * This function finishes releasing slices from the last collection.
+ * Their card tables are cleaned, and they are put on the free slices,
+ * with their memory discarded if there is more free space than the
+ * target.  Past twice the target, free slices are given back to the
+ * system, including ones released by earlier collections.  This is
+ * lock-free, and may be called by any number of executors at once.
+ * This must not be called during a collection.
+ *
+ * \brief Finish releasing memory.
+ * \arg max The most slices to release or give back.
+ * \return The number of slices released or given back.
+ */
+internal unsigned int gc_allocator_release_deferred(unsigned int max);
+
 #endif
@@ -0,0 +1,31 @@
+/* Copyright (c) 2008 Eric McCorkle.  All rights reserved. */
+
+#ifndef GC_BARRIER_H
+#define GC_BARRIER_H
+
+#include "definitions.h"
+
+/*!
+ * This is the stack barrier trampoline.  The collector stores its
+ * address in place of the return address into the first unscanned
+ * frame of a thread's stack.  When the thread returns into it, it
+ * preserves the return value registers, calls gc_stack_barrier, and
+ * jumps to the return address it gives back.  This is never called
+ * directly.
+ *
+ * \brief The stack barrier trampoline.
+ */
+extern void gc_stack_trampoline(void) asm("gc_stack_trampoline");
+
+/*!
+ * This function is called by the stack barrier trampoline, on the
+ * stack of the current thread.  It scans more of the thread's stack
+ * if necessary, and returns the return address the trampoline
+ * replaced.
+ *
+ * \brief Handle a stack barrier.
+ * \return The original return address.
+ */
+extern const void* gc_stack_barrier(void) asm("gc_stack_barrier");
+
+#endif
@@ -0,0 +1,292 @@
+/* Copyright (c) 2008 Eric McCorkle.  All rights reserved. */
+
+#ifndef GC_CARD_H
+#define GC_CARD_H
+
+#include "definitions.h"
+#include "atomic.h"
+#include "mm/slice.h"
+
+#include <stdbool.h>
+
+/*!
+ * This is the log of the size of a card.
+ *
+ * \brief The log of the card size.
+ */
+#define GC_CARD_SHIFT 9
+
+/*!
+ * This is the size of a card.  Each card has one byte in the card
+ * table of its slice, which is dirtied whenever anything in the card
+ * is written.
+ *
+ * \brief The card size.
+ */
+#define GC_CARD_SIZE (1 << GC_CARD_SHIFT)
+
+/*!
+ * This is the number of cards claimed at once by a collector scanning
+ * a card table.
+ *
+ * \brief The number of cards in a claimed range.
+ */
+#define GC_CARD_CLUSTER_SIZE 64
+
+/*!
+ * These are the values of a card.
+ * - GC_CARD_CLEAN: nothing in the card needs to be looked at.
+ * - GC_CARD_REMEMBERED(gen): the card holds pointers into generation
+ *   gen, and is scanned by every collection of gen or above.  This is
+ *   the card's part of the remembered set for gen.
+ * - GC_CARD_DIRTY: the card has been written, and may hold anything.
+ *   This is remembered for generation 0, so every collection scans
+ *   it.
+ *
+ * A card in an older generation always holds the youngest generation
+ * it has pointers into, so a collection of the younger generations
+ * can skip the older ones, and find all pointers into what it is
+ * collecting from the cards alone.
+ *
+ * \brief Card values.
+ */
+#define GC_CARD_CLEAN 0
+#define GC_CARD_REMEMBERED(gen) ((gen) + 1)
+#define GC_CARD_DIRTY GC_CARD_REMEMBERED(0)
+
+#if GC_CARD_SIZE / CACHE_LINE_SIZE > 32
+#error "Object starts in a card must fit in a word"
+#endif
+
+/*!
+ * These are the values of mm_card_marking.
+ * - GC_CARD_MARKING_OFF: mutators log writes in the write log during
+ *   collections.  Every collection traces through all generations.
+ * - GC_CARD_MARKING_ON: mutators dirty the card of every write,
+ *   whether or not a collection is running, and keep no write log.
+ *   Pointers are stored into both halves of a double pointer.  The
+ *   cards serve as remembered sets, and collections do not trace
+ *   through generations they are not collecting.
+ *
+ * \brief Write barrier modes.
+ */
+#define GC_CARD_MARKING_OFF 0
+#define GC_CARD_MARKING_ON 1
+
+/*!
+ * This is the write barrier mode.  This is set by the launcher, and
+ * must not change once the memory manager is started.
+ *
+ * \brief Write barrier mode.
+ */
+extern unsigned int mm_card_marking;
+
+/*!
+ * This is the card table of a garbage-collected slice.  It sits at the
+ * beginning of the slice, and covers the entire slice, itself
+ * included.  It is followed by the card marks, one byte per card, and
+ * then by the object starts, one word per card.  The object starts
+ * have a bit for each cache line in the card at which an object header
+ * starts; object headers are always cache line aligned.
+ *
+ * \brief A card table.
+ */
+typedef struct {
+
+  /*!
+   * This is used by collectors to claim ranges of cards to scan.  The
+   * high word is the pass for which the low word is valid.  The low
+   * word is the next range to be claimed.  This is aligned to a cache
+   * line.
+   *
+   * \brief The claim word.
+   */
+  union {
+
+    volatile atomic_uint64_t value;
+    cache_line_t _;
+
+  } _ct_claim;
+
+  /*!
+   * This is the slice to which this card table belongs.
+   *
+   * \brief The slice.
+   */
+  slice_t* ct_slice;
+
+  /*!
+   * This is the number of cards in the slice.
+   *
+   * \brief The number of cards.
+   */
+  unsigned int ct_num_cards;
+
+  /*!
+   * This is the index of the card table in the list of card tables.
+   *
+   * \brief The index of the card table.
+   */
+  unsigned int ct_index;
+
+  /*!
+   * This is the generation of the objects in the slice.
+   *
+   * \brief The generation.
+   */
+  unsigned char ct_gen;
+
+  /*!
+   * This is true if the slice holds a single large object, which is
+   * marked in place by the collector instead of being copied.
+   *
+   * \brief Whether the slice is in the large object space.
+   */
+  bool ct_large;
+
+  /*!
+   * This is set when the large object in the slice is found to be
+   * live by a collection, and cleared when the slice is kept at the
+   * end of it.
+   *
+   * \brief Whether the large object is live.
+   */
+  volatile bool ct_live;
+
+  /*!
+   * These are the object starts, which follow the card marks.
+   *
+   * \brief The object starts.
+   */
+  volatile unsigned int* ct_starts;
+
+  /*!
+   * These are the card marks.
+   *
+   * \brief The card marks.
+   */
+  volatile unsigned char ct_cards[];
+
+} gc_card_table_t;
+
+#define ct_claim _ct_claim.value
+
+
+/*!
+ * This function gets the size of the card table for a slice of a
+ * given size.  Allocation in the slice must begin after this many
+ * bytes.
+ *
+ * \brief Get the card table size.
+ * \arg size The size of the slice.
+ * \return The size of the card table, aligned to a cache line.
+ */
+internal pure unsigned int gc_card_table_size(unsigned int size);
+
+/*!
+ * This function initializes the card table of a new
+ * garbage-collected slice, and registers it to be scanned by
+ * collectors.  Slices only have card tables when cards are marked,
+ * except for large object slices, which always have one.
+ *
+ * \brief Initialize a slice's card table.
+ * \arg slice The slice.
+ * \arg gen The generation the slice holds.
+ * \arg large Whether the slice holds a single large object.
+ */
+internal void gc_card_table_init(slice_t* slice, unsigned char gen,
+				 bool large);
+
+/*!
+ * This function unregisters the card table of a slice which is about
+ * to be freed.  This must not be called while collectors may be
+ * scanning card tables.  This does nothing if the slice has no card
+ * table.
+ *
+ * \brief Destroy a slice's card table.
+ * \arg slice The slice.
+ */
+internal void gc_card_table_destroy(slice_t* slice);
+
+/*!
+ * This function cleans all cards and forgets all objects in a slice.
+ * This is called when the slice's memory is freed, and does nothing
+ * if the slice has no card table.
+ *
+ * \brief Clear a slice's card table.
+ * \arg slice The slice.
+ */
+internal void gc_card_table_clear(slice_t* slice);
+
+/*!
+ * This function marks the card holding a location dirty.  This is the
+ * write barrier when mm_card_marking is GC_CARD_MARKING_ON, and may
+ * be inlined by compiled code, which is simply a slice lookup and a
+ * byte store.  Locations outside garbage-collected slices with card
+ * tables are ignored.
+ *
+ * \brief Dirty a card.
+ * \arg ptr The location written.
+ */
+internal void gc_card_mark(volatile void* ptr);
+
+/*!
+ * This function adds a location to the remembered set of the
+ * generation of the object to which it points, if that generation is
+ * younger than the location's.  Locations outside of
+ * garbage-collected memory are ignored.  This is done by the collector
+ * whenever it stores a pointer.
+ *
+ * \brief Remember a pointer.
+ * \arg ptr The location written.
+ * \arg obj The object to which it points.
+ */
+internal void gc_card_remember(volatile void* ptr, volatile void* obj);
+
+/*!
+ * This function records that an object header starts at an address.
+ * This must be done for every object allocated in garbage-collected
+ * memory when card marking is used, so that a dirty card can be
+ * mapped back to the objects in it.  The collector does this for
+ * objects it copies, and the GC allocator for objects the program
+ * allocates; anything else allocating garbage-collected memory must
+ * do it as well.
+ *
+ * \brief Record an object start.
+ * \arg obj The object header.
+ */
+internal void gc_card_note_object(volatile void* obj);
+
+/*!
+ * This function gets the number of card tables.  Card tables may be
+ * destroyed, so some of the ones below this may be NULL.
+ *
+ * \brief Get the number of card tables.
+ * \return The number of card tables.
+ */
+internal unsigned int gc_card_table_count(void);
+
+/*!
+ * This function gets a card table.
+ *
+ * \brief Get a card table.
+ * \arg index The index of the card table.
+ * \return The card table.
+ */
+internal gc_card_table_t* gc_card_table_get(unsigned int index);
+
+/*!
+ * This function claims a range of GC_CARD_CLUSTER_SIZE cards in a
+ * card table for the given pass.  Each range is claimed once per
+ * pass.
+ *
+ * \brief Claim a range of cards.
+ * \arg table The card table.
+ * \arg pass The current pass.
+ * \arg first Set to the first card in the range.
+ * \return Whether or not a range was claimed.
+ */
+internal bool gc_card_claim(gc_card_table_t* table, unsigned int pass,
+			    unsigned int* first);
+
+#endif
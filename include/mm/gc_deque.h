@@ -0,0 +1,137 @@
+/* Copyright (c) 2008 Eric McCorkle.  All rights reserved. */
+
+#ifndef GC_DEQUE_H
+#define GC_DEQUE_H
+
+#include "definitions.h"
+#include "atomic.h"
+
+#include <stdbool.h>
+
+/*!
+ * This is the capacity of a work-stealing deque.  This must be a
+ * power of two.
+ *
+ * \brief The capacity of a work-stealing deque.
+ */
+#define GC_DEQUE_SIZE 1024
+
+/*!
+ * This is a work-stealing deque of gray objects (see Dynamic Circular
+ * Work-Stealing Deque, Chase and Lev, 2005).  Each collector owns
+ * one, and pushes and pops at the bottom without any atomic
+ * operations in the common case.  Other collectors steal from the
+ * top.  Unlike the original algorithm, the array is fixed in size;
+ * the owner keeps anything that does not fit on its own private
+ * list.
+ *
+ * \brief A work-stealing deque.
+ */
+typedef struct {
+
+  /*!
+   * This is the index of the oldest entry.  Thieves claim entries by
+   * compare-and-set on this.  This is aligned to a cache line.
+   *
+   * \brief The top of the deque.
+   */
+  union {
+
+    volatile atomic_uint_t value;
+    cache_line_t _;
+
+  } _dq_top;
+
+  /*!
+   * This is the index one past the newest entry.  Only the owner
+   * writes this.  This is aligned to a cache line.
+   *
+   * \brief The bottom of the deque.
+   */
+  union {
+
+    volatile unsigned int value;
+    cache_line_t _;
+
+  } _dq_bottom;
+
+  /*!
+   * These are the entries, indexed modulo GC_DEQUE_SIZE.
+   *
+   * \brief The entries.
+   */
+  volatile void* volatile dq_array[GC_DEQUE_SIZE];
+
+} gc_deque_t;
+
+#define dq_top _dq_top.value
+#define dq_bottom _dq_bottom.value
+
+
+/*!
+ * This function calculates the amount of static memory needed for a
+ * deque for each executor.
+ *
+ * \brief Request static memory for the deques.
+ * \arg execs The number of executors.
+ * \return The size of memory required by the deques.
+ */
+internal pure unsigned int gc_deque_request(unsigned int execs);
+
+/*!
+ * This function initializes a deque for each executor in the memory
+ * reserved by gc_deque_request.
+ *
+ * \brief Initialize the deques.
+ * \arg mem The static memory for the deques.
+ * \arg execs The number of executors.
+ * \return A pointer to the array of deques.
+ */
+internal gc_deque_t* gc_deque_init(void* mem, unsigned int execs);
+
+/*!
+ * This function pushes an object on the bottom of a deque.  This may
+ * only be called by the deque's owner.
+ *
+ * \brief Push an object onto a deque.
+ * \arg deque The deque.
+ * \arg obj The object.
+ * \return Whether or not there was room for the object.
+ */
+internal bool gc_deque_push(gc_deque_t* deque, volatile void* obj);
+
+/*!
+ * This function pops the newest object from the bottom of a deque.
+ * This may only be called by the deque's owner.
+ *
+ * \brief Pop an object from a deque.
+ * \arg deque The deque.
+ * \return The object, or NULL if the deque is empty.
+ */
+internal volatile void* gc_deque_pop(gc_deque_t* deque);
+
+/*!
+ * This function checks whether a deque holds any objects.  This may
+ * only be called by the deque's owner, and is exact only while no
+ * other collector is stealing from it.
+ *
+ * \brief Check if a deque is empty.
+ * \arg deque The deque.
+ * \return Whether or not the deque is empty.
+ */
+internal bool gc_deque_empty(gc_deque_t* deque);
+
+/*!
+ * This function steals up to half the objects in one deque, moving
+ * them onto another.  This may only be called by the owner of the
+ * destination, which must not be the owner of the source.
+ *
+ * \brief Steal half of a deque.
+ * \arg victim The deque from which to steal.
+ * \arg thief The deque onto which to move stolen objects.
+ * \return The number of objects stolen.
+ */
+internal unsigned int gc_deque_steal_half(gc_deque_t* victim,
+					  gc_deque_t* thief);
+
+#endif
@@ -21,8 +21,6 @@
 #define GC_TYPEDESC_CLASS 0x3
 #define GC_TYPEDESC_CONST 0x4
 
-#define GC_WRITE_LOG_LENGTH 64
-
 
 /*!
  * This enumeration gives the class of a type descriptor.  This is
@@ -136,6 +134,81 @@ typedef unsigned int gc_typedesc_t[4];
 typedef void* gc_double_ptr_t[2];
 
 
+/*!
+ * This is a frame descriptor, which tells the collector where the
+ * pointers are in a stack frame.  The compiler generates a static
+ * array of these, one for each return address at which a thread can
+ * enter the runtime, sorted by return address.
+ *
+ * A thread's saved stack is walked starting from the return address
+ * and frame saved in its mailbox.  The descriptor for the return
+ * address gives the pointers in the frame, which are double-pointers
+ * like global pointers.  It also gives where in the frame the
+ * caller's return address is stored, and how far above this frame
+ * the caller's frame lies.  The walk stops at the first return
+ * address which has no descriptor.
+ *
+ * \brief A frame descriptor for the garbage collector.
+ */
+typedef struct {
+
+  /*!
+   * This is the return address described by this descriptor.
+   *
+   * \brief The return address.
+   */
+  const void* fd_retaddr;
+
+  /*!
+   * This is the distance in bytes from this frame to the caller's
+   * frame.
+   *
+   * \brief The size of the frame.
+   */
+  unsigned int fd_size;
+
+  /*!
+   * This is the offset in bytes within the frame of the caller's
+   * return address.
+   *
+   * \brief The offset of the caller's return address.
+   */
+  unsigned int fd_retaddr_offset;
+
+  /*!
+   * This is the number of double-pointers in the frame.
+   *
+   * \brief The number of pointers.
+   */
+  unsigned int fd_num_ptrs;
+
+  /*!
+   * These are the offsets in bytes within the frame of each
+   * double-pointer.
+   *
+   * \brief The offsets of the pointers.
+   */
+  const unsigned int* fd_ptrs;
+
+} gc_framedesc_t;
+
+
+/*!
+ * This is the frame descriptor table, which is provided by the
+ * program.  This must be sorted by return address.
+ *
+ * \brief The frame descriptors.
+ */
+extern const gc_framedesc_t gc_frame_descs[];
+
+/*!
+ * This is the number of entries in gc_frame_descs.
+ *
+ * \brief The number of frame descriptors.
+ */
+extern const unsigned int gc_frame_desc_count;
+
+
 /*!
  * This function initializes normal object header.  It is used to
  * create a new object in the destination space.  Only type
@@ -5,15 +5,55 @@
 
 #include "definitions.h"
 #include "mm/gc_desc.h"
+#include "mm/gc_deque.h"
 
 #include <stdbool.h>
 
+/* The thread header includes this one, through the allocator. */
+struct thread_t;
+
+/*!
+ * This is the number of entries in a thread's write log to begin
+ * with.
+ *
+ * \brief The initial size of a write log.
+ */
+#define GC_WRITE_LOG_LENGTH 64
+
+/*!
+ * This is the largest a write log may grow.  Write logs double in
+ * size when they fill up more than GC_WRITE_LOG_GROW_FILLS times in
+ * one collection, up to this size.
+ *
+ * \brief The maximum size of a write log.
+ */
+#define GC_WRITE_LOG_MAX_LENGTH 1024
+
+/*!
+ * This is the number of times a write log may fill up during one
+ * collection before it is grown.
+ *
+ * \brief The number of fills before a write log grows.
+ */
+#define GC_WRITE_LOG_GROW_FILLS 4
+
+/*!
+ * This is the number of slots in a bucket of the write log dedup
+ * table.  A bucket fills exactly one cache line.
+ *
+ * \brief The number of slots in a dedup bucket.
+ */
+#define GC_WRITE_LOG_BUCKET_SIZE (CACHE_LINE_SIZE / sizeof(void*))
+
 /*!
- * This is the number of entries in a thread's write log.
+ * This is the number of buckets in the write log dedup table.  This
+ * must be a power of two, and is chosen to keep the table at most
+ * half full.
  *
- * \brief The size of a write log.
+ * \brief The number of dedup buckets.
  */
-#define GC_WRITE_LOG_SIZE 64
+#define GC_WRITE_LOG_BUCKETS \
+  ((2 * GC_WRITE_LOG_MAX_LENGTH) / GC_WRITE_LOG_BUCKET_SIZE)
 
 /*!
  * This is the minimum number of elements for an array to be processed
@@ -41,6 +81,35 @@
  */
 #define GC_ARRAY_CLUSTER_SIZE 16
 
+/*!
+ * This is the size above which scalar arrays are copied bypassing the
+ * cache.  Nothing reads them back during a collection, and copying
+ * them through the cache would push out the rest of the collector's
+ * working set.
+ *
+ * \brief The minimum size for bulk copying of scalar arrays.
+ */
+#define GC_ARRAY_BULK_COPY_SIZE 0x10000
+
+/*!
+ * This is the number of frames scanned at a time in a thread's stack.
+ * The rest of the stack is left behind a stack barrier, and scanned
+ * later.
+ *
+ * \brief The number of stack frames scanned at once.
+ */
+#define GC_STACK_BARRIER_DEPTH 16
+
+/*!
+ * This is the number of blocks a collector takes off of its queue
+ * ahead of processing them.  Each is prefetched as it is taken, so
+ * the cache misses on their headers overlap.  Blocks which have been
+ * taken can't be stolen, so this should be small.
+ *
+ * \brief The depth of the prefetch ring.
+ */
+#define GC_PREFETCH_DEPTH 8
+
 
 /*!
  * This is a single allocator.  One such allocator exists for each
@@ -58,131 +127,136 @@ typedef void* gc_allocator_t[2];
 
 
 /*!
- * This is a hash node used to process write log entries.  This helps
- * avoid processing the same location multiple times.
+ * This is a bucket in the table used to find duplicate write log
+ * entries.  Each slot holds an object address, or NULL.  Slots are
+ * filled in order and only emptied all at once, so the used slots
+ * are always at the front, and a bucket can be probed by comparing
+ * every slot at once.
+ *
+ * \brief A bucket in the write log dedup table.
+ */
+typedef union {
+
+  const void* wb_slots[GC_WRITE_LOG_BUCKET_SIZE];
+  cache_line_t _;
+
+} gc_write_log_bucket_t;
+
+/*!
+ * This is the closure for a garbage collection thread.  This can be
+ * thought of as thread-local data.  A pointer to this structure is
+ * passed as a parameter to the gc_thread function.
  *
- * \brief A hash node used to process write log entries.
+ * \brief A garbage collection thread's closure.
  */
-typedef struct gc_write_log_hash_node_t {
+typedef struct {
 
   /*!
-   * This is the next pointer for a list of unique locations.  The
-   * node in inserted into the hash table and the unique list only
-   * once.
+   * This is this thread's work-stealing deque, which holds most of
+   * its queue of blocks to process.
    *
-   * \brief The next pointer for the unique list.
+   * \brief The work-stealing deque.
    */
-  struct gc_write_log_hash_node_t* wh_list_next;
+  gc_deque_t* gth_deque;
 
   /*!
-   * This is the next pointer for the bucket lists in a hash table.
-   * The node in inserted into this table, and subsequent inserts are
-   * ignored.
+   * This is the state of the random number generator used to choose
+   * which collector to steal from.
    *
-   * \brief The next pointer for the hash table.
+   * \brief The seed for choosing victims.
    */
-  struct gc_write_log_hash_node_t* wh_hash_next;
+  unsigned int gth_steal_seed;
 
   /*!
-   * This is the write log entry whose address is represented by this
-   * node.
+   * This is the last phase change epoch this collector acknowledged.
    *
-   * \brief The log entry.
+   * \brief The last acknowledged epoch.
    */
-  volatile gc_log_entry_t* wh_log_entry;
+  unsigned int gth_epoch;
 
-} gc_write_log_hash_node_t;
+  /*!
+   * This is the head of the overflow list, which holds blocks which
+   * didn't fit in the deque.  Dequeues happen here.
+   *
+   * \brief The head of the overflow list.
+   */
+  volatile void* gth_head;
 
-/*!
- * This is the closure for a garbage collection thread.  This can be
- * thought of as thread-local data.  A pointer to this structure is
- * passed as a parameter to the gc_thread function.
- *
- * \brief A garbage collection thread's closure.
- */
-typedef struct {
+  /*!
+   * This is the tail of the overflow list.  Enqueues happen here.
+   *
+   * \brief The tail of the overflow list.
+   */
+  volatile void* gth_tail;
 
   /*!
-   * This is a special counter which controls action on the workshare
-   * queue.  Because keeping a total count of all objects presently
-   * known to the collector is not feasible, the upper and lower
-   * bounds on the number of objects in one gc_closure's queue has to
-   * be constant.  This will create a situation of high contention on
-   * the queue in many cases.  Therefore, this counter is used to
-   * reduce the number of accesses to the workshare.
+   * These are the blocks which have been taken off of the queue and
+   * prefetched, but not processed yet.  This is a ring buffer.
    *
-   * The counter represents an estimate of how many objects the thread
-   * needs to add or remove from the workshare to be balanced
-   * (positive values represent the need to add, negative values
-   * represent the need to remove).  A value of the workshare queue
-   * capacity / number of executors is used as moderator value.
-   * Threads begin collection with a count of +moderator.  The
-   * count has a range of -moderator to +moderator.  If a pull fails,
-   * the count is reset to +moderator.  If a push fails, the counter
-   * is reset to -moderator.  If a pull fails, it is reset to
-   * +moderator.  Otherwise, everytime the thread intends to push, it
-   * decrements, and everytime it intends to pull, it increments.
+   * \brief The prefetch ring.
+   */
+  volatile void* gth_prefetch_ring[GC_PREFETCH_DEPTH];
+
+  /*!
+   * This is the index of the oldest block in the prefetch ring.
    *
-   * Which action the thread intends to do, and whether or not it
-   * actually attempts it is determined from the count and the number
-   * of items in the local queue.  The value count + (moderator -
-   * local) is calculated.  If this value is negative, the thread will
-   * intend to pull.  If it is positive, the thread will intend to
-   * push.  The raw count is used in the same way to determine whether
-   * or not the action is actually done.  Regardless, if the thread
-   * intends to pull, it increments count, and if it intends to push,
-   * it decrements it.
+   * \brief The head of the prefetch ring.
+   */
+  unsigned int gth_prefetch_head;
+
+  /*!
+   * This is the number of blocks in the prefetch ring.
    *
-   * \brief A counter for the next action on the workshare queue.
+   * \brief The number of prefetched blocks.
    */
-  int gth_workshare_count;
+  unsigned int gth_prefetch_count;
 
   /*!
-   * This is the number of blocks in the local block queue.
+   * This is the number of write log entries the mutators on this
+   * executor may use before the log is full.
    *
-   * \brief The number of blocks in the queue.
+   * \brief The write log limit.
    */
-  unsigned int gth_queue_size;
+  unsigned int gth_write_log_limit;
 
   /*!
-   * This is the head of the local queue.  Dequeues happen here.
+   * This is the number of times the write log has filled up during
+   * the current collection.
    *
-   * \brief The head of the local queue.
+   * \brief The number of write log fills.
    */
-  volatile void* gth_head;
+  unsigned int gth_write_log_fills;
 
   /*!
-   * This is the tail of the local queue.  Enqueues happen here.
+   * This is the write log processed by this GC thread.
    *
-   * \brief The tail of the local queue.
+   * \brief The write log.
    */
-  volatile void* gth_tail;
+  volatile gc_log_entry_t* gth_write_log;
 
   /*!
-   * This is the head of a list used to determine all the unique
-   * locations affected by a given write log.
+   * These are the indexes of the unique entries found in the write
+   * log, in the order they were found.
    *
-   * \brief Head of a list used to process write logs.
+   * \brief The unique write log entries.
    */
-  gc_write_log_hash_node_t* gth_unique_list;
+  unsigned int gth_unique_entries[GC_WRITE_LOG_MAX_LENGTH];
 
   /*!
-   * This is a collection of hash nodes used to process write logs.
-   * This avoids multiple processing of a given location.  These are
-   * pre-allocated to avoid calling malloc.
+   * This is the table used to find duplicate write log entries.  This
+   * is open-addressed, and emptied after each write log is processed.
    *
-   * \brief Hash nodes for processing write logs.
+   * \brief The write log dedup table.
    */
-  gc_write_log_hash_node_t gth_hash_nodes[GC_WRITE_LOG_SIZE];
+  gc_write_log_bucket_t gth_dedup_table[GC_WRITE_LOG_BUCKETS];
 
   /*!
-   * This is a pre-allocated hash table used for processing write
-   * logs.  This helps avoid processing the same location multiple
-   * times.
+   * These are the indexes of the dedup table buckets used while
+   * processing the current write log.
    *
-   * \brief Hash table for processing write logs.
+   * \brief The used dedup buckets.
    */
-  gc_write_log_hash_node_t* gth_hash_table[1024];
+  unsigned int gth_dedup_used[GC_WRITE_LOG_BUCKETS];
 
   /*!
    * There are the allocators for this garbage collection thread.
@@ -204,10 +278,12 @@ typedef struct {
  * \brief Calculate memory required by collector threads.
  * \arg execs The number of executors.
  * \arg gens The number of generations.
+ * \arg threads The size of the thread table.
  * \return The size of memory required by collector threads.
  */
 internal unsigned int gc_thread_request(unsigned int execs,
-					unsigned int gens);
+					unsigned int gens,
+					unsigned int threads);
 
 /*!
  * Initialize garbage collection thread structures for some number of
@@ -217,12 +293,13 @@ internal unsigned int gc_thread_request(unsigned int execs,
  *
  * \brief Setup garbage collection threads.
  * \arg execs The number of executors.
+ * \arg threads The size of the thread table.
  * \arg mem The statically allocated memory available to the
  * subsystem.
  * \return The new free space.
  */
 internal void* gc_thread_init(unsigned int execs, unsigned int num_gen,
-			      void* restrict mem);
+			      unsigned int threads, void* restrict mem);
 
 /*!
  * This function initializes the gc_thread_t structure corresponding
@@ -232,9 +309,11 @@ internal void* gc_thread_init(unsigned int execs, unsigned int num_gen,
  * \brief Initialize a gc_thread for a given executor.
  * \arg thread The gc_thread_t to initialize.
  * \arg log The write log that will be processed by this GC thread.
+ * \arg exec The executor ID.
  */
 internal void gc_closure_init(gc_closure_t* closure,
-			      volatile gc_log_entry_t* log);
+			      volatile gc_log_entry_t* log,
+			      unsigned int exec);
 
 /*!
  * This function activates the garbage collector threads, starting the
@@ -248,6 +327,55 @@ internal void gc_closure_init(gc_closure_t* closure,
  */
 internal void gc_thread_activate(unsigned char gen);
 
+/*!
+ * This function gets the forwarding pointer of an unclaimed object in
+ * a generation.  Objects allocated by the program must start out with
+ * this.
+ *
+ * \brief Get the unclaimed forwarding pointer value.
+ * \arg gen The generation.
+ * \return The unclaimed forwarding pointer value.
+ */
+internal void* gc_thread_unclaimed(unsigned char gen);
+
+/*!
+ * This function makes the current thread do some of the collector's
+ * tracing work, in proportion to what it has allocated.  This is
+ * called when a thread gets new memory during a collection.  It does
+ * nothing if there is no work to be had.
+ *
+ * \brief Make a thread assist the collector.
+ * \arg work The number of bytes of objects to process.
+ */
+internal void gc_thread_assist(unsigned int work);
+
+
+/*!
+ * This function is called by an executor before it resumes a thread.
+ * Collectors never scan the stacks of running threads, so if the top
+ * of the thread's stack hasn't been scanned in the current phase of a
+ * collection, the executor scans it here.  If a collector is scanning
+ * it, this waits for the collector to finish.
+ *
+ * \brief Scan a thread's stack before resuming it.
+ * \arg thread The thread, which must not be running.
+ * \arg allocators The allocators of the executor.
+ * \arg exec The executor ID.
+ */
+internal void gc_thread_resume(struct thread_t* restrict thread,
+			       volatile gc_allocator_t* allocators,
+			       unsigned int exec);
+
+/*!
+ * This function is called when a thread is destroyed.  If collectors
+ * may be scanning the thread's stack, the collector keeps the thread,
+ * and destroys it again once the collection is done.
+ *
+ * \brief Keep a dead thread until the collection is done.
+ * \arg thread The thread.
+ * \return Whether the collector kept the thread.
+ */
+internal bool gc_thread_keep_dead(struct thread_t* restrict thread);
 
 /*!
  * This function is the entry function for garbage collector threads.
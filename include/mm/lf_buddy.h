@@ -0,0 +1,130 @@
+/* Copyright (c) 2008 Eric McCorkle.  All rights reserved. */
+
+#ifndef LF_BUDDY_H
+#define LF_BUDDY_H
+
+#include "definitions.h"
+#include "atomic.h"
+#include "mm/slice.h"
+
+/*!
+ * This is the base-2 logarithm of the smallest block the buddy
+ * allocator hands out.
+ *
+ * \brief Log of the minimum buddy block size.
+ */
+#define LF_BUDDY_MIN_SHIFT 14
+
+/*!
+ * This is the base-2 logarithm of the size of a buddy arena.  An
+ * arena is a single malloc slice, and the largest block which can be
+ * allocated from it is half of this (the first minimum-sized block
+ * holds the arena header).
+ *
+ * \brief Log of the buddy arena size.
+ */
+#define LF_BUDDY_ARENA_SHIFT 23
+
+/*!
+ * This is the size of a buddy arena.
+ *
+ * \brief The buddy arena size.
+ */
+#define LF_BUDDY_ARENA_SIZE (1 << LF_BUDDY_ARENA_SHIFT)
+
+/*!
+ * This is the number of levels in an arena's block tree.
+ *
+ * \brief Number of levels in a buddy tree.
+ */
+#define LF_BUDDY_LEVELS (LF_BUDDY_ARENA_SHIFT - LF_BUDDY_MIN_SHIFT + 1)
+
+/*!
+ * This is the largest block the buddy allocator will hand out.
+ * Anything larger must be allocated as its own slice.
+ *
+ * \brief The maximum buddy block size.
+ */
+#define LF_BUDDY_MAX_SIZE (LF_BUDDY_ARENA_SIZE >> 1)
+
+/*!
+ * This is the type of a buddy arena.  Arenas are created on demand
+ * and never destroyed; their blocks coalesce on free and are reused.
+ *
+ * \brief Type of a buddy arena.
+ */
+typedef struct lf_buddy_arena_t lf_buddy_arena_t;
+
+struct lf_buddy_arena_t {
+
+  /*!
+   * This is the slice holding this arena.  The arena header lives at
+   * the beginning of the slice's memory.
+   *
+   * \brief The slice holding the arena.
+   */
+  slice_t* ba_slice;
+
+  /*!
+   * This is the next arena.  Arenas are only ever pushed onto the
+   * list, so this is effectively constant once the arena is
+   * published.
+   *
+   * \brief The next arena.
+   */
+  lf_buddy_arena_t* ba_next;
+
+  /*!
+   * This is the block tree, stored as an implicit binary heap (the
+   * root is at index 1, and the children of node n are 2n and 2n+1).
+   * Each word has LF_BUDDY_OCC set if the node is allocated as a
+   * whole, and holds a count of allocated descendants in the
+   * remaining bits.  A node may be allocated only when its word is
+   * zero, which makes coalescing implicit.
+   *
+   * \brief The block tree.
+   */
+  volatile atomic_uint_t ba_tree[1 << LF_BUDDY_LEVELS];
+
+};
+
+
+/*!
+ * This function allocates a block of at least the given size from a
+ * buddy arena, creating a new arena if all existing ones are full.
+ * Blocks are aligned to their size relative to the arena base.
+ *
+ * \brief Allocate a block from the buddy allocator.
+ * \arg size The size of the block.  Must be no more than
+ * LF_BUDDY_MAX_SIZE.
+ * \arg arena A pointer to where to store the arena from which the
+ * block was allocated.
+ * \arg node A pointer to where to store the block's tree node.
+ * \return A pointer to the block, or NULL if no memory is available.
+ */
+internal void* lf_buddy_alloc(unsigned int size, lf_buddy_arena_t** arena,
+			      unsigned int* node);
+
+
+/*!
+ * This function returns a block to its arena.  The block coalesces
+ * with its free buddies automatically.
+ *
+ * \brief Free a block from the buddy allocator.
+ * \arg arena The arena from which the block was allocated.
+ * \arg node The block's tree node.
+ */
+internal void lf_buddy_free(lf_buddy_arena_t* arena, unsigned int node);
+
+
+/*!
+ * This function gets the size of the block represented by a tree
+ * node.
+ *
+ * \brief Get the size of a buddy block.
+ * \arg node The block's tree node.
+ * \return The size of the block.
+ */
+internal pure unsigned int lf_buddy_node_size(unsigned int node);
+
+#endif
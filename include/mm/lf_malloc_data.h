@@ -9,6 +9,7 @@
 #include "arch.h"
 
 typedef uint64_t anchor_t;
+typedef uint64_t tagged_t;
 
 #if (32 == BITS)
 typedef uint32_t active_t;
@@ -197,4 +198,35 @@ internal pure void* active_get_ptr(active_t active);
  */
 internal pure active_t active_set_ptr(active_t active, const void* ptr);
 
+/*!
+ * This function creates a tagged pointer from a pointer and a tag.
+ * Tagged pointers are used as the heads of lock-free stacks, where
+ * the tag is incremented on every update to avoid the ABA problem.
+ *
+ * \brief Create a tagged pointer.
+ * \arg ptr The pointer value.
+ * \arg tag The tag value.
+ * \return The tagged pointer.
+ */
+internal pure tagged_t tagged_create(const void* restrict ptr,
+				     unsigned int tag);
+
+/*!
+ * This function extracts the pointer from a tagged pointer.
+ *
+ * \brief Get the pointer from a tagged pointer.
+ * \arg tagged The tagged pointer.
+ * \return The pointer.
+ */
+internal pure void* tagged_get_ptr(tagged_t tagged);
+
+/*!
+ * This function extracts the tag from a tagged pointer.
+ *
+ * \brief Get the tag from a tagged pointer.
+ * \arg tagged The tagged pointer.
+ * \return The tag.
+ */
+internal pure unsigned int tagged_get_tag(tagged_t tagged);
+
 #endif
@@ -0,0 +1,168 @@
+/* Copyright (c) 2008 Eric McCorkle.  All rights reserved. */
+
+#ifndef LF_REGION_H
+#define LF_REGION_H
+
+#include "definitions.h"
+#include "atomic.h"
+#include "mm/slice.h"
+
+/*!
+ * This is the base-2 logarithm of the size of a malloc region.
+ *
+ * \brief Log of the region size.
+ */
+#define LF_REGION_SHIFT 22
+
+/*!
+ * This is the size of a malloc region.  Each region is a single
+ * slice, which is mapped once and then carved into superblocks.
+ *
+ * \brief The region size.
+ */
+#define LF_REGION_SIZE (1 << LF_REGION_SHIFT)
+
+/*!
+ * This is the base-2 logarithm of the size of the units handed out
+ * by the region allocator.
+ *
+ * \brief Log of the region unit size.
+ */
+#define LF_REGION_UNIT_SHIFT 14
+
+/*!
+ * This is the size of the units handed out by the region allocator.
+ *
+ * \brief The region unit size.
+ */
+#define LF_REGION_UNIT_SIZE (1 << LF_REGION_UNIT_SHIFT)
+
+/*!
+ * This is the number of units in a region.
+ *
+ * \brief The number of units in a region.
+ */
+#define LF_REGION_UNITS (1 << (LF_REGION_SHIFT - LF_REGION_UNIT_SHIFT))
+
+/*!
+ * This is the number of words in a region's unit bitmap.
+ *
+ * \brief The size of a region bitmap.
+ */
+#define LF_REGION_BITMAP_SIZE (LF_REGION_UNITS / (WORD_SIZE * 8))
+
+/*!
+ * This is the largest number of units which can be allocated at
+ * once.  Multi-unit allocations must be a power of two in size, and
+ * are aligned to their size.
+ *
+ * \brief The maximum number of units in one allocation.
+ */
+#define LF_REGION_MAX_UNITS (WORD_SIZE * 8)
+
+/*!
+ * This is the type of a malloc region.  This is the intermediate
+ * layer between the slice allocator and malloc superblocks.  Regions
+ * are never unmapped; when a region becomes entirely empty, its
+ * memory is released to the OS with SLICE_USAGE_BLANK, and the OS
+ * reclaims it lazily.
+ *
+ * Each region's slice has the region as its private data, so the
+ * region containing any address can be found with slice_lookup.
+ *
+ * \brief Type of a malloc region.
+ */
+typedef struct lf_region_t lf_region_t;
+
+struct lf_region_t {
+
+  /*!
+   * This is the slice holding this region.  This is NULL until the
+   * region is fully initialized.
+   *
+   * \brief The slice holding this region.
+   */
+  slice_t* volatile r_slice;
+
+  /*!
+   * This is the number of units currently allocated from this region.
+   *
+   * \brief The number of used units.
+   */
+  volatile atomic_uint_t r_used;
+
+  /*!
+   * This is the allocation bitmap.  A set bit means the unit is in
+   * use.
+   *
+   * \brief The unit allocation bitmap.
+   */
+  volatile atomic_uint_t r_bitmap[LF_REGION_BITMAP_SIZE];
+
+  /*!
+   * This is the owner of each unit, as set by lf_region_set_owner.
+   * Malloc uses this to find the descriptor for a block without
+   * storing it in the block.
+   *
+   * \brief The owner of each unit.
+   */
+  void* volatile r_owner[LF_REGION_UNITS];
+
+};
+
+
+/*!
+ * This function allocates a contiguous run of units from a region,
+ * mapping a new region if all existing ones are full.  The run is
+ * aligned to its size.
+ *
+ * \brief Allocate units from a region.
+ * \arg units The number of units.  This must be a power of two, no
+ * greater than LF_REGION_MAX_UNITS.
+ * \arg region A pointer to where to store the region from which the
+ * units were allocated.
+ * \return A pointer to the units, or NULL if no memory is available.
+ */
+internal void* lf_region_alloc(unsigned int units, lf_region_t** region);
+
+
+/*!
+ * This function returns a run of units to its region.  If this
+ * leaves the region empty, its memory is released to the OS.
+ *
+ * \brief Free units from a region.
+ * \arg region The region to which the units belong.
+ * \arg ptr A pointer to the units.
+ * \arg units The number of units, as given to lf_region_alloc.
+ */
+internal void lf_region_free(lf_region_t* region, void* ptr,
+			     unsigned int units);
+
+
+/*!
+ * This function records the owner of a run of units.  The owner
+ * stays in place until it is set again, even after the units are
+ * freed.
+ *
+ * \brief Set the owner of units in a region.
+ * \arg region The region to which the units belong.
+ * \arg ptr A pointer to the units.
+ * \arg units The number of units.
+ * \arg owner The owner.
+ */
+internal void lf_region_set_owner(lf_region_t* region, void* ptr,
+				  unsigned int units, void* owner);
+
+
+/*!
+ * This function gets the owner of the unit containing a given
+ * address.  This works for any address, including those which don't
+ * belong to a region at all, in which case the result is NULL.
+ *
+ * \brief Find the owner of the unit containing an address.
+ * \arg ptr The address.
+ * \return The owner of the unit, or NULL.
+ */
+internal void* lf_region_owner(const void* ptr);
+
+#endif
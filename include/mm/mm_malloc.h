@@ -3,6 +3,62 @@
 #ifndef MM_MALLOC_H
 #define MM_MALLOC_H
 
+/*!
+ * This is the number of free blocks each executor may hold in its
+ * private cache for a single size class.  Allocations and frees
+ * which hit the cache do not touch any shared state.  When a cache
+ * runs empty, it is refilled with half this many blocks; when it
+ * fills up, half of it is returned to the shared superblocks.
+ *
+ * \brief The depth of each per-executor, per-size-class malloc cache.
+ */
+#ifndef MALLOC_CACHE_DEPTH
+#define MALLOC_CACHE_DEPTH 32
+#endif
+
+/*!
+ * This is the base-2 logarithm of the smallest malloc size class.
+ * This is also the alignment of all small blocks.
+ *
+ * \brief Log of the minimum malloc block size.
+ */
+#ifndef MALLOC_MIN_SHIFT
+#define MALLOC_MIN_SHIFT 4
+#endif
+
+/*!
+ * This is the base-2 logarithm of the largest size class.  Requests
+ * larger than this are served by the buddy allocator, or as whole
+ * slices.
+ *
+ * \brief Log of the maximum small block size.
+ */
+#ifndef MALLOC_MAX_SMALL_SHIFT
+#define MALLOC_MAX_SMALL_SHIFT 14
+#endif
+
+/*!
+ * This is the base-2 logarithm of the number of size classes between
+ * each power of two.  Internal fragmentation of small blocks is no
+ * more than one part in 1 << MALLOC_SPLIT_SHIFT.
+ *
+ * \brief Log of the number of size classes per doubling.
+ */
+#ifndef MALLOC_SPLIT_SHIFT
+#define MALLOC_SPLIT_SHIFT 2
+#endif
+
+/*!
+ * This is the smallest number of blocks in a superblock.  Superblocks
+ * for large size classes are scaled up until they hold at least this
+ * many blocks.
+ *
+ * \brief The minimum number of blocks per superblock.
+ */
+#ifndef MALLOC_SB_MIN_BLOCKS
+#define MALLOC_SB_MIN_BLOCKS 16
+#endif
+
 
 /*!
  * This function calculates the required size of statically-allocated
@@ -74,6 +130,22 @@ extern void* malloc_lf(unsigned int size, unsigned int exec);
  */
 extern void free_lf(void* ptr, unsigned int exec);
 
+/*!
+ * This function reports the effectiveness of an executor's malloc
+ * caches.  Hits are allocations satisfied entirely from the cache,
+ * misses are allocations which had to refill it from the shared
+ * superblocks.  The counts are summed over all size classes.  These
+ * are not synchronized, and are only meant for tuning
+ * MALLOC_CACHE_DEPTH.
+ *
+ * \brief Get the hit and miss counts for an executor's malloc cache.
+ * \arg exec The ID of the executor.
+ * \arg hits A pointer to where to store the number of hits.
+ * \arg misses A pointer to where to store the number of misses.
+ */
+internal void malloc_cache_stats(unsigned int exec, unsigned int* hits,
+				 unsigned int* misses);
+
 /*!
  * This function releases unused memory from explicitly managed
  * memory.  It will attempt to confine the total memory size to the
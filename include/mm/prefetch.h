@@ -0,0 +1,18 @@
+/* Copyright (c) 2008 Eric McCorkle.  All rights reserved. */
+
+#ifndef PREFETCH_H
+#define PREFETCH_H
+
+#include "definitions.h"
+
+/*!
+ * This function hints to the processor that the cache line holding
+ * an address will be read soon.  It never faults, even if the address
+ * is invalid, and returns immediately.
+ *
+ * \brief Prefetch a cache line.
+ * \arg addr The address to prefetch.
+ */
+internal void prefetch(volatile const void* addr);
+
+#endif
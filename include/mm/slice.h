@@ -86,6 +86,39 @@ extern const unsigned int slice_max_size;
  */
 extern const unsigned int slice_min_size;
 
+/*!
+ * This is passed as the executor to slice functions called from
+ * outside any executor, or from code which does not know its
+ * executor.  Space accounting for these goes directly to the global
+ * counters.
+ *
+ * \brief No executor.
+ */
+#define SLICE_EXEC_NONE ((unsigned int)-1)
+
+/*!
+ * These are the values of mm_huge_pages.
+ * - MM_HUGE_PAGES_NONE: use normal pages only.
+ * - MM_HUGE_PAGES_TRANSPARENT: align GC and malloc slices to
+ *   HUGE_PAGE_SIZE and ask for transparent huge pages.
+ * - MM_HUGE_PAGES_EXPLICIT: as MM_HUGE_PAGES_TRANSPARENT, and also
+ *   back static slices with explicitly reserved huge pages where
+ *   available.
+ *
+ * \brief Huge page modes.
+ */
+#define MM_HUGE_PAGES_NONE 0
+#define MM_HUGE_PAGES_TRANSPARENT 1
+#define MM_HUGE_PAGES_EXPLICIT 2
+
+/*!
+ * This is the huge page mode used for new slices.  This is set by the
+ * launcher, and must not change once the memory manager is started.
+ *
+ * \brief Huge page mode.
+ */
+extern unsigned int mm_huge_pages;
+
 /*!
  * This structure describes a slice.  A slice is a large block of
  * memory allocated from an operating system facility such as mmap.
@@ -166,6 +199,15 @@ typedef struct slice_t {
    */
   struct slice_t* s_next;
 
+  /*!
+   * This is private data belonging to the allocator which owns the
+   * slice.  It is NULL when the slice is allocated, and the slice
+   * allocator never looks at it.
+   *
+   * \brief Allocator-private data.
+   */
+  void* s_data;
+
 } slice_t;
 
 
@@ -194,6 +236,36 @@ typedef struct {
 internal void slice_init(unsigned int max, unsigned int defaultsize,
 			 unsigned int malloc_max, unsigned int gc_max);
 
+/*!
+ * This function calculates the size of the static structures the
+ * slice allocator needs for per-executor space accounting.
+ *
+ * This function must return a multiple of CACHE_LINE_SIZE.
+ *
+ * \brief Get the size of the slice allocator's per-executor
+ * structures.
+ * \arg execs The number of executors.
+ * \return The size of the structures.
+ */
+internal unsigned int slice_request(unsigned int execs);
+
+/*!
+ * This function sets up per-executor space accounting, using memory
+ * of the size given by slice_request.  Until this is called, all
+ * accounting goes to the global counters.
+ *
+ * Each executor keeps a quota of space already reserved from the
+ * global counters, and draws on it without any atomic operations.
+ * Quotas are refilled and flushed in batches, so the global counters
+ * may run ahead of the space actually in use by a bounded amount.
+ *
+ * \brief Initialize per-executor slice accounting.
+ * \arg execs The number of executors.
+ * \arg mem The memory to use.
+ * \return The end of the memory used.
+ */
+internal void* slice_executor_init(unsigned int execs, void* mem);
+
 /*!
  * This function attempts to allocate a slice from the operating
  * system.  This may fail for a number of reasons, including lack of
@@ -203,10 +275,31 @@ internal void slice_init(unsigned int max, unsigned int defaultsize,
  * \arg type The type of the slice to allocate.
  * \arg prot The memory protections to request.
  * \arg size The size of the slice to allocate.
+ * \arg exec The executor ID, or SLICE_EXEC_NONE.
  * \return A slice descriptor.
  */
 internal slice_t* restrict slice_alloc(slice_type_t type, slice_prot_t prot,
-				       unsigned int size);
+				       unsigned int size, unsigned int exec);
+
+
+/*!
+ * This function allocates a slice like slice_alloc, but with its
+ * memory aligned to the given boundary.
+ *
+ * \brief Allocate an aligned slice of a given size and class.
+ * \arg type The type of the slice to allocate.
+ * \arg prot The memory protections to request.
+ * \arg size The size of the slice to allocate.
+ * \arg align The alignment of the slice.  This must be a power of
+ * two, and at least PAGE_SIZE.
+ * \arg exec The executor ID, or SLICE_EXEC_NONE.
+ * \return A slice descriptor.
+ */
+internal slice_t* restrict slice_alloc_aligned(slice_type_t type,
+					       slice_prot_t prot,
+					       unsigned int size,
+					       unsigned int align,
+					       unsigned int exec);
 
 
 /*!
@@ -215,8 +308,27 @@ internal slice_t* restrict slice_alloc(slice_type_t type, slice_prot_t prot,
  *
  * \brief Allocate a slice of a given size and class.
  * \arg type The slice to free.
+ * \arg exec The executor ID, or SLICE_EXEC_NONE.
  */
-internal void slice_free(slice_t* restrict slice);
+internal void slice_free(slice_t* restrict slice, unsigned int exec);
+
+
+/*!
+ * This function changes the size of a slice, preserving its
+ * contents.  The slice's memory may move, in which case s_ptr is
+ * updated.  The space accounting for the slice's type is adjusted
+ * accordingly.  If the slice cannot be resized, it is left unchanged.
+ * slice_lookup does not find the slice while it is being resized, so
+ * only its owner may use it during the call.
+ *
+ * \brief Resize a slice.
+ * \arg slice The slice to resize.
+ * \arg size The new size of the slice.
+ * \arg exec The executor ID, or SLICE_EXEC_NONE.
+ * \return Whether or not the slice was resized.
+ */
+internal bool slice_resize(slice_t* restrict slice, unsigned int size,
+			   unsigned int exec);
 
 
 /*!
@@ -230,6 +342,37 @@ internal void slice_free(slice_t* restrict slice);
  */
 internal void slice_set_usage(slice_t* restrict slice, slice_usage_t usage);
 
+/*!
+ * This function informs the kernel of a change in memory policy for
+ * part of a slice, for allocators which divide slices up further.
+ * Unlike slice_set_usage, this does not change the usage of the slice
+ * as a whole.  The range should be page-aligned.
+ *
+ * \brief Change the usage of part of a slice.
+ * \arg slice The slice containing the range.
+ * \arg ptr The start of the range.
+ * \arg size The size of the range.
+ * \arg usage The new usage policy.
+ */
+internal void slice_range_set_usage(const slice_t* restrict slice,
+				    void* restrict ptr, unsigned int size,
+				    slice_usage_t usage);
+
+/*!
+ * This function finds the slice containing a given address.  Any
+ * address may be given, including ones which do not belong to any
+ * slice, in which case the result is NULL.  This takes constant
+ * time, and never blocks.
+ *
+ * The result is only meaningful if the slice cannot be freed
+ * concurrently, which is up to the caller.
+ *
+ * \brief Find the slice containing an address.
+ * \arg ptr The address.
+ * \return The slice containing ptr, or NULL.
+ */
+internal slice_t* slice_lookup(const void* ptr);
+
 /*!
  * This function sets the memory protections on a slice.
  *
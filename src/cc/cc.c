@@ -35,13 +35,21 @@ unsigned int cc_request(cc_stat_t* const restrict stat) {
 
   PRINTD("Reserving space for concurrency system\n");
 
+  /* The garbage collector sizes its own structures from the size of
+   * the thread table, so settle it here.
+   */
+  if(0 == stat->cc_max_threads)
+    stat->cc_max_threads = THREAD_TAB_DEFAULT_SIZE;
+
   const unsigned int executor_size = executor_request(stat);
+  const unsigned int tab_size = thread_tab_request(stat->cc_max_threads);
 
   PRINTD("  Reserving 0x%x bytes for executor system\n", executor_size);
+  PRINTD("  Reserving 0x%x bytes for thread table\n", tab_size);
   PRINTD("Concurrency system total static size is 0x%x bytes.\n",
-	 executor_size);
+	 executor_size + tab_size);
 
-  return executor_size;
+  return executor_size + tab_size;
 
 }
 
@@ -66,9 +74,12 @@ noreturn void cc_start(cc_stat_t* const restrict stat,
     stat->cc_num_executors : 2;
   PRINTD("Initializing concurrency system with %u executors\n",
 	 stat->cc_num_executors);
+
+  void* const ptr = thread_tab_init(stat->cc_max_threads, mem);
+
   executor_start(stat->cc_num_executors,
 		 stat->cc_executor_stack_size,
-		 main, argc, argv, envp, mem);
+		 main, argc, argv, envp, ptr);
 
 }
 
@@ -88,7 +99,7 @@ void cc_stat(cc_stat_t* const restrict stat) {
   stat->cc_num_executors = executor_count();
   stat->cc_actual_executors = stat->cc_num_executors;
   stat->cc_executor_stack_size = 0;
-  stat->cc_max_threads = 0;
+  stat->cc_max_threads = thread_tab_size;
   stat->cc_num_threads = thread_count();
   stat->cc_active_threads = sched_active_thread_count();
 
@@ -5,6 +5,7 @@
 #include "definitions.h"
 #include "atomic.h"
 #include "cc/thread.h"
+#include "mm/gc_thread.h"
 
 /* Global invariant: bijection between increments and thread
  * creations, and decrements and thread destructions.
@@ -14,6 +15,118 @@ static volatile atomic_uint_t thread_num;
 /* Global invariant: monotonically increasing */
 static volatile atomic_uint_t thread_id;
 
+/* The thread table holds every live thread, so the garbage collector
+ * can find them all.  Entries which have never been used are handed
+ * out from thread_tab_used; freed entries go on a tagged list, with
+ * the index in the low half of the head and the tag in the high half.
+ */
+#define THREAD_TAB_LIST_TAG_SHIFT 32
+
+static thread_t* volatile * thread_tab;
+static unsigned int* thread_tab_next;
+static unsigned int thread_tab_size;
+static volatile atomic_uint_t thread_tab_used;
+static volatile atomic_uint64_t thread_tab_free_list;
+
+
+internal unsigned int thread_tab_request(const unsigned int size) {
+
+  const unsigned int tab_size =
+    size * (sizeof(thread_t*) + sizeof(unsigned int));
+  const unsigned int aligned_tab_size =
+    ((tab_size - 1) & ~(CACHE_LINE_SIZE - 1)) + CACHE_LINE_SIZE;
+
+  PRINTD("    Reserving 0x%x bytes for thread table\n", aligned_tab_size);
+
+  return aligned_tab_size;
+
+}
+
+
+internal void* thread_tab_init(const unsigned int size, void* const mem) {
+
+  INVARIANT(size != 0);
+
+  PRINTD("Initializing thread table with %u entries at 0x%p\n", size, mem);
+  thread_tab = mem;
+  thread_tab_next = (unsigned int*)(thread_tab + size);
+  thread_tab_size = size;
+  thread_tab_used.value = 0;
+  thread_tab_free_list.value = size;
+
+  return (char*)mem + thread_tab_request(size);
+
+}
+
+
+internal unsigned int thread_tab_count(void) {
+
+  const unsigned int used = thread_tab_used.value;
+
+  return used < thread_tab_size ? used : thread_tab_size;
+
+}
+
+
+internal thread_t* thread_tab_get(const unsigned int index) {
+
+  INVARIANT(index < thread_tab_size);
+
+  return thread_tab[index];
+
+}
+
+
+static inline bool thread_tab_try_alloc(unsigned int* const slot) {
+
+  const uint64_t oldhead = atomic_read_uint64(&thread_tab_free_list);
+  const unsigned int index = oldhead & 0xffffffff;
+  bool out = true;
+
+  /* The next array is static, so reading it is safe even if the entry
+   * was taken in the meantime; the tag catches that.
+   */
+  if(thread_tab_size != index) {
+
+    const uint64_t tag = (oldhead >> THREAD_TAB_LIST_TAG_SHIFT) + 1;
+    const uint64_t newhead =
+      (tag << THREAD_TAB_LIST_TAG_SHIFT) | thread_tab_next[index];
+
+    out = atomic_compare_and_set_uint64(oldhead, newhead,
+					&thread_tab_free_list);
+    *slot = index;
+
+  }
+
+  else {
+
+    const unsigned int used = atomic_fetch_inc_uint(&thread_tab_used) - 1;
+
+    if(used >= thread_tab_size)
+      panic("Thread table is full (%u entries)\n", thread_tab_size);
+
+    *slot = used;
+
+  }
+
+  return out;
+
+}
+
+
+static inline bool thread_tab_try_free(const unsigned int slot) {
+
+  const uint64_t oldhead = atomic_read_uint64(&thread_tab_free_list);
+  const uint64_t tag = (oldhead >> THREAD_TAB_LIST_TAG_SHIFT) + 1;
+  const uint64_t newhead = (tag << THREAD_TAB_LIST_TAG_SHIFT) | slot;
+
+  thread_tab_next[slot] = oldhead & 0xffffffff;
+  store_fence();
+
+  return atomic_compare_and_set_uint64(oldhead, newhead, &thread_tab_free_list);
+
+}
+
 internal void thread_init(thread_t* restrict thread,
 			  const thread_stat_t* restrict stat,
 			  const thread_mbox_t mbox) {
@@ -25,6 +138,13 @@ internal void thread_init(thread_t* restrict thread,
   PRINTD("Initializing thread %p\n", thread);
   thread->t_id = atomic_fetch_inc_uint(&thread_id);
   atomic_increment_uint(&thread_num);
+
+  for(unsigned int i = 1; !thread_tab_try_alloc(&(thread->t_slot)); i++)
+    backoff_delay(i);
+
+  thread->t_gc_barrier.value = 0;
+  thread->t_gc_barrier_slot = NULL;
+  thread->t_gc_scan.value = 0;
 #ifdef INTERACTIVE
   thread->t_hard_pri = stat->t_pri;
 #endif
@@ -34,6 +154,9 @@ internal void thread_init(thread_t* restrict thread,
   thread->t_sched_stat_ref.value =
     T_STAT_RUNNABLE == stat->t_sched_stat ? T_STAT_NONE : stat->t_sched_stat;
   memcpy((void*)(thread->t_mbox), mbox, sizeof(thread_mbox_t));
+  /* Publish the thread only once its mailbox is set up. */
+  store_fence();
+  thread_tab[thread->t_slot] = thread;
   PRINTD("State/ref count: %x\n", thread->t_sched_stat_ref.value);
   PRINTD("Initial mailbox state for thread %p: %p = [%p, %p, %p, %p\n"
 	 "                                           %p, %p, %p]\n",
@@ -61,11 +184,22 @@ internal void thread_destroy(unused thread_t* restrict thread) {
 
   INVARIANT(thread != NULL);
 
-  PRINTD("Destroying thread %p\n", thread);
-  atomic_decrement_uint(&thread_num);
+  /* Collectors may be looking at the thread, so it stays in the table
+   * until the collection is done.
+   */
+  if(!gc_thread_keep_dead(thread)) {
 
-  if(NULL != thread->t_destroy)
-    thread->t_destroy(thread);
+    PRINTD("Destroying thread %p\n", thread);
+    atomic_decrement_uint(&thread_num);
+    thread_tab[thread->t_slot] = NULL;
+
+    for(unsigned int i = 1; !thread_tab_try_free(thread->t_slot); i++)
+      backoff_delay(i);
+
+    if(NULL != thread->t_destroy)
+      thread->t_destroy(thread);
+
+  }
 
   /* Global invariants:
    * - Bijection between thread deletions and decrements to thread_num
@@ -158,3 +292,14 @@ thread_mbox_allocators(volatile thread_mbox_t mbox) {
   return out;
 
 }
+
+
+internal pure volatile unsigned int*
+thread_mbox_write_log_limit(volatile thread_mbox_t mbox) {
+
+  volatile gc_allocator_t* volatile * const ptr = thread_mbox_allocators(mbox);
+  volatile unsigned int* const out = (volatile unsigned int*)(ptr + 1);
+
+  return out;
+
+}
@@ -39,7 +39,8 @@ typedef struct executor_t {
 
   /*!
    * This is the highest available index for the GC write log.  If
-   * this is equal to GC_WRITE_LOG_LENGTH, then the write log is full.
+   * this is equal to the closure's write log limit, then the write
+   * log is full.
    *
    * \brief The highest available write log index.
    */
@@ -99,11 +100,11 @@ typedef struct executor_t {
   /*!
    * This is the garbage collection write log.  Writes record an entry
    * here, and when the log fills up, the garbage collector thread is
-   * run.
+   * run.  Only the first gth_write_log_limit entries are used.
    *
    * \brief The GC write log.
    */
-  volatile gc_log_entry_t ex_gc_write_log[GC_WRITE_LOG_LENGTH];
+  volatile gc_log_entry_t ex_gc_write_log[GC_WRITE_LOG_MAX_LENGTH];
 
   /*!
    * These are the garbage collection allocators for this executor.
@@ -269,6 +270,8 @@ static inline void executor_setup_threads(executor_t* const restrict exec,
     thread_mbox_write_log(exec->ex_idle_thread.t_mbox);
   volatile gc_allocator_t* volatile* const idle_allocator_ptr =
     thread_mbox_allocators(exec->ex_idle_thread.t_mbox);
+  volatile unsigned int* const idle_write_log_limit_ptr =
+    thread_mbox_write_log_limit(exec->ex_idle_thread.t_mbox);
   volatile retaddr_t * const gc_retaddr_ptr =
     thread_mbox_retaddr(exec->ex_gc_thread.t_mbox);
   volatile unsigned int* const gc_executor_ptr =
@@ -283,6 +286,8 @@ static inline void executor_setup_threads(executor_t* const restrict exec,
     thread_mbox_write_log(exec->ex_gc_thread.t_mbox);
   volatile gc_allocator_t* volatile* const gc_allocator_ptr =
     thread_mbox_allocators(exec->ex_gc_thread.t_mbox);
+  volatile unsigned int* const gc_write_log_limit_ptr =
+    thread_mbox_write_log_limit(exec->ex_gc_thread.t_mbox);
 
   PRINTD("Creating idle thread %p for executor %u\n",
 	 &(exec->ex_idle_thread), exec->ex_id);
@@ -298,6 +303,7 @@ static inline void executor_setup_threads(executor_t* const restrict exec,
   *idle_write_log_index_ptr = 0;
   *idle_write_log_ptr = exec->ex_gc_write_log;
   *idle_allocator_ptr = exec->ex_gc_allocators;
+  *idle_write_log_limit_ptr = exec->ex_gc_closure.gth_write_log_limit;
   PRINTD("Creating gc thread %p for executor %u\n",
 	 &(exec->ex_gc_thread), exec->ex_id);
   exec->ex_gc_thread.t_id = 0;
@@ -312,6 +318,7 @@ static inline void executor_setup_threads(executor_t* const restrict exec,
   *gc_write_log_index_ptr = 0;
   *gc_write_log_ptr = exec->ex_gc_write_log;
   *gc_allocator_ptr = exec->ex_gc_allocators;
+  *gc_write_log_limit_ptr = exec->ex_gc_closure.gth_write_log_limit;
 
 }
 
@@ -326,9 +333,10 @@ static inline void executor_init_state(executor_t* const restrict exec,
   exec->ex_c_stack = stkptr;
   PRINTD("Executor %u clearing write log\n", exec->ex_id);
   memset(exec->ex_gc_write_log, 0,
-	 GC_WRITE_LOG_LENGTH * sizeof(gc_log_entry_t));
+	 GC_WRITE_LOG_MAX_LENGTH * sizeof(gc_log_entry_t));
   PRINTD("Executor %u initializing gc closure\n", exec->ex_id);
-  gc_closure_init(&(exec->ex_gc_closure), exec->ex_gc_write_log);
+  gc_closure_init(&(exec->ex_gc_closure), exec->ex_gc_write_log,
+		  exec->ex_id);
   executor_setup_threads(exec, stkptr);
   scheduler_init(&(exec->ex_scheduler), &(exec->ex_idle_thread),
 		 &(exec->ex_gc_thread));
@@ -499,6 +507,8 @@ void executor_start_prog(void (*const main)(thread_t* restrict thread,
     thread_mbox_write_log(mbox);
   volatile gc_log_entry_t* volatile* const allocator_ptr =
     thread_mbox_allocators(mbox);
+  volatile unsigned int* const write_log_limit_ptr =
+    thread_mbox_write_log_limit(mbox);
 
   unused void* ptr = mem;
 
@@ -517,6 +527,7 @@ void executor_start_prog(void (*const main)(thread_t* restrict thread,
   *write_log_index_ptr = 0;
   *write_log_ptr = executors[0].ex_gc_write_log;
   *allocator_ptr = executors[0].ex_gc_allocators;
+  *write_log_limit_ptr = executors[0].ex_gc_closure.gth_write_log_limit;
   stat.t_sched_stat = T_STAT_RUNNABLE;
   stat.t_destroy = (void (*)(thread_t* ptr))free;
   thread_init(start_thread, &stat, mbox);
@@ -658,9 +669,18 @@ static inline noreturn void executor_get_new_thread(executor_t* const
     thread_mbox_write_log(thread->t_mbox);
   volatile gc_log_entry_t* volatile* const allocator_ptr =
     thread_mbox_allocators(thread->t_mbox);
+  volatile unsigned int* const write_log_limit_ptr =
+    thread_mbox_write_log_limit(thread->t_mbox);
   volatile void* const stkptr = *stkptr_ptr;
   const retaddr_t retaddr = *retaddr_ptr;
 
+  /* The collector doesn't scan running threads, so the top of the
+   * stack may have to be scanned before the thread runs.  The idle
+   * and collector threads have no program frames.
+   */
+  if(thread != &(exec->ex_idle_thread) && thread != &(exec->ex_gc_thread))
+    gc_thread_resume(thread, exec->ex_gc_allocators, exec->ex_id);
+
   PRINTD("Executor %u storing return context: (%u, %p)\n",
 	 exec->ex_id, exec->ex_id, exec->ex_c_stack);
   *executor_ptr = exec->ex_id;
@@ -669,6 +689,7 @@ static inline noreturn void executor_get_new_thread(executor_t* const
   *write_log_index_ptr = exec->ex_gc_write_log_index;
   *write_log_ptr = exec->ex_gc_write_log;
   *allocator_ptr = exec->ex_gc_allocators;
+  *write_log_limit_ptr = exec->ex_gc_closure.gth_write_log_limit;
   store_fence();
   /* This cannot change as long as I'm here */
   PRINTD("Executor %u loading context: %p (%p, %p)\n",
@@ -770,6 +791,24 @@ internal unsigned int executor_self(void) {
 }
 
 
+internal thread_t* executor_curr_thread(const unsigned int exec) {
+
+  INVARIANT(exec == executor_self());
+
+  return executors[exec].ex_scheduler.sch_curr_thread;
+
+}
+
+
+internal gc_closure_t* executor_gc_closure(const unsigned int exec) {
+
+  INVARIANT(exec == executor_self());
+
+  return &(executors[exec].ex_gc_closure);
+
+}
+
+
 static inline int executor_try_wakeup(executor_t* const restrict exec) {
 
   INVARIANT(exec != NULL);
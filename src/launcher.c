@@ -8,6 +8,9 @@
 #include "definitions.h"
 #include "program.h"
 #include "mm.h"
+#include "mm/slice.h"
+#include "mm/gc_card.h"
+#include "mm/gc_alloc.h"
 #include "cc.h"
 #include "arch.h"
 
@@ -28,6 +31,14 @@ static const char* const usage =
   "mm_malloc_limit\t\tMM_MALLOC_LIMIT\t\tMaximum unmanaged memory\n"
   "mm_slice_size\t\tMM_SLICE_SIZE\t\tSize of blocks allocated from OS\n"
   "mm_num_generations\t\tMM_NUM_GENERATIONS\t\tNumber of generations\n"
+  "mm_huge_pages\t\tMM_HUGE_PAGES\t\tHuge pages: 0 (off), 1 (transparent),\n"
+  "\t\t\t\t\t\tor 2 (explicit for static data)\n"
+  "mm_card_marking\t\tMM_CARD_MARKING\t\tWrite barrier: 0 (write log)\n"
+  "\t\t\t\t\t\tor 1 (card marking, remembered sets)\n"
+  "mm_gc_free_target\tMM_GC_FREE_TARGET\tFree space kept, as a percentage\n"
+  "\t\t\t\t\t\tof the recent live heap\n"
+  "mm_gc_shrink_decay\tMM_GC_SHRINK_DECAY\tPercentage the free space target\n"
+  "\t\t\t\t\t\tdecays each collection\n"
   "\n";
 
 static mm_stat_t mm_stats = {
@@ -85,7 +96,11 @@ static inline void print_mm_stats(void) {
 	 "  .mm_gc_live = 0x%x\n"
 	 "  .mm_slice_size = 0x%x\n"
 	 "  .mm_num_generations = 0x%x\n"
-	 "}\nmemory_manager = \"%s\"\n",
+	 "}\nmm_huge_pages = %u\n"
+	 "mm_card_marking = %u\n"
+	 "mm_gc_free_target = %u\n"
+	 "mm_gc_shrink_decay = %u\n"
+	 "memory_manager = \"%s\"\n",
 	 mm_stats.mm_total_limit,
 	 mm_stats.mm_malloc_limit,
 	 mm_stats.mm_gc_limit,
@@ -97,6 +112,10 @@ static inline void print_mm_stats(void) {
 	 mm_stats.mm_gc_live,
 	 mm_stats.mm_slice_size,
 	 mm_stats.mm_num_generations,
+	 mm_huge_pages,
+	 mm_card_marking,
+	 mm_gc_free_target,
+	 mm_gc_shrink_decay,
 	 memory_manager == NULL ? "default" : memory_manager);
 
 }
@@ -213,6 +232,78 @@ static int set_runtime_stats(const int argc, const char* const * const argv,
 
   }
 
+  if(NULL != (str = getenv("MM_HUGE_PAGES")) && strcmp(str, "")) {
+
+    value = strtoul(str, NULL, 10);
+
+    if(EINVAL != errno && MM_HUGE_PAGES_EXPLICIT >= value)
+      mm_huge_pages = value;
+
+    else {
+
+      fputs("MM_HUGE_PAGES environment variable must be 0, 1, or 2.\n\n",
+	    stderr);
+      fputs(usage, stderr);
+      exit(EXIT_FAILURE);
+
+    }
+
+  }
+
+  if(NULL != (str = getenv("MM_CARD_MARKING")) && strcmp(str, "")) {
+
+    value = strtoul(str, NULL, 10);
+
+    if(EINVAL != errno && GC_CARD_MARKING_ON >= value)
+      mm_card_marking = value;
+
+    else {
+
+      fputs("MM_CARD_MARKING environment variable must be 0 or 1.\n\n",
+	    stderr);
+      fputs(usage, stderr);
+      exit(EXIT_FAILURE);
+
+    }
+
+  }
+
+  if(NULL != (str = getenv("MM_GC_FREE_TARGET")) && strcmp(str, "")) {
+
+    value = strtoul(str, NULL, 10);
+
+    if(EINVAL != errno)
+      mm_gc_free_target = value;
+
+    else {
+
+      fputs("MM_GC_FREE_TARGET environment variable must be an integer.\n\n",
+	    stderr);
+      fputs(usage, stderr);
+      exit(EXIT_FAILURE);
+
+    }
+
+  }
+
+  if(NULL != (str = getenv("MM_GC_SHRINK_DECAY")) && strcmp(str, "")) {
+
+    value = strtoul(str, NULL, 10);
+
+    if(EINVAL != errno && 100 >= value)
+      mm_gc_shrink_decay = value;
+
+    else {
+
+      fputs("MM_GC_SHRINK_DECAY environment variable must be between "
+	    "0 and 100.\n\n", stderr);
+      fputs(usage, stderr);
+      exit(EXIT_FAILURE);
+
+    }
+
+  }
+
   if(NULL != (str = getenv("CC_NUM_EXECUTORS")) && strcmp(str, "")) {
 
     value = strtoul(str, NULL, 10);
@@ -431,6 +522,75 @@ static int set_runtime_stats(const int argc, const char* const * const argv,
 
       }
 
+      else if(!strcmp(argv[i], "mm_huge_pages") && argc > ++i) {
+
+	value = strtoul(argv[i], NULL, 10);
+
+	if(EINVAL != errno && MM_HUGE_PAGES_EXPLICIT >= value)
+	  mm_huge_pages = value;
+
+	else {
+
+	  fputs("mm_huge_pages argument must be 0, 1, or 2.\n\n", stderr);
+	  fputs(usage, stderr);
+	  exit(EXIT_FAILURE);
+
+	}
+
+      }
+
+      else if(!strcmp(argv[i], "mm_card_marking") && argc > ++i) {
+
+	value = strtoul(argv[i], NULL, 10);
+
+	if(EINVAL != errno && GC_CARD_MARKING_ON >= value)
+	  mm_card_marking = value;
+
+	else {
+
+	  fputs("mm_card_marking argument must be 0 or 1.\n\n", stderr);
+	  fputs(usage, stderr);
+	  exit(EXIT_FAILURE);
+
+	}
+
+      }
+
+      else if(!strcmp(argv[i], "mm_gc_free_target") && argc > ++i) {
+
+	value = strtoul(argv[i], NULL, 10);
+
+	if(EINVAL != errno)
+	  mm_gc_free_target = value;
+
+	else {
+
+	  fputs("mm_gc_free_target argument must be an integer.\n\n", stderr);
+	  fputs(usage, stderr);
+	  exit(EXIT_FAILURE);
+
+	}
+
+      }
+
+      else if(!strcmp(argv[i], "mm_gc_shrink_decay") && argc > ++i) {
+
+	value = strtoul(argv[i], NULL, 10);
+
+	if(EINVAL != errno && 100 >= value)
+	  mm_gc_shrink_decay = value;
+
+	else {
+
+	  fputs("mm_gc_shrink_decay argument must be between 0 and 100.\n\n",
+		stderr);
+	  fputs(usage, stderr);
+	  exit(EXIT_FAILURE);
+
+	}
+
+      }
+
       else {
 
 	fputs("Invalid argument.\n\n", stderr);
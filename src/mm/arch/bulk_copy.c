@@ -0,0 +1,7 @@
+/* Copyright (c) 2008 Eric McCorkle.  All rights reserved. */
+
+#ifdef IA_32
+#include "ia32/bulk_copy.c"
+#else
+#error "Invalid architecture specification"
+#endif
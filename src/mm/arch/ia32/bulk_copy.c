@@ -0,0 +1,58 @@
+/* Copyright (c) 2008 Eric McCorkle.  All rights reserved. */
+
+#include <string.h>
+
+#include "definitions.h"
+#include "mm/bulk_copy.h"
+
+/* Copy 64 bytes at a time through the SSE registers with
+ * non-temporal stores, which need the destination aligned to 16
+ * bytes.  The unaligned head and the tail are copied normally.
+ */
+
+#define BULK_COPY_ALIGN 16
+#define BULK_COPY_BLOCK 64
+
+internal void bulk_copy(void* const restrict dst,
+			const void* const restrict src,
+			const unsigned int size) {
+
+  const unsigned int head = -(unsigned int)dst & (BULK_COPY_ALIGN - 1);
+
+  if(size < head + BULK_COPY_BLOCK)
+    memcpy(dst, src, size);
+
+  else {
+
+    const unsigned int blocks = (size - head) / BULK_COPY_BLOCK;
+    const unsigned int tail = (size - head) % BULK_COPY_BLOCK;
+    char* curr_dst = (char*)dst + head;
+    const char* curr_src = (const char*)src + head;
+
+    memcpy(dst, src, head);
+
+    for(unsigned int i = 0; i < blocks; i++) {
+
+      asm volatile("movdqu   (%1), %%xmm0\n\t"
+		   "movdqu 16(%1), %%xmm1\n\t"
+		   "movdqu 32(%1), %%xmm2\n\t"
+		   "movdqu 48(%1), %%xmm3\n\t"
+		   "movntdq %%xmm0,   (%0)\n\t"
+		   "movntdq %%xmm1, 16(%0)\n\t"
+		   "movntdq %%xmm2, 32(%0)\n\t"
+		   "movntdq %%xmm3, 48(%0)"
+		   :
+		   : "r"(curr_dst), "r"(curr_src)
+		   : "memory", "xmm0", "xmm1", "xmm2", "xmm3");
+      curr_dst += BULK_COPY_BLOCK;
+      curr_src += BULK_COPY_BLOCK;
+
+    }
+
+    /* Non-temporal stores are weakly ordered. */
+    asm volatile("sfence" : : : "memory");
+    memcpy(curr_dst, curr_src, tail);
+
+  }
+
+}
@@ -0,0 +1,42 @@
+/* Copyright (c) 2008 Eric McCorkle.  All rights reserved. */
+
+#include "definitions.h"
+#include "mm/gc_barrier.h"
+
+/* The frame being returned into may expect a result in %eax:%edx, or
+ * in st(0), so keep those across the call.  Everything else is dead
+ * at a return.  The x87 stack must be empty when calling C code, so
+ * st(0) is popped into the frame if it holds anything, and pushed
+ * back afterward.  The stack is aligned for the call, since the
+ * frame's own alignment is unknown.
+ */
+asm(".text\n"
+    ".globl gc_stack_trampoline\n"
+    "gc_stack_trampoline:\n\t"
+    "pushl     %ebp\n\t"
+    "movl      %esp, %ebp\n\t"
+    "pushl     %eax\n\t"
+    "pushl     %edx\n\t"
+    "subl      $24, %esp\n\t"
+    "andl      $-16, %esp\n\t"
+    "movl      $0, 12(%esp)\n\t"
+    /* fxam sets C3 and C0 alone if st(0) is empty */
+    "fxam\n\t"
+    "fnstsw    %ax\n\t"
+    "andw      $0x4500, %ax\n\t"
+    "cmpw      $0x4100, %ax\n\t"
+    "je        1f\n\t"
+    "fstpt     (%esp)\n\t"
+    "movl      $1, 12(%esp)\n"
+    "1:\n\t"
+    "call      gc_stack_barrier\n\t"
+    "movl      %eax, %ecx\n\t"
+    "cmpl      $0, 12(%esp)\n\t"
+    "je        2f\n\t"
+    "fldt      (%esp)\n"
+    "2:\n\t"
+    "movl      -8(%ebp), %edx\n\t"
+    "movl      -4(%ebp), %eax\n\t"
+    "movl      %ebp, %esp\n\t"
+    "popl      %ebp\n\t"
+    "jmp       *%ecx\n");
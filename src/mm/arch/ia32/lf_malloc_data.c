@@ -301,3 +301,51 @@ internal pure active_t active_set_ptr(const active_t active,
   return ptr_val | credits_val;
 
 }
+
+
+/*!
+ * This function creates a tagged pointer from a pointer and a tag.
+ * Tagged pointers are used as the heads of lock-free stacks, where
+ * the tag is incremented on every update to avoid the ABA problem.
+ *
+ * \brief Create a tagged pointer.
+ * \arg ptr The pointer value.
+ * \arg tag The tag value.
+ * \return The tagged pointer.
+ */
+internal pure tagged_t tagged_create(const void* const restrict ptr,
+				     const unsigned int tag) {
+
+  const uint64_t tag64 = tag;
+
+  return (tag64 << 32) | (unsigned int)ptr;
+
+}
+
+
+/*!
+ * This function extracts the pointer from a tagged pointer.
+ *
+ * \brief Get the pointer from a tagged pointer.
+ * \arg tagged The tagged pointer.
+ * \return The pointer.
+ */
+internal pure void* tagged_get_ptr(const tagged_t tagged) {
+
+  return (void*)(unsigned int)tagged;
+
+}
+
+
+/*!
+ * This function extracts the tag from a tagged pointer.
+ *
+ * \brief Get the tag from a tagged pointer.
+ * \arg tagged The tagged pointer.
+ * \return The tag.
+ */
+internal pure unsigned int tagged_get_tag(const tagged_t tagged) {
+
+  return tagged >> 32;
+
+}
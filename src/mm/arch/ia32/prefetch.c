@@ -0,0 +1,12 @@
+/* Copyright (c) 2008 Eric McCorkle.  All rights reserved. */
+
+#include "definitions.h"
+#include "mm/prefetch.h"
+
+internal void prefetch(volatile const void* const addr) {
+
+  asm volatile("prefetcht0 %0"
+	       :
+	       : "m"(*(volatile const char*)addr));
+
+}
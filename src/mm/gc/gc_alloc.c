@@ -2,21 +2,29 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "definitions.h"
 #include "panic.h"
 #include "atomic.h"
 #include "bitops.h"
 #include "gc.h"
 #include "mm/gc_alloc.h"
+#include "mm/gc_card.h"
 #include "mm/gc_thread.h"
 #include "mm/gc_vars.h"
 #include "mm/slice.h"
+#include "cc/executor.h"
 
 
 #define MIN_SLICE_POWER 14
 #define MAX_SLICE_POWER BITS - 1
 #define SLICE_POWERS (((MAX_SLICE_POWER) - (MIN_SLICE_POWER)) + 1)
 #define USAGE_RATIO 2
+#define GC_PACER_SCALE 256
+#define GC_SPACE_FLUSH_SIZE 0x40000
+
+unsigned int mm_gc_free_target = 100;
+unsigned int mm_gc_shrink_decay = 25;
 
 /*!
  * This is the hard limit of total space to used space.  Going below
@@ -47,19 +55,134 @@ static float gc_soft_ratio;
 static volatile atomic_ptr_t* gc_used_slices[SLICE_POWERS];
 static volatile atomic_ptr_t* gc_free_slices[SLICE_POWERS];
 static volatile atomic_ptr_t* gc_new_slices[SLICE_POWERS];
+
+/* The used and new stacks are only ever pushed, so their tails are
+ * the first slices pushed onto them.  This lets the final barrier
+ * splice whole stacks in constant time.
+ */
+static volatile atomic_ptr_t* gc_used_tails[SLICE_POWERS];
+static volatile atomic_ptr_t* gc_new_tails[SLICE_POWERS];
+
+/* Slices released by the last collection, which still need their
+ * card tables cleared and their memory given back before they can
+ * go on the free stacks.  This is done after the final barrier,
+ * spread out over the executors, and by allocators which find the
+ * free stacks empty.  These are always empty during a collection.
+ */
+static volatile atomic_ptr_t* gc_released_slices[SLICE_POWERS];
 static volatile atomic_uint_t* gc_used_space;
 static volatile atomic_uint_t* gc_free_space;
 static volatile atomic_uint_t* gc_new_space;
 
+/* Changes to the space counters are kept by each executor, one entry
+ * for each generation, and each executor's entries in their own cache
+ * lines.  Only the executor itself touches them; each one adds its
+ * own into the shared counters before passing the final barrier, so
+ * the counters are exact when the slices are released.  Otherwise,
+ * an entry is added into the shared counters once any of its changes
+ * reaches GC_SPACE_FLUSH_SIZE, so the shared counters are never off
+ * by more than that much per executor and generation.
+ */
+typedef struct {
+
+  int sd_used;
+  int sd_new;
+  int sd_free;
+  int sd_alloc;
 
-static slice_t* gc_allocator_alloc_slice(volatile atomic_ptr_t*
-					 const restrict src,
-					 volatile atomic_ptr_t*
-					 const restrict dst) {
+} gc_space_delta_t;
+
+static gc_space_delta_t* gc_space_deltas;
+static unsigned int gc_space_stride;
+
+/* The pacer.  Collections are started early enough that, at the rate
+ * mutators allocated relative to the collector's copying in the last
+ * cycle, the collection finishes before the hard limit is reached.
+ * Mutators which allocate during a collection are made to do tracing
+ * work in proportion, so that the collector keeps up.  Ratios are
+ * fixed-point, scaled by GC_PACER_SCALE.
+ */
+static volatile atomic_uint_t gc_pacer_alloc;
+static unsigned int gc_pacer_alloc_per_scan = GC_PACER_SCALE;
+static unsigned int gc_pacer_assist_ratio = GC_PACER_SCALE;
+static unsigned int gc_pacer_live;
+
+/* The recent size of the heap after a collection.  This takes the
+ * largest size right away, and decays by mm_gc_shrink_decay each
+ * collection, so a spike is only kept around for a few cycles.
+ */
+static unsigned int gc_shrink_survivors;
+
+/* Large objects each have a slice to themselves, kept on one list for
+ * all generations.  Mutators only ever push onto it.  Slices are
+ * only taken off by the final barrier sequential code.
+ */
+static volatile atomic_ptr_t gc_large_slices;
+
+
+internal pure unsigned int gc_allocator_request(const unsigned int execs,
+					       const unsigned int gens) {
+
+  const unsigned int stride_size = gens * sizeof(gc_space_delta_t);
+  const unsigned int aligned_stride_size =
+    ((stride_size - 1) & ~(CACHE_LINE_SIZE - 1)) + CACHE_LINE_SIZE;
+
+  PRINTD("    Reserving 0x%x bytes for space counters\n",
+	 execs * aligned_stride_size);
+
+  return execs * aligned_stride_size;
+
+}
+
+
+internal void* gc_allocator_init(void* const mem, const unsigned int execs,
+				 const unsigned int gens) {
+
+  const unsigned int size = gc_allocator_request(execs, gens);
+
+  PRINTD("Initializing space counters for %u executors at 0x%p\n",
+	 execs, mem);
+  gc_space_deltas = mem;
+  gc_space_stride = (size / execs) / sizeof(gc_space_delta_t);
+  memset(mem, 0, size);
+
+  return (char*)mem + size;
+
+}
+
+
+static void gc_allocator_push_slice(slice_t* const restrict slice,
+				    volatile atomic_ptr_t* const restrict dst,
+				    volatile atomic_ptr_t* const restrict tail) {
+
+  for(unsigned int i = 1;; i++) {
+
+    slice_t* const dst_value = dst->value;
+
+    slice->s_next = dst_value;
+
+    if(atomic_compare_and_set_ptr(dst_value, slice, dst)) {
+
+      if(NULL == dst_value && NULL != tail)
+	tail->value = slice;
+
+      break;
+
+    }
+
+    else
+      backoff_delay(i);
+
+  }
+
+}
+
+
+static slice_t* gc_allocator_pop_slice(volatile atomic_ptr_t*
+				       const restrict src) {
 
   slice_t* out;
 
-  /* Try to pull a slice off of the source. */
   for(unsigned int i = 1;; i++) {
 
     out = src->value;
@@ -72,24 +195,26 @@ static slice_t* gc_allocator_alloc_slice(volatile atomic_ptr_t*
 
   }
 
-  /* At this point, we've succeeded or failed.  Since the queues are
-   * switched inside a barrier action, it is ok for this to be
-   * non-linearizable.  If I got one, put it on the destination.
-   */
-  if(NULL != out)
-    for(unsigned int i = 1;; i++) {
+  return out;
 
-      slice_t* const dst_value = dst->value;
+}
 
-      out->s_next = dst_value;
 
-      if(atomic_compare_and_set_ptr(dst_value, out, dst))
-	break;
+static slice_t* gc_allocator_alloc_slice(volatile atomic_ptr_t*
+					 const restrict src,
+					 volatile atomic_ptr_t*
+					 const restrict dst,
+					 volatile atomic_ptr_t*
+					 const restrict tail) {
 
-      else
-	backoff_delay(i);
+  slice_t* const out = gc_allocator_pop_slice(src);
 
-    }
+  /* At this point, we've succeeded or failed.  Since the queues are
+   * switched inside a barrier action, it is ok for this to be
+   * non-linearizable.  If I got one, put it on the destination.
+   */
+  if(NULL != out)
+    gc_allocator_push_slice(out, dst, tail);
 
   return out;
 
@@ -208,8 +333,71 @@ static bool gc_allocator_limit_check(const unsigned int req_size) {
 }
 
 
-/* Check the soft ratio and maybe activate the collector.  Again, this
- * is ok to be not-quite linearizable.
+static inline void gc_allocator_add_space(volatile atomic_uint_t* const space,
+					  const unsigned int size) {
+
+  for(unsigned int i = 1; 0 != size; i++) {
+
+    const unsigned int old = space->value;
+
+    if(atomic_compare_and_set_uint(old, old + size, space))
+      break;
+
+    else
+      backoff_delay(i);
+
+  }
+
+}
+
+
+static inline gc_space_delta_t* gc_allocator_space_delta(const unsigned int
+							 gen) {
+
+  return gc_space_deltas + (executor_self() * gc_space_stride) + gen - 1;
+
+}
+
+
+static inline void gc_allocator_fold_space(gc_space_delta_t* const delta,
+					   const unsigned int gen) {
+
+  gc_allocator_add_space(gc_used_space + gen - 1, delta->sd_used);
+  gc_allocator_add_space(gc_new_space + gen - 1, delta->sd_new);
+  gc_allocator_add_space(gc_free_space + gen - 1, delta->sd_free);
+  gc_allocator_add_space(&gc_pacer_alloc, delta->sd_alloc);
+  delta->sd_used = 0;
+  delta->sd_new = 0;
+  delta->sd_free = 0;
+  delta->sd_alloc = 0;
+
+}
+
+
+/* Add an executor's changes into the shared counters if any of them
+ * has grown large enough.  Returns true if they were added.
+ */
+static inline bool gc_allocator_flush_space(gc_space_delta_t* const delta,
+					    const unsigned int gen) {
+
+  const bool out = GC_SPACE_FLUSH_SIZE <= abs(delta->sd_used) ||
+    GC_SPACE_FLUSH_SIZE <= abs(delta->sd_new) ||
+    GC_SPACE_FLUSH_SIZE <= abs(delta->sd_free) ||
+    GC_SPACE_FLUSH_SIZE <= delta->sd_alloc;
+
+  if(out)
+    gc_allocator_fold_space(delta, gen);
+
+  return out;
+
+}
+
+
+/* Check the limits and maybe activate the collector.  A collection
+ * starts once the ratio of total space to used space drops to the
+ * soft ratio, or earlier if the mutators are expected to allocate
+ * enough during the collection to hit the hard ratio.  Again, this is
+ * ok to be not-quite linearizable.
  */
 static void gc_allocator_check_activate_collector(void) {
 
@@ -217,77 +405,173 @@ static void gc_allocator_check_activate_collector(void) {
   const unsigned int new_size = gc_allocator_total_new_space();
   const unsigned int free_size = gc_allocator_total_free_space();
   const unsigned int total_size = used_size + new_size + free_size;
-  const float ratio = (1.0 * total_size) / used_size;
+  const unsigned int soft_size = total_size / gc_soft_ratio;
+  const unsigned int hard_size = total_size / gc_hard_ratio;
+  const unsigned int expect_size = ((unsigned long long)gc_pacer_live *
+				    gc_pacer_alloc_per_scan) / GC_PACER_SCALE;
+  const unsigned int paced_size =
+    hard_size > expect_size ? hard_size - expect_size : 0;
+  const unsigned int trigger_size = min(soft_size, paced_size);
+
+  if(GC_STATE_INACTIVE == (gc_state.value & GC_STATE_PHASE) &&
+     used_size >= trigger_size) {
+
+    const unsigned int headroom =
+      hard_size > used_size ? hard_size - used_size : 1;
+
+    PRINTD("Starting collection with 0x%x bytes used, trigger at 0x%x\n",
+	   used_size, trigger_size);
+
+    /* Spread the expected tracing work over what the mutators can
+     * allocate before hitting the hard limit.
+     */
+    gc_pacer_assist_ratio =
+      ((unsigned long long)gc_pacer_live * GC_PACER_SCALE) / headroom;
+    gc_pacer_alloc.value = 0;
 
-  if(GC_STATE_INACTIVE == gc_state.value & GC_STATE_PHASE &&
-     ratio >= gc_soft_ratio)
     /* I don't need to CAS, since this will only change to something
      * other than initial when everyone (including me) passes the
      * barrier.
      */
     gc_state.value = GC_STATE_INITIAL;
 
+  }
+
 }
 
 
-/* This does need to be linearizable. */
+/* This doesn't need to be linearizable any more.  The sizes are
+ * counted by each executor, and only go into the shared counters when
+ * one of them gets large enough, which is also the only time the
+ * limits are checked.
+ */
 static void gc_allocator_update_sizes(const unsigned int req_size,
 				      const unsigned int gen,
 				      const bool new,
 				      const bool for_gc) {
 
+  gc_space_delta_t* const delta = gc_allocator_space_delta(gen);
+
   if(!for_gc) {
 
-    for(unsigned int i = 1;; i++) {
+    delta->sd_used += req_size;
+    delta->sd_alloc += req_size;
 
-      const unsigned int used_size = gc_used_space[gen - 1].value;
+  }
 
-      if(atomic_compare_and_set_uint(used_size, used_size + req_size,
-				     &gc_used_space))
-	break;
+  else
+    delta->sd_new += req_size;
 
-      else
-	backoff_delay(i);
+  /* If not a new slice, then decrement free_size */
+  if(!new)
+    delta->sd_free -= req_size;
 
-    }
+  /* Second part: maybe switch on the collector */
+  if(gc_allocator_flush_space(delta, gen) && !for_gc)
+    gc_allocator_check_activate_collector();
 
-  }
+}
 
-  else
-    for(unsigned int i = 1;; i++) {
 
-      const unsigned int new_size = gc_new_space[gen - 1].value;
+static inline unsigned int gc_allocator_free_target(void) {
 
-      if(atomic_compare_and_set_uint(new_size, new_size + req_size,
-				     &gc_new_space))
-	break;
+  return ((unsigned long long)gc_shrink_survivors * mm_gc_free_target) / 100;
 
-      else
-	backoff_delay(i);
+}
 
-    }
 
-  /* If not a new slice, then decrement free_size */
-  if(!new) {
+/* Slices only have card tables when cards are marked, but large
+ * object slices always do, since the table records whether the
+ * object is live.
+ */
+static inline unsigned int gc_allocator_table_size(const slice_t* const
+						   slice) {
+
+  return NULL != slice->s_data ? gc_card_table_size(slice->s_size) : 0;
+
+}
+
+
+static void gc_allocator_return_slice(slice_t* const slice,
+				      const unsigned int index) {
+
+  gc_space_delta_t* const delta = gc_allocator_space_delta(index + 1);
+
+  PRINTD("Returning slice %p to the system\n", slice);
+  delta->sd_free -= slice->s_size;
+  gc_allocator_flush_space(delta, index + 1);
+  gc_card_table_destroy(slice);
+  slice_free(slice, SLICE_EXEC_NONE);
+
+}
+
+
+/* Finish releasing one slice from the last collection.  Its cards are
+ * cleaned.  Up to the target, it goes on the free stack as it is, to
+ * be reused right away.  Past the target, its pages are dropped from
+ * the resident set first, and past twice the target it goes back to
+ * the system.
+ * Returns false if there was nothing to release.
+ */
+static bool gc_allocator_release_slice(const unsigned int power,
+				       const unsigned int index) {
+
+  slice_t* const slice = gc_allocator_pop_slice(gc_released_slices[power] +
+						index);
+
+  if(NULL != slice) {
+
+    const unsigned int table_size = gc_allocator_table_size(slice);
+    const unsigned int start = 0 != table_size ?
+      ((table_size - 1) & ~(PAGE_SIZE - 1)) + PAGE_SIZE : 0;
+    const unsigned int free_size = gc_allocator_total_free_space();
+    const unsigned int target = gc_allocator_free_target();
 
-    for(unsigned int i = 1;; i++) {
+    gc_card_table_clear(slice);
 
-      const unsigned int free_size = gc_free_space[gen - 1].value;
+    if(free_size > 2 * target)
+      gc_allocator_return_slice(slice, index);
 
-      if(atomic_compare_and_set_uint(free_size, free_size - req_size,
-				     &gc_free_space))
-	break;
+    else {
 
-      else
-	backoff_delay(i);
+      if(free_size > target && start < slice->s_size)
+	slice_range_set_usage(slice, (char*)(slice->s_ptr) + start,
+			      slice->s_size - start, SLICE_USAGE_UNUSED);
+
+      gc_allocator_push_slice(slice, gc_free_slices[power] + index, NULL);
 
     }
 
   }
 
-  /* Second part: maybe switch on the collector */
-  if(!for_gc)
-    gc_allocator_check_activate_collector();
+  return NULL != slice;
+
+}
+
+
+/* Get a free slice, finishing the release of slices from the last
+ * collection if there are none.
+ */
+static slice_t* gc_allocator_take_slice(const unsigned int power,
+					const unsigned int index,
+					const bool for_gc) {
+
+  volatile atomic_ptr_t* const restrict dst =
+    !for_gc ? gc_used_slices[power] + index : gc_new_slices[power] + index;
+  volatile atomic_ptr_t* const restrict tail =
+    !for_gc ? gc_used_tails[power] + index : gc_new_tails[power] + index;
+  slice_t* out;
+
+  for(;;) {
+
+    out = gc_allocator_alloc_slice(gc_free_slices[power] + index, dst, tail);
+
+    if(NULL != out || !gc_allocator_release_slice(power, index))
+      break;
+
+  }
+
+  return out;
 
 }
 
@@ -325,18 +609,10 @@ static bool gc_allocator_do_refresh(gc_allocator_t allocator,
     /* If doing it for garbage collection, add to the new slices,
      * otherwise, add to the used slices.
      */
-      if(NULL !=
-	 (slice = gc_allocator_alloc_slice(gc_free_slices[i] + index,
-					   !for_gc ? gc_used_slices[i] + index :
-					   gc_new_slices[i] + index)))
+      if(NULL != (slice = gc_allocator_take_slice(i, index, for_gc)))
 	gc_allocator_update_sizes(0x1 << (i + MIN_SLICE_POWER),
 				  gen, false, for_gc);
 
-  /* XXX This is going to be very inefficient, and will not
-   * keep memory usage down.  Figure out how to intelligently release
-   * slices and redo this part.
-   */
-
   /* If this is for GC, ignore the limit, otherwise, obey it */
   for(unsigned int i = min_slice_power + 1;
       i < SLICE_POWERS && NULL == slice &&
@@ -345,10 +621,7 @@ static bool gc_allocator_do_refresh(gc_allocator_t allocator,
     /* If doing it for garbage collection, add to the new slices,
      * otherwise, add to the used slices.
      */
-    if(NULL !=
-       (slice = gc_allocator_alloc_slice(gc_free_slices[i] + index,
-					 !for_gc ? gc_used_slices[i] + index :
-					 gc_new_slices[i] + index)))
+    if(NULL != (slice = gc_allocator_take_slice(i, index, for_gc)))
       gc_allocator_update_sizes(0x1 << (i + MIN_SLICE_POWER),
 				gen, false, for_gc);
 
@@ -356,27 +629,19 @@ static bool gc_allocator_do_refresh(gc_allocator_t allocator,
   for(unsigned int i = target_slice_power;
       i >= min_slice_power && NULL == slice; i--)
     if(NULL != (slice = slice_alloc(SLICE_TYPE_GC, SLICE_PROT_RWX,
-				    0x1 << (i + MIN_SLICE_POWER)))) {
+				    0x1 << (i + MIN_SLICE_POWER),
+				    SLICE_EXEC_NONE))) {
 
       /* If allocation succeeds, insert it into the right stack */
       volatile atomic_ptr_t* const restrict dst =
-	for_gc ? gc_used_slices[i] + index : gc_new_slices[i] + index;
+	!for_gc ? gc_used_slices[i] + index : gc_new_slices[i] + index;
+      volatile atomic_ptr_t* const restrict tail =
+	!for_gc ? gc_used_tails[i] + index : gc_new_tails[i] + index;
 
-      /* Add it to the destination */
-      for(unsigned int i = 1;; i++) {
-
-	slice_t* const dst_value = dst->value;
-
-	slice->s_next = dst_value;
-
-	if(atomic_compare_and_set_ptr(dst_value, slice, dst))
-	  break;
-
-	else
-	  backoff_delay(i);
-
-      }
+      if(GC_CARD_MARKING_ON == mm_card_marking)
+	gc_card_table_init(slice, gen, false);
 
+      gc_allocator_push_slice(slice, dst, tail);
       gc_allocator_update_sizes(0x1 << (i + MIN_SLICE_POWER),
 				gen, true, for_gc);
 
@@ -385,8 +650,9 @@ static bool gc_allocator_do_refresh(gc_allocator_t allocator,
   /* If successful update the allocator accordingly */
   if(NULL != slice) {
 
+    /* Slices start with their card tables, if they have them. */
     out = true;
-    allocator[0] = slice->s_ptr;
+    allocator[0] = (char*)(slice->s_ptr) + gc_allocator_table_size(slice);
     allocator[1] = (char*)(slice->s_ptr) + (slice->s_size);
 
   }
@@ -434,25 +700,76 @@ static inline unsigned int get_target_size(const unsigned int min) {
 }
 
 
-internal void* gc_allocator_alloc(gc_allocator_t allocator,
-				  const unsigned int size,
-				  const unsigned int gen) {
+/* Pay for new memory with tracing work, if a collection is running. */
+
+static inline void gc_allocator_assist(const unsigned int size) {
+
+  if(GC_STATE_NORMAL == (gc_state.value & GC_STATE_PHASE) ||
+     GC_STATE_WEAK == (gc_state.value & GC_STATE_PHASE))
+    gc_thread_assist(((unsigned long long)size * gc_pacer_assist_ratio) /
+		     GC_PACER_SCALE);
+
+}
+
+
+/* Give a large object a slice of its own.  The card table is at the
+ * front as usual; the estimate of its size is generous enough for any
+ * object this large.
+ */
+static void* gc_allocator_alloc_large(const unsigned int size,
+				      const unsigned int gen) {
+
+  const unsigned int table_size =
+    gc_card_table_size(size + (size / 64) + PAGE_SIZE);
+  const unsigned int slice_size =
+    ((size + table_size - 1) & ~(PAGE_SIZE - 1)) + PAGE_SIZE;
+  slice_t* slice = NULL;
+  void* out = NULL;
+
+  if(gc_allocator_limit_check(slice_size) &&
+     NULL != (slice = slice_alloc(SLICE_TYPE_GC, SLICE_PROT_RWX,
+				  slice_size, SLICE_EXEC_NONE))) {
+
+    INVARIANT(gc_card_table_size(slice->s_size) <= table_size);
 
+    gc_card_table_init(slice, gen, true);
+    gc_allocator_push_slice(slice, &gc_large_slices, NULL);
+    PRINTD("Allocated large object slice %p of 0x%x bytes\n",
+	   slice, slice_size);
+    gc_allocator_update_sizes(slice_size, gen, true, false);
+    out = (char*)(slice->s_ptr) + gc_card_table_size(slice->s_size);
+
+  }
+
+  return out;
+
+}
+
+
+/* This is only called when the fast path in gc_alloc.h fails, so
+ * there is no point in trying the current block again.
+ */
+internal void* gc_allocator_refill(gc_allocator_t allocator,
+				   const unsigned int obj_size,
+				   const unsigned int gen) {
+
+  const unsigned int size = gc_allocator_obj_size(obj_size);
   const unsigned int target = get_target_size(size);
-  char* const newptr = (char*)(allocator[0]) + size;
   void* out = NULL;
 
-  /* If there is enough memory there already, just allocate it. */
-  if(newptr <= (char*)allocator[1]) {
+  /* Large blocks get a slice to themselves. */
+  if(GC_LARGE_OBJECT_SIZE <= size) {
 
-    out = allocator[0];
-    allocator[0] = newptr;
+    if(NULL != (out = gc_allocator_alloc_large(size, gen)))
+      gc_allocator_assist(size);
 
   }
 
   /* Otherwise try to get more. */
   else if(gc_allocator_refresh(allocator, size, target, gen)) {
 
+    char* const newptr = (char*)(allocator[0]) + size;
+
     /* If there still isn't enough, something went wrong */
     if(newptr <= (char*)allocator[1]) {
 
@@ -464,13 +781,77 @@ internal void* gc_allocator_alloc(gc_allocator_t allocator,
     else
       panic("Error: gc_allocator_refresh didn't allocate enough space.\n");
 
+    /* Pay for the new block with tracing work.  This is done after
+     * the allocator is updated, since the collector shares allocator
+     * 0 with the program.
+     */
+    gc_allocator_assist((char*)allocator[1] - (char*)allocator[0]);
+
   }
 
+  /* Cards written by the program need to find its objects too. */
+  if(NULL != out && GC_CARD_MARKING_ON == mm_card_marking)
+    gc_card_note_object(out);
+
   return out;
 
 }
 
 
+/* Headers are all written in one pass over the block.  Blocks are
+ * kept below the large object size, since a large object slice can
+ * only hold one object.
+ */
+internal bool gc_allocator_alloc_batch(gc_allocator_t allocator,
+				       const unsigned int* const type,
+				       const unsigned char flags,
+				       const unsigned int gen,
+				       const unsigned char next_gen,
+				       const unsigned int num,
+				       void** const restrict objs) {
+
+  INVARIANT(GC_TYPEDESC_NORMAL == gc_typedesc_class(type));
+
+  const unsigned int raw_size = sizeof(gc_header_t) +
+    gc_typedesc_nonptr_size(type) +
+    ((gc_typedesc_normal_ptrs(type) + gc_typedesc_weak_ptrs(type)) *
+     sizeof(gc_double_ptr_t));
+  const unsigned int size =
+    ((raw_size - 1) & ~(CACHE_LINE_SIZE - 1)) + CACHE_LINE_SIZE;
+  const unsigned int per_block = (GC_LARGE_OBJECT_SIZE - 1) / size;
+  void* const unclaimed = gc_thread_unclaimed(gen);
+  unsigned int done = 0;
+
+  while(done < num) {
+
+    const unsigned int count = min(num - done, per_block);
+    char* const block = gc_allocator_alloc(allocator, count * size, gen);
+
+    if(NULL == block)
+      break;
+
+    for(unsigned int i = 0; i < count; i++) {
+
+      void* const obj = block + (i * size);
+
+      gc_header_init_normal(unclaimed, type, flags, gen, next_gen, 0, obj);
+
+      if(GC_CARD_MARKING_ON == mm_card_marking)
+	gc_card_note_object(obj);
+
+      objs[done + i] = obj;
+
+    }
+
+    done += count;
+
+  }
+
+  return done == num;
+
+}
+
+
 internal void* gc_allocator_gc_prealloc(gc_closure_t* const restrict closure,
 					const unsigned int size,
 					const unsigned int gen) {
@@ -519,29 +900,160 @@ internal void gc_allocator_gc_postalloc(gc_closure_t* const restrict closure,
 }
 
 
+/* This is on the collector's hot path.  Objects are allocated at
+ * their own size, and anything under half the large object size
+ * can't have been given a large slice, so most objects are decided
+ * from the header without touching their slice's card table.
+ */
+internal bool gc_allocator_large(volatile void* const obj) {
+
+  const unsigned int* const type = gc_header_type(obj);
+  const unsigned int size = gc_typedesc_nonptr_size(type) +
+    ((gc_typedesc_normal_ptrs(type) + gc_typedesc_weak_ptrs(type)) *
+     sizeof(gc_double_ptr_t));
+  const unsigned int len = GC_TYPEDESC_NORMAL == gc_typedesc_class(type) ?
+    1 : gc_header_array_len(obj);
+  bool out = false;
+
+  if((unsigned long long)size * len >= GC_LARGE_OBJECT_SIZE / 2) {
+
+    const slice_t* const slice = slice_lookup((const void*)obj);
+    const gc_card_table_t* const table =
+      NULL != slice && SLICE_TYPE_GC == slice->s_type ? slice->s_data : NULL;
+
+    out = NULL != table && table->ct_large;
+
+  }
+
+  return out;
+
+}
+
+
+internal void gc_allocator_mark_large(volatile void* const obj) {
+
+  const slice_t* const slice = slice_lookup((const void*)obj);
+  gc_card_table_t* const table = slice->s_data;
+
+  table->ct_live = true;
+
+}
+
+
+/* Go through the large objects in the collected generations.  Live
+ * ones stay where they are, and move into the new heap without being
+ * copied.  Dead ones have their slices freed.  Mutators may still
+ * push new slices, so the head is only taken off with a
+ * compare-and-set.  Returns the size of the live ones.
+ */
+static unsigned int gc_allocator_release_large(const unsigned int gen) {
+
+  unsigned int out = 0;
+  slice_t* prev = NULL;
+  slice_t* next;
+
+  for(slice_t* curr = gc_large_slices.value; NULL != curr; curr = next) {
+
+    gc_card_table_t* const table = curr->s_data;
+
+    next = curr->s_next;
+
+    if(table->ct_gen >= gen || table->ct_live) {
+
+      /* Its space went into the free space with the rest of the used
+       * space, but it is still in use.
+       */
+      if(table->ct_gen < gen) {
+
+	table->ct_live = false;
+	gc_free_space[table->ct_gen - 1].value -= curr->s_size;
+	gc_used_space[table->ct_gen - 1].value += curr->s_size;
+	out += curr->s_size;
+
+      }
+
+      prev = curr;
+
+    }
+
+    else {
+
+      /* Its space went into the free space with the rest of the used
+       * space, but it goes back to the system.
+       */
+      PRINTD("Freeing large object slice %p\n", curr);
+      gc_free_space[table->ct_gen - 1].value -= curr->s_size;
+
+      if(NULL != prev)
+	prev->s_next = next;
+
+      else if(!atomic_compare_and_set_ptr(curr, next, &gc_large_slices)) {
+
+	for(prev = gc_large_slices.value; curr != prev->s_next;
+	    prev = prev->s_next);
+
+	prev->s_next = next;
+
+      }
+
+      gc_card_table_destroy(curr);
+      slice_free(curr, SLICE_EXEC_NONE);
+
+    }
+
+  }
+
+  return out;
+
+}
+
+
+/* Everything in the used space has now survived a collection. */
+
+static inline void gc_allocator_update_shrink(void) {
+
+  const unsigned int survivors = gc_allocator_total_used_space();
+  const unsigned int decayed = gc_shrink_survivors -
+    ((unsigned long long)gc_shrink_survivors * mm_gc_shrink_decay) / 100;
+
+  gc_shrink_survivors = max(survivors, decayed);
+  PRINTD("Shrinking: 0x%x bytes survived, keeping 0x%x bytes free\n",
+	 survivors, gc_allocator_free_target());
+
+}
+
+
+internal void gc_allocator_fold_deltas(void) {
+
+  for(unsigned int i = 1; i <= gc_num_generations; i++)
+    gc_allocator_fold_space(gc_allocator_space_delta(i), i);
+
+}
+
+
 /* This function is not lock-free.  It is called only by the last
  * thread to pass the final barrier.  Therefore, it is safe to assume
  * that it is executed only by one thread.
  */
 internal void gc_allocator_release_slices(const unsigned int gen) {
 
-  /* Append the used space to the free space (free old heap). */
+  unsigned int copied = 0;
+
+  /* Splice the used space onto the released space (free old heap).
+   * Their cards and objects are all dead, but cleaning them is left
+   * until after the barrier.
+   */
   for(unsigned int i = 0; i < SLICE_POWERS; i++)
     for(unsigned int j = 0; j < gen - 1; j++) {
 
-      slice_t* curr = gc_free_slices[i][j].value;
+      slice_t* const used = gc_used_slices[i][j].value;
 
-      /* If there are no free slices, then the used slices are just copied */
-      if(NULL == curr)
-	gc_free_slices[i][j].value = gc_used_slices[i][j].value;
+      if(NULL != used) {
 
-      /* Otherwise append the used slices */
-      else {
+	slice_t* const tail = gc_used_tails[i][j].value;
 
-	while(NULL != curr->s_next)
-	  curr = curr->s_next;
-
-	curr->s_next = gc_used_slices[i][j].value;
+	tail->s_next = gc_released_slices[i][j].value;
+	gc_released_slices[i][j].value = used;
 
       }
 
@@ -551,10 +1063,37 @@ internal void gc_allocator_release_slices(const unsigned int gen) {
   for(unsigned int i = 0; i < gen - 1; i++)
     gc_free_space[i].value += gc_used_space[i].value;
 
+  /* Update the pacer.  Everything copied this cycle was live, and the
+   * ratio of allocation to copying is averaged with the last cycle to
+   * smooth out bursts.
+   */
+  for(unsigned int i = 0; i < gen - 1; i++)
+    copied += gc_new_space[i].value;
+
+  if(0 != copied) {
+
+    const unsigned long long ratio =
+      ((unsigned long long)gc_pacer_alloc.value * GC_PACER_SCALE) / copied;
+
+    gc_pacer_alloc_per_scan =
+      (gc_pacer_alloc_per_scan +
+       min(ratio, GC_PACER_SCALE * GC_PACER_SCALE)) / 2;
+
+  }
+
+  gc_pacer_live = copied;
+  gc_pacer_alloc.value = 0;
+  PRINTD("Pacer: 0x%x bytes live, allocation to copying ratio %u/%u\n",
+	 copied, gc_pacer_alloc_per_scan, GC_PACER_SCALE);
+
   /* The new space becomes the used space (transition to new heap image). */
   for(unsigned int i = 0; i < SLICE_POWERS; i++)
-    for(unsigned int j = 0; j < gen - 1; j++)
+    for(unsigned int j = 0; j < gen - 1; j++) {
+
       gc_used_slices[i][j].value = gc_new_slices[i][j].value;
+      gc_used_tails[i][j].value = gc_new_tails[i][j].value;
+
+    }
 
   /* Set the used space counters to the current new space counters and
    * zero out the new space counters.
@@ -566,11 +1105,56 @@ internal void gc_allocator_release_slices(const unsigned int gen) {
 
   }
 
+  gc_pacer_live += gc_allocator_release_large(gen);
+
+  gc_allocator_update_shrink();
+
   /* Set the new space to NULL.  This only gets built during a collection */
   for(unsigned int i = 0; i < SLICE_POWERS; i++)
-    for(unsigned int j = 0; j < gen - 1; j++)
+    for(unsigned int j = 0; j < gen - 1; j++) {
+
       gc_new_slices[i][j].value = NULL;
+      gc_new_tails[i][j].value = NULL;
+
+    }
 
   store_fence();
 
 }
+
+
+/* Give back free slices while there is more than twice the target.
+ * These were kept by earlier collections, but the target has decayed
+ * since.  The largest slices go first.  Returns false if there was
+ * nothing to give back.
+ */
+static bool gc_allocator_trim_slice(void) {
+
+  slice_t* slice = NULL;
+
+  if(gc_allocator_total_free_space() > 2 * gc_allocator_free_target())
+    for(unsigned int i = SLICE_POWERS; NULL == slice && 0 < i; i--)
+      for(unsigned int j = 0; NULL == slice && j < gc_num_generations; j++)
+	if(NULL != (slice = gc_allocator_pop_slice(gc_free_slices[i - 1] + j)))
+	  gc_allocator_return_slice(slice, j);
+
+  return NULL != slice;
+
+}
+
+
+internal unsigned int gc_allocator_release_deferred(const unsigned int max) {
+
+  unsigned int out = 0;
+
+  for(unsigned int i = 0; i < SLICE_POWERS; i++)
+    for(unsigned int j = 0; j < gc_num_generations; j++)
+      while(out < max && gc_allocator_release_slice(i, j))
+	out++;
+
+  while(out < max && gc_allocator_trim_slice())
+    out++;
+
+  return out;
+
+}
@@ -0,0 +1,256 @@
+/* Copyright (c) 2008 Eric McCorkle.  All rights reserved. */
+
+#include <stdbool.h>
+#include <string.h>
+
+#include "definitions.h"
+#include "atomic.h"
+#include "mm/slice.h"
+#include "mm/gc_card.h"
+
+/* Card tables live at the front of their slices, and are listed in a
+ * static table so collectors can go through all of them.  Only large
+ * object slices are ever given back by the GC allocator, so the table
+ * can be no larger than the slice table.  Their entries are reused,
+ * and the count is the highest entry ever used.
+ */
+
+#define GC_CARD_PASS_SHIFT 32
+
+unsigned int mm_card_marking = GC_CARD_MARKING_OFF;
+
+static volatile atomic_ptr_t gc_card_tables[SLICE_TAB_SIZE];
+
+static volatile atomic_uint_t gc_card_count;
+
+
+internal pure unsigned int gc_card_table_size(const unsigned int size) {
+
+  const unsigned int cards = size >> GC_CARD_SHIFT;
+  const unsigned int raw_size = sizeof(gc_card_table_t) +
+    ((cards + sizeof(unsigned int)) & ~(sizeof(unsigned int) - 1)) +
+    (cards * sizeof(unsigned int));
+
+  return ((raw_size - 1) & ~(CACHE_LINE_SIZE - 1)) + CACHE_LINE_SIZE;
+
+}
+
+
+static inline void gc_card_table_wipe(gc_card_table_t* const table) {
+
+  memset((void*)table->ct_cards, 0, table->ct_num_cards);
+  memset((void*)table->ct_starts, 0,
+	 table->ct_num_cards * sizeof(unsigned int));
+
+}
+
+
+internal void gc_card_table_init(slice_t* const slice,
+				 const unsigned char gen,
+				 const bool large) {
+
+  gc_card_table_t* const table = slice->s_ptr;
+
+  table->ct_claim.value = 0;
+  table->ct_slice = slice;
+  table->ct_num_cards = slice->s_size >> GC_CARD_SHIFT;
+  table->ct_gen = gen;
+  table->ct_large = large;
+  table->ct_live = false;
+  table->ct_starts = (volatile unsigned int*)
+    (((unsigned int)(table->ct_cards + table->ct_num_cards) +
+      sizeof(unsigned int)) & ~(sizeof(unsigned int) - 1));
+  gc_card_table_wipe(table);
+  slice->s_data = table;
+  store_fence();
+
+  /* Take the first free entry, and raise the count past it. */
+  for(unsigned int i = 0;; i++) {
+
+    INVARIANT(i < SLICE_TAB_SIZE);
+
+    if(atomic_compare_and_set_ptr(NULL, table, gc_card_tables + i)) {
+
+      table->ct_index = i;
+      break;
+
+    }
+
+  }
+
+  PRINTD("Creating card table %u for slice %p\n", table->ct_index, slice);
+
+  for(unsigned int i = 1;; i++) {
+
+    const unsigned int count = gc_card_count.value;
+
+    if(table->ct_index < count ||
+       atomic_compare_and_set_uint(count, table->ct_index + 1, &gc_card_count))
+      break;
+
+    else
+      backoff_delay(i);
+
+  }
+
+}
+
+
+internal void gc_card_table_destroy(slice_t* const slice) {
+
+  gc_card_table_t* const table = slice->s_data;
+
+  if(NULL != table) {
+
+    PRINTD("Destroying card table %u for slice %p\n",
+	   table->ct_index, slice);
+    gc_card_tables[table->ct_index].value = NULL;
+
+  }
+
+}
+
+
+internal void gc_card_table_clear(slice_t* const slice) {
+
+  if(NULL != slice->s_data)
+    gc_card_table_wipe(slice->s_data);
+
+}
+
+
+static inline gc_card_table_t* gc_card_table_lookup(volatile void* const
+						    ptr) {
+
+  const slice_t* const slice = slice_lookup((const void*)ptr);
+
+  return NULL != slice && SLICE_TYPE_GC == slice->s_type ?
+    slice->s_data : NULL;
+
+}
+
+
+internal void gc_card_mark(volatile void* const ptr) {
+
+  gc_card_table_t* const table = gc_card_table_lookup(ptr);
+
+  if(NULL != table) {
+
+    const unsigned int offset =
+      (const char*)ptr - (const char*)table->ct_slice->s_ptr;
+
+    table->ct_cards[offset >> GC_CARD_SHIFT] = GC_CARD_DIRTY;
+
+  }
+
+}
+
+
+/* Mutators store to cards without synchronizing, so lower the card
+ * with a compare-and-set on the word holding it.  A card may only be
+ * lowered here; the value is never above what is really in the card.
+ */
+static inline bool gc_card_try_lower(gc_card_table_t* const table,
+				     const unsigned int card,
+				     const unsigned char value) {
+
+  const unsigned int addr = (unsigned int)(table->ct_cards + card);
+  volatile atomic_uint_t* const word =
+    (volatile atomic_uint_t*)(addr & ~(sizeof(unsigned int) - 1));
+  const unsigned int shift = (addr & (sizeof(unsigned int) - 1)) * 8;
+  const unsigned int old = word->value;
+  const unsigned char old_value = old >> shift;
+  const unsigned int new = (old & ~(0xff << shift)) | (value << shift);
+
+  return (GC_CARD_CLEAN != old_value && old_value <= value) ||
+    atomic_compare_and_set_uint(old, new, word);
+
+}
+
+
+internal void gc_card_remember(volatile void* const ptr,
+			       volatile void* const obj) {
+
+  gc_card_table_t* const table = gc_card_table_lookup(ptr);
+  gc_card_table_t* const obj_table = gc_card_table_lookup(obj);
+
+  if(NULL != table && NULL != obj_table && obj_table->ct_gen < table->ct_gen) {
+
+    const unsigned int offset =
+      (const char*)ptr - (const char*)table->ct_slice->s_ptr;
+    const unsigned int card = offset >> GC_CARD_SHIFT;
+    const unsigned char value = GC_CARD_REMEMBERED(obj_table->ct_gen);
+
+    for(unsigned int i = 1; !gc_card_try_lower(table, card, value); i++)
+      backoff_delay(i);
+
+  }
+
+}
+
+
+/* Only one allocator uses a slice at a time, so nobody else can be
+ * changing these bits.
+ */
+internal void gc_card_note_object(volatile void* const obj) {
+
+  const slice_t* const slice = slice_lookup((const void*)obj);
+  gc_card_table_t* const table = slice->s_data;
+  const unsigned int offset = (const char*)obj - (const char*)slice->s_ptr;
+  const unsigned int line = (offset & (GC_CARD_SIZE - 1)) / CACHE_LINE_SIZE;
+
+  INVARIANT((offset & (CACHE_LINE_SIZE - 1)) == 0);
+
+  table->ct_starts[offset >> GC_CARD_SHIFT] |= 1 << line;
+
+}
+
+
+internal unsigned int gc_card_table_count(void) {
+
+  return min(gc_card_count.value, SLICE_TAB_SIZE);
+
+}
+
+
+internal gc_card_table_t* gc_card_table_get(const unsigned int index) {
+
+  return gc_card_tables[index].value;
+
+}
+
+
+internal bool gc_card_claim(gc_card_table_t* const table,
+			    const unsigned int pass,
+			    unsigned int* const first) {
+
+  const unsigned int ranges =
+    ((table->ct_num_cards - 1) / GC_CARD_CLUSTER_SIZE) + 1;
+  bool out = false;
+
+  for(unsigned int i = 1;; i++) {
+
+    const uint64_t old = atomic_read_uint64(&(table->ct_claim));
+    const unsigned int old_pass = old >> GC_CARD_PASS_SHIFT;
+    const unsigned int next = pass == old_pass ? (unsigned int)old : 0;
+    const uint64_t new = ((uint64_t)pass << GC_CARD_PASS_SHIFT) | (next + 1);
+
+    if(next >= ranges)
+      break;
+
+    else if(atomic_compare_and_set_uint64(old, new, &(table->ct_claim))) {
+
+      *first = next * GC_CARD_CLUSTER_SIZE;
+      out = true;
+      break;
+
+    }
+
+    else
+      backoff_delay(i);
+
+  }
+
+  return out;
+
+}
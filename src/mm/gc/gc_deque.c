@@ -0,0 +1,183 @@
+/* Copyright (c) 2008 Eric McCorkle.  All rights reserved. */
+
+#include <stdbool.h>
+
+#include "definitions.h"
+#include "atomic.h"
+#include "mm/gc_deque.h"
+
+/* Chase-Lev deques with a fixed array.  The top and bottom indexes
+ * increase forever and wrap around; only their difference matters,
+ * so every comparison is done on the signed difference.
+ *
+ * Thieves take one entry at a time.  Taking a whole batch with one
+ * compare-and-set on the top would race with the owner, which only
+ * synchronizes with thieves when it takes the very last entry.
+ */
+
+#define GC_DEQUE_MASK (GC_DEQUE_SIZE - 1)
+
+
+internal pure unsigned int gc_deque_request(const unsigned int execs) {
+
+  const unsigned int size = execs * sizeof(gc_deque_t);
+  const unsigned int aligned_size =
+    ((size - 1) & ~(CACHE_LINE_SIZE - 1)) + CACHE_LINE_SIZE;
+
+  PRINTD("    Reserving 0x%x bytes for %u work-stealing deques\n",
+	 aligned_size, execs);
+
+  return aligned_size;
+
+}
+
+
+internal gc_deque_t* gc_deque_init(void* const mem, const unsigned int execs) {
+
+  gc_deque_t* const out = mem;
+
+  PRINTD("Initializing %u work-stealing deques at 0x%p\n", execs, mem);
+
+  for(unsigned int i = 0; i < execs; i++) {
+
+    out[i].dq_top.value = 0;
+    out[i].dq_bottom = 0;
+
+  }
+
+  return out;
+
+}
+
+
+internal bool gc_deque_push(gc_deque_t* const deque, volatile void* const obj) {
+
+  const unsigned int bottom = deque->dq_bottom;
+  const unsigned int top = deque->dq_top.value;
+  bool out;
+
+  if(out = (bottom - top < GC_DEQUE_SIZE)) {
+
+    deque->dq_array[bottom & GC_DEQUE_MASK] = obj;
+    store_fence();
+    deque->dq_bottom = bottom + 1;
+
+  }
+
+  return out;
+
+}
+
+
+internal volatile void* gc_deque_pop(gc_deque_t* const deque) {
+
+  const unsigned int bottom = deque->dq_bottom - 1;
+  unsigned int top;
+  volatile void* out;
+
+  /* Claim the entry before looking at the top, so that a thief either
+   * sees the new bottom or the owner sees the thief's top.
+   */
+  deque->dq_bottom = bottom;
+  mem_fence();
+  top = deque->dq_top.value;
+
+  if(0 > (int)(bottom - top)) {
+
+    deque->dq_bottom = top;
+    out = NULL;
+
+  }
+
+  else {
+
+    out = deque->dq_array[bottom & GC_DEQUE_MASK];
+
+    /* The last entry may be taken by a thief at the same time. */
+    if(bottom == top) {
+
+      if(!atomic_compare_and_set_uint(top, top + 1, &(deque->dq_top)))
+	out = NULL;
+
+      deque->dq_bottom = top + 1;
+
+    }
+
+  }
+
+  return out;
+
+}
+
+
+internal bool gc_deque_empty(gc_deque_t* const deque) {
+
+  return 0 >= (int)(deque->dq_bottom - deque->dq_top.value);
+
+}
+
+
+/* Try to steal one entry.  This fails if the deque is empty or
+ * another thief (or the owner) won the entry.
+ */
+static inline volatile void* gc_deque_try_steal(gc_deque_t* const deque,
+						bool* const empty) {
+
+  const unsigned int top = deque->dq_top.value;
+  volatile void* out = NULL;
+  unsigned int bottom;
+
+  load_fence();
+  bottom = deque->dq_bottom;
+
+  if(!(*empty = (0 >= (int)(bottom - top)))) {
+
+    out = deque->dq_array[top & GC_DEQUE_MASK];
+
+    if(!atomic_compare_and_set_uint(top, top + 1, &(deque->dq_top)))
+      out = NULL;
+
+  }
+
+  return out;
+
+}
+
+
+internal unsigned int gc_deque_steal_half(gc_deque_t* const victim,
+					  gc_deque_t* const thief) {
+
+  INVARIANT(victim != thief);
+
+  const int size = victim->dq_bottom - victim->dq_top.value;
+  const unsigned int want = 0 < size ? (size + 1) / 2 : 0;
+  unsigned int out = 0;
+  bool empty = false;
+
+  for(unsigned int i = 1; !empty && out < want;) {
+
+    volatile void* const obj = gc_deque_try_steal(victim, &empty);
+
+    if(NULL != obj) {
+
+      /* The thief's deque is only ever filled by its owner, which is
+       * doing this, so it can only be full if the thief had plenty of
+       * work already.
+       */
+      if(!gc_deque_push(thief, obj))
+	panic("Work-stealing deque overflowed while stealing\n");
+
+      out++;
+
+    }
+
+    else if(!empty)
+      backoff_delay(i++);
+
+  }
+
+  PRINTD("Stole %u of %d entries from deque %p\n", out, size, victim);
+
+  return out;
+
+}
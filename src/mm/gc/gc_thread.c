@@ -6,14 +6,20 @@
 #include "program.h"
 #include "gc.h"
 #include "atomic.h"
+#include "bitops.h"
 #include "cc.h"
 #include "os_thread.h"
 #include "cc/executor.h"
+#include "cc/thread.h"
 #include "mm/gc_desc.h"
 #include "mm/gc_vars.h"
 #include "mm/gc_alloc.h"
 #include "mm/gc_thread.h"
-#include "mm/lf_object_queue.h"
+#include "mm/gc_deque.h"
+#include "mm/gc_barrier.h"
+#include "mm/gc_card.h"
+#include "mm/prefetch.h"
+#include "mm/bulk_copy.h"
 
 typedef struct {
 
@@ -26,8 +32,13 @@ typedef struct {
 static unsigned int gc_thread_count;
 static void* gc_global_ptr_bitmap;
 
-/* The workshare queue, used to more evenly divide work. */
-static lf_object_queue_t* gc_workshare;
+/* This is the bitmap used to claim clusters of threads from the
+ * thread table, whose stacks are then scanned.
+ */
+static void* gc_thread_stack_bitmap;
+
+/* The work-stealing deques, one for each executor. */
+static gc_deque_t* gc_thread_deques;
 
 /* This is the index at which to start claiming blocks of global
  * pointers to process.  Executors should claim some small number,
@@ -41,9 +52,55 @@ static volatile atomic_uint_t gc_thread_data_index;
  */
 static volatile atomic_ptr_t gc_thread_array_list;
 
-static barrier_t gc_thread_initial_barrier_value;
-static barrier_t gc_thread_middle_barrier_value;
-static barrier_t gc_thread_final_barrier_value;
+/* This is a lock-free simple stack of threads whose stacks have only
+ * been partly scanned.  A thread is pushed at most once per phase,
+ * and the stack is empty between phases, so there is no ABA problem.
+ */
+static volatile atomic_ptr_t gc_thread_stack_list;
+
+/* States of a thread's stack barrier.  The barrier is armed when the
+ * rest of the stack needs scanning, and busy while someone is
+ * scanning it.
+ */
+#define GC_BARRIER_NONE 0
+#define GC_BARRIER_ARMED 1
+#define GC_BARRIER_BUSY 2
+
+/* Values of a thread's scan word.  The top of the stack is unscanned
+ * in a pass while the word is below the pass's done value.
+ */
+#define GC_SCAN_DONE(pass) ((pass) * 2)
+#define GC_SCAN_BUSY(pass) (((pass) * 2) + 1)
+
+/* The phase changes are a ragged handshake.  Each executor
+ * acknowledges the current epoch once, at its next safepoint, and the
+ * last one to do so performs the change and advances the epoch.
+ * Nobody blocks; executors waiting on the epoch keep going through
+ * safepoints.
+ */
+static volatile atomic_uint_t gc_thread_epoch;
+static volatile atomic_uint_t gc_thread_epoch_acks;
+
+/* Card tables and the tops of thread stacks are scanned once per
+ * phase.  This is advanced with each phase change, and tells
+ * collectors which card ranges and stacks are claimed.
+ */
+static volatile unsigned int gc_thread_scan_pass;
+
+/* Threads destroyed while collectors may be looking at them are kept
+ * here, and destroyed after the final barrier.  Nothing is taken off
+ * until the barrier, so there is no ABA problem.
+ */
+static volatile atomic_ptr_t gc_thread_dead_list;
+
+/* Each generation has its own parity, which gives the meaning of the
+ * claimed and unclaimed values of forwarding pointers and array
+ * bitmaps in it.  A generation's parity flips with each collection
+ * which traces it.  Without remembered sets every collection traces
+ * every generation, so these all stay equal to the parity of
+ * gc_collection_count.  Double pointers always go by the latter.
+ */
+static volatile bool gc_thread_gen_parity[GC_MAX_GENS + 1];
 
 /* These track the generation being collected.  The next generation is
  * updated when collection of a specific generation is requested.
@@ -71,6 +128,15 @@ static const unsigned int gc_gen_promote = 2;
  *
  * Collectors first traverse the entire root set attempting to claim
  * each block for themselves, then begin processing their own queues.
+ * The root set is the global pointers, and the saved stacks of all
+ * threads.  Stacks are claimed in clusters of threads from the thread
+ * table, and walked using the program's frame descriptors.
+ * Only the top few frames of each stack are scanned at first.  The
+ * return address into the next frame is replaced with a trampoline
+ * (a stack barrier), and the rest of the stack is scanned later,
+ * either by a collector that has run out of other work, or by the
+ * thread itself as it returns into unscanned frames.  All stacks are
+ * finished before the middle barrier.
  * When a collector removes a thread from its queue, it performs a
  * snapshot copy of the block to the forwarding pointer, then attempts
  * to claim each of its heap pointers.
@@ -81,15 +147,15 @@ static const unsigned int gc_gen_promote = 2;
  * thread resumes, it processes its own write log, possibly adding new
  * blocks to its queue.
  *
- * Collectors periodically share work by pushing blocks from their own
- * queues onto a lock-free structure, or pulling blocks off this
- * structure onto their own.
+ * Each collector keeps its queue in a work-stealing deque, which
+ * other collectors can take blocks from.  When a collector exhausts
+ * its own queue, it steals half the deque of another collector,
+ * chosen at random.  Anything which doesn't fit in the deque goes on
+ * a private list, which is moved back into the deque as it drains.
  *
- * When a collector exhausts its own queue, it sets a bit on a mask
- * and enters a sleep state.  If a collector moves work onto the
- * workshare queue and other collectors are sleeping, it awakens one
- * of them.  Additionally, if a collector's write log becomes
- * non-empty, the collector must be reactivated.  The last collector
+ * When a collector can find no work, it sets a bit on a mask and
+ * enters a sleep state.  Additionally, if a collector's write log
+ * becomes non-empty, the collector must be reactivated.  The last collector
  * to finish the collection switches over the state before it
  * deactivates itself.
  *
@@ -102,8 +168,21 @@ static const unsigned int gc_gen_promote = 2;
 
 /* XXX the lower bits of object pointers need to be masked */
 
+/* Get the size of the bitmap for claiming clusters of threads. */
+static inline unsigned int gc_thread_stack_bitmap_size(const unsigned int
+						       threads) {
+
+  const unsigned int cache_line_bits = CACHE_LINE_SIZE * 8;
+  const unsigned int bits = ((threads - 1) / GC_CLUSTER_SIZE) + 1;
+
+  return (((bits - 1) & ~(cache_line_bits - 1)) + cache_line_bits) / 8;
+
+}
+
+
 internal unsigned int gc_thread_request(const unsigned int execs,
-					const unused unsigned int gens) {
+					const unsigned int gens,
+					const unsigned int threads) {
 
   PRINTD("  Reserving space for garbage collector\n");
 
@@ -111,22 +190,29 @@ internal unsigned int gc_thread_request(const unsigned int execs,
   const unsigned int gc_global_ptr_bitmap_size =
     (((gc_global_ptr_count - 1) & ~(cache_line_bits - 1))
      + cache_line_bits) / 8;
-  const unsigned int queue_size = lf_object_queue_request(64 * execs, execs);
+  const unsigned int stack_bitmap_size = gc_thread_stack_bitmap_size(threads);
+  const unsigned int queue_size = gc_deque_request(execs);
+  const unsigned int counters_size = gc_allocator_request(execs, gens);
 
   PRINTD("    Reserving 0x%x bytes for global pointer bitmap.\n",
 	 gc_global_ptr_bitmap_size);
-  PRINTD("    Reserving 0x%x bytes for object queue.\n",
+  PRINTD("    Reserving 0x%x bytes for thread stack bitmap.\n",
+	 stack_bitmap_size);
+  PRINTD("    Reserving 0x%x bytes for work-stealing deques.\n",
 	 queue_size);
   PRINTD("  Garbage collector total static size is 0x%x bytes.\n",
-	 queue_size + gc_global_ptr_bitmap_size);
+	 queue_size + gc_global_ptr_bitmap_size + stack_bitmap_size +
+	 counters_size);
 
-  return queue_size + gc_global_ptr_bitmap_size;
+  return queue_size + gc_global_ptr_bitmap_size + stack_bitmap_size +
+    counters_size;
 
 }
 
 
 internal void* gc_thread_init(const unsigned int execs,
-			      const unused unsigned int gens,
+			      const unsigned int gens,
+			      const unsigned int threads,
 			      void* const restrict mem) {
 
   PRINTD("Initializing GC system, static memory at 0x%p.\n", mem);
@@ -140,40 +226,52 @@ internal void* gc_thread_init(const unsigned int execs,
   const unsigned int gc_threads_size = execs * gc_thread_size;
   const unsigned int aligned_gc_threads_size =
     ((gc_threads_size - 1) & ~(CACHE_LINE_SIZE - 1)) + CACHE_LINE_SIZE;
-  void* const bitmap = lf_object_queue_init(mem, execs * 64, execs);
-  void* const out = (char*)bitmap + gc_global_ptr_bitmap_size;
+  const unsigned int stack_bitmap_size = gc_thread_stack_bitmap_size(threads);
+  void* const bitmap = (char*)mem + gc_deque_request(execs);
+  void* const stack_bitmap = (char*)bitmap + gc_global_ptr_bitmap_size;
+  void* const counters = (char*)stack_bitmap + stack_bitmap_size;
+  void* const out = (char*)counters + gc_allocator_request(execs, gens);
 
   PRINTD("GC system memory:\n");
-  PRINTD("\tobject queue at 0x%p\n", mem);
+  PRINTD("\twork-stealing deques at 0x%p\n", mem);
   PRINTD("\tglobal pointer bitmap at 0x%p\n", bitmap);
+  PRINTD("\tthread stack bitmap at 0x%p\n", stack_bitmap);
+  PRINTD("\tspace counters at 0x%p\n", counters);
   PRINTD("\tend at 0x%p\n", out);
 
-  os_thread_barrier_init(&gc_thread_initial_barrier_value, execs);
-  os_thread_barrier_init(&gc_thread_middle_barrier_value, execs);
-  os_thread_barrier_init(&gc_thread_final_barrier_value, execs);
+  gc_thread_epoch.value = 0;
+  gc_thread_epoch_acks.value = 0;
   gc_thread_data_index.value = 0;
+  gc_thread_stack_list.value = NULL;
+  gc_thread_dead_list.value = NULL;
   gc_thread_count = execs;
-  gc_workshare = mem;
+  gc_thread_deques = gc_deque_init(mem, execs);
   gc_global_ptr_bitmap = bitmap;
+  gc_thread_stack_bitmap = stack_bitmap;
   memset(gc_global_ptr_bitmap, 0, gc_global_ptr_bitmap_size);
+  memset(gc_thread_stack_bitmap, 0, stack_bitmap_size);
+  gc_allocator_init(counters, execs, gens);
 
   return out;
 
 }
 
 
-internal void gc_thread_executor_init(gc_closure_t* const closure,
-				      volatile gc_log_entry_t* const log) {
+internal void gc_closure_init(gc_closure_t* const closure,
+			      volatile gc_log_entry_t* const log,
+			      const unsigned int exec) {
 
-  closure->gth_workshare_count = 0;
-  closure->gth_queue_size = 0;
+  closure->gth_deque = gc_thread_deques + exec;
+  closure->gth_steal_seed = exec + 1;
+  closure->gth_epoch = ~0;
   closure->gth_head = NULL;
   closure->gth_tail = NULL;
-  closure->gth_unique_list = NULL;
-  memset(closure->gth_hash_table, 0, 1024 * sizeof(gc_write_log_hash_node_t*));
-
-  for(unsigned int i = 0; i < GC_WRITE_LOG_LENGTH; i++)
-    closure->gth_hash_nodes[i].wh_log_entry = log + i;
+  closure->gth_prefetch_head = 0;
+  closure->gth_prefetch_count = 0;
+  closure->gth_write_log_limit = GC_WRITE_LOG_LENGTH;
+  closure->gth_write_log_fills = 0;
+  closure->gth_write_log = log;
+  memset(closure->gth_dedup_table, 0, sizeof(closure->gth_dedup_table));
 
 }
 
@@ -230,8 +328,6 @@ internal void gc_thread_activate(const unsigned char gen) {
 static inline void gc_thread_enqueue(gc_closure_t* const restrict closure,
 				     volatile void* const obj) {
 
-  closure->gth_queue_size++;
-
   if(NULL == closure->gth_head) {
 
     gc_header_list_ptr_set(NULL, (void*)obj);
@@ -258,8 +354,6 @@ volatile void* gc_thread_dequeue(gc_closure_t* const restrict closure) {
 
   volatile void* const out = closure->gth_head;
 
-  closure->gth_queue_size--;
-
   if(closure->gth_tail != out)
     closure->gth_head = gc_header_list_ptr(out);
 
@@ -275,6 +369,162 @@ volatile void* gc_thread_dequeue(gc_closure_t* const restrict closure) {
 }
 
 
+/* Add a block to the local queue.  Blocks go in the deque, where
+ * other collectors can steal them, unless it is full.
+ */
+static inline void gc_thread_push(gc_closure_t* const restrict closure,
+				  volatile void* const obj) {
+
+  if(!gc_deque_push(closure->gth_deque, obj))
+    gc_thread_enqueue(closure, obj);
+
+}
+
+
+/* Get the next block from the local queue.  Once the deque runs dry,
+ * refill it from the overflow list, so those blocks can be stolen
+ * too.
+ */
+static inline
+volatile void* gc_thread_next(gc_closure_t* const restrict closure) {
+
+  volatile void* out = gc_deque_pop(closure->gth_deque);
+
+  if(NULL == out && NULL != closure->gth_head) {
+
+    out = gc_thread_dequeue(closure);
+
+    /* Take blocks off the list before publishing them, since a thief
+     * may reuse the list pointer as soon as it has one.
+     */
+    while(NULL != closure->gth_head) {
+
+      volatile void* const obj = gc_thread_dequeue(closure);
+
+      if(!gc_deque_push(closure->gth_deque, obj)) {
+
+	gc_thread_enqueue(closure, obj);
+	break;
+
+      }
+
+    }
+
+  }
+
+  return out;
+
+}
+
+
+/* Take the oldest block out of the prefetch ring without topping it
+ * up, or return NULL if it is empty.
+ */
+static inline
+volatile void* gc_thread_take_prefetched(gc_closure_t* const restrict closure) {
+
+  const unsigned int head = closure->gth_prefetch_head;
+  volatile void* out = NULL;
+
+  if(0 != closure->gth_prefetch_count) {
+
+    out = closure->gth_prefetch_ring[head];
+    closure->gth_prefetch_head = (head + 1) % GC_PREFETCH_DEPTH;
+    closure->gth_prefetch_count--;
+
+  }
+
+  return out;
+
+}
+
+
+/* Get the next block to process through the prefetch ring.  The ring
+ * is topped up from the local queue first, prefetching the header and
+ * first line of data of each block put in it, so that by the time a
+ * block comes out, it has most likely arrived.  The type descriptor
+ * can't be prefetched until the header has arrived, but these are
+ * shared by many objects, and usually in the cache anyway.
+ */
+static inline
+volatile void* gc_thread_next_prefetched(gc_closure_t* const restrict closure) {
+
+  const unsigned int head = closure->gth_prefetch_head;
+  unsigned int count = closure->gth_prefetch_count;
+  volatile void* obj;
+
+  while(GC_PREFETCH_DEPTH > count &&
+	NULL != (obj = gc_thread_next(closure))) {
+
+    closure->gth_prefetch_ring[(head + count) % GC_PREFETCH_DEPTH] = obj;
+    prefetch(obj);
+    prefetch((char*)obj + CACHE_LINE_SIZE);
+    count++;
+
+  }
+
+  closure->gth_prefetch_count = count;
+
+  return gc_thread_take_prefetched(closure);
+
+}
+
+
+/* Check for gray objects which only this collector can see.  Blocks
+ * in the prefetch ring and on the overflow list can't be stolen, and
+ * the deque may hold blocks nobody has got around to stealing.
+ */
+static inline bool gc_thread_has_local(gc_closure_t* const restrict closure) {
+
+  return 0 != closure->gth_prefetch_count || NULL != closure->gth_head ||
+    !gc_deque_empty(closure->gth_deque);
+
+}
+
+
+/* Pick a victim other than myself, using a xorshift generator. */
+static inline
+unsigned int gc_thread_victim(gc_closure_t* const restrict closure,
+			      const unsigned int exec) {
+
+  unsigned int seed = closure->gth_steal_seed;
+  unsigned int out;
+
+  seed ^= seed << 13;
+  seed ^= seed >> 17;
+  seed ^= seed << 5;
+  closure->gth_steal_seed = seed;
+  out = seed % (gc_thread_count - 1);
+
+  return out < exec ? out : out + 1;
+
+}
+
+
+/* Try to steal half of some other collector's deque.  Try as many
+ * victims as there are collectors before giving up.
+ */
+static inline bool gc_thread_steal(gc_closure_t* const restrict closure,
+				   const unsigned int exec) {
+
+  bool out = false;
+
+  if(1 < gc_thread_count)
+    for(unsigned int i = 0; !out && i < gc_thread_count; i++) {
+
+      const unsigned int victim = gc_thread_victim(closure, exec);
+
+      if(out = (0 != gc_deque_steal_half(gc_thread_deques + victim,
+					 closure->gth_deque)))
+	PRINTD("Executor %u stole work from executor %u\n", exec, victim);
+
+    }
+
+  return out;
+
+}
+
+
 /* Arrays are handled in a slightly more complex manner, based on
  * exactly what they store.
  *
@@ -335,14 +585,17 @@ static inline void gc_thread_add_obj(gc_closure_t* const restrict closure,
   const unsigned int size = gc_thread_obj_size(nonptr_size, normptrs, weakptrs);
 
   if(GC_TYPEDESC_NORMAL == class)
-    gc_thread_enqueue(closure, obj);
+    gc_thread_push(closure, obj);
 
   else {
 
     const unsigned int num = gc_header_array_len((void*)obj);
 
-    if(!gc_thread_array_shared(num, size))
-      gc_thread_enqueue(closure, obj);
+    /* Scalar arrays are copied in one go, which is faster than
+     * splitting them into clusters.
+     */
+    if(!gc_thread_array_shared(num, size) || (0 == normptrs && 0 == weakptrs))
+      gc_thread_push(closure, obj);
 
     else
       gc_thread_push_array(obj);
@@ -500,6 +753,69 @@ static inline volatile void* gc_thread_claim(gc_closure_t* restrict closure,
 					     bool copy);
 
 
+/* With card marking, the cards are remembered sets, and collections
+ * don't trace through generations they aren't collecting.
+ */
+static inline bool gc_thread_remembered(void) {
+
+  return GC_CARD_MARKING_ON == mm_card_marking;
+
+}
+
+
+static inline bool gc_thread_flipflop(const unsigned char gen) {
+
+  return gc_thread_gen_parity[gen];
+
+}
+
+
+internal void* gc_thread_unclaimed(const unsigned char gen) {
+
+  return gc_thread_flipflop(gen) ? (void*)0 : (void*)~0;
+
+}
+
+
+/* Get the parity a generation will have once this collection is over. */
+
+static inline bool gc_thread_next_flipflop(const unsigned char gen,
+					   const unsigned char max_gen) {
+
+  return gc_thread_gen_parity[gen] !=
+    (!gc_thread_remembered() || max_gen >= gen);
+
+}
+
+
+/* Get what a weak pointer to an object becomes: the object's new
+ * address if it survives, NULL otherwise.  Generations which aren't
+ * being collected, and large objects, survive in place.
+ */
+static inline void* gc_thread_weak_target(volatile void* const restrict obj) {
+
+  const unsigned char gen = gc_header_curr_gen(obj);
+  void* const unclaimed = gc_thread_flipflop(gen) ? (void*)0 : (void*)~0;
+  void* const fwd_ptr = gc_header_fwd_ptr(obj);
+  void* out;
+
+  if(gc_thread_remembered() && gc_thread_last_gen < gen)
+    out = (void*)obj;
+
+  else if(unclaimed == fwd_ptr)
+    out = NULL;
+
+  else if(gc_allocator_large(obj))
+    out = (void*)obj;
+
+  else
+    out = fwd_ptr;
+
+  return out;
+
+}
+
+
 /* Copy one pointer entry over to the destination.  Do not repeatedly
  * copy the pointer.  The check_ptr function does this.
  */
@@ -519,8 +835,16 @@ static inline void gc_thread_process_ptr(gc_closure_t* const restrict closure,
   /* If not a null pointer, then claim it and assign the result to the
    * field.
    */
-  if(NULL != src)
-    dstptr[unused_ptr] = (void*)gc_thread_claim(closure, src, max_gen, do_weak);
+  if(NULL != src) {
+
+    volatile void* const obj = gc_thread_claim(closure, src, max_gen, do_weak);
+
+    dstptr[unused_ptr] = (void*)obj;
+
+    if(gc_thread_remembered())
+      gc_card_remember(dstptr, obj);
+
+  }
 
   /* Otherwise just assign NULL */
   else if(NULL != dst)
@@ -544,25 +868,18 @@ static inline void gc_thread_process_weak_ptr(gc_closure_t* const
    */
   if(do_weak) {
 
-    void* const unclaimed = flipflop ? (void*)0 : (void*)~0;
     void* const restrict src = srcptr[used_ptr];
     void* const dst = dstptr[unused_ptr];
-    void* const fwd_ptr = gc_header_fwd_ptr(src);
 
     /* If the object to which the source points is unclamed, then
      * null out the destination.  Otherwise, copy the pointer.
      */
     if(NULL != src) {
 
-      if(unclaimed != fwd_ptr) {
-
-	if(dst != fwd_ptr)
-	  dstptr[unused_ptr] = fwd_ptr;
-
-	}
+      void* const target = gc_thread_weak_target(src);
 
-      else if(NULL != dst)
-	dstptr[unused_ptr] = NULL;
+      if(dst != target)
+	dstptr[unused_ptr] = target;
 
     }
 
@@ -575,6 +892,30 @@ static inline void gc_thread_process_weak_ptr(gc_closure_t* const
 }
 
 
+/* Prefetch the headers of the objects some pointers point to.  This
+ * is done for all of an object's pointers before claiming any of
+ * them, so that the misses overlap instead of each claim waiting on
+ * its own.
+ */
+static inline void gc_thread_prefetch_ptrs(volatile gc_double_ptr_t* const
+					   restrict ptrs,
+					   const unsigned int num) {
+
+  const bool flipflop = gc_collection_count % 2;
+  const unsigned int used_ptr = flipflop ? 0 : 1;
+
+  for(unsigned int i = 0; i < num; i++) {
+
+    void* const ptr = ptrs[i][used_ptr];
+
+    if(NULL != ptr)
+      prefetch(ptr);
+
+  }
+
+}
+
+
 /* Copy a normal object.  The dst and src pointer point to raw data,
  * not to the object headers, allowing this function to be used in
  * array copy functions.
@@ -605,6 +946,7 @@ static void gc_thread_copy(gc_closure_t* const restrict closure,
     volatile unsigned char* const restrict src_nonptr = src;
 
     memcpy((void*)dst_nonptr, (void*)src_nonptr, nonptr_size);
+    gc_thread_prefetch_ptrs(src_normptrs, num_normptrs);
 
     for(unsigned int i = 0; i < num_normptrs; i++)
       gc_thread_process_ptr(closure, src_normptrs[i], dst_normptrs[i],
@@ -642,7 +984,7 @@ static void gc_thread_copy(gc_closure_t* const restrict closure,
 
 
 /* Copy function for scalar arrays.  This is a straight one-fell-swoop
- * memcpy.
+ * memcpy, or a bulk copy if the array is big.
  */
 static inline void gc_thread_copy_scalar_array(volatile void* const
 					       restrict dst,
@@ -651,7 +993,13 @@ static inline void gc_thread_copy_scalar_array(volatile void* const
 					       const unsigned int num,
 					       const unsigned int size) {
 
-  memcpy((void*)dst, (void*)src, num * size);
+  const unsigned int total = num * size;
+
+  if(GC_ARRAY_BULK_COPY_SIZE <= total)
+    bulk_copy((void*)dst, (void*)src, total);
+
+  else
+    memcpy((void*)dst, (void*)src, total);
 
 }
 
@@ -703,13 +1051,26 @@ static inline void gc_thread_check_ptr(gc_closure_t* const restrict closure,
     void* const dst = dstptr[unused_ptr];
 
     /* If not a null pointer, then claim it and assign the result to
-     * the field
+     * the field.  Objects which aren't being collected stay where they
+     * are.
      */
     if(NULL != src) {
 
-      if(dst != gc_header_fwd_ptr(src))
-	dstptr[unused_ptr] = (void*)gc_thread_claim(closure, src, max_gen,
-						    do_weak);
+      void* const fwd_ptr =
+	max_gen < gc_header_curr_gen(src) || gc_allocator_large(src) ?
+	src : gc_header_fwd_ptr(src);
+
+      if(dst != fwd_ptr) {
+
+	volatile void* const obj =
+	  gc_thread_claim(closure, src, max_gen, do_weak);
+
+	dstptr[unused_ptr] = (void*)obj;
+
+	if(gc_thread_remembered())
+	  gc_card_remember(dstptr, obj);
+
+      }
 
       else
 	break;
@@ -741,31 +1102,20 @@ static inline void gc_thread_check_weak_ptr(gc_closure_t* const
   /* If I'm actually processing weak pointers, check to see if it was
    * preserved.  If it was, then copy it.  Otherwise, NULL it out.
    */
-  void* const unclaimed = flipflop ? (void*)0 : (void*)~0;
-
   for(;;) {
 
     void* const restrict src = srcptr[used_ptr];
     void* const dst = dstptr[unused_ptr];
-    void* const fwd_ptr = gc_header_fwd_ptr(src);
 
     /* If the object to which the source points is unclamed, then
      * null out the destination.  Otherwise, copy the pointer.
      */
     if(NULL != src) {
 
-      if(unclaimed != fwd_ptr) {
-
-	if(dst != fwd_ptr)
-	  dstptr[unused_ptr] = fwd_ptr;
-
-	else
-	  break;
-
-      }
+      void* const target = gc_thread_weak_target(src);
 
-      else if(NULL != dst)
-	dstptr[unused_ptr] = NULL;
+      if(dst != target)
+	dstptr[unused_ptr] = target;
 
       else
 	break;
@@ -919,11 +1269,16 @@ static void gc_thread_update(gc_closure_t* const restrict closure,
   volatile gc_double_ptr_t* const restrict weakptrs = normptrs + num_normptrs;
 
   /* Claim all normal pointers and assign them to the unused slot */
-  if(!copied)
+  if(!copied) {
+
+    gc_thread_prefetch_ptrs(normptrs, num_normptrs);
+
     for(unsigned int i = 0; i < num_normptrs; i++)
       gc_thread_process_ptr(closure, normptrs[i], normptrs[i],
 			    max_gen, do_weak);
 
+  }
+
   /* Process weak pointers */
   if(do_weak) {
 
@@ -1062,7 +1417,7 @@ static inline void gc_thread_process(gc_closure_t* const restrict closure,
 				     const unsigned char max_gen,
 				     const bool do_weak) {
 
-  const bool flipflop = gc_collection_count % 2;
+  const bool flipflop = gc_thread_flipflop(gc_header_curr_gen(src));
   const unsigned int* const type = gc_header_type(src);
   const gc_typedesc_class_t class = gc_typedesc_class(type);
   const unsigned int nonptr_size = gc_typedesc_nonptr_size(type);
@@ -1078,9 +1433,9 @@ static inline void gc_thread_process(gc_closure_t* const restrict closure,
   /* If the object is being collected, copy all its fields.  Objects
    * which are being collected will not have their forwarding pointers
    * set to "claimed".  Note that the lower two bits of the forwarding
-   * pointer have to be excluded.
+   * pointer have to be excluded.  Large objects are never copied.
    */
-  if(masked_fwd_ptr != masked_claimed) {
+  if(masked_fwd_ptr != masked_claimed && !gc_allocator_large(src)) {
 
     const bool copied = !((unsigned int)raw_fwd_ptr & 0x1);
     void* const restrict dst = (void*)masked_fwd_ptr;
@@ -1176,7 +1531,7 @@ static inline void gc_thread_process_cluster(gc_closure_t* const
 					     const unsigned char max_gen,
 					     const bool do_weak) {
 
-  const bool flipflop = gc_collection_count % 2;
+  const bool flipflop = gc_thread_flipflop(gc_header_curr_gen(src));
   const unsigned int* const type = gc_header_type(src);
   const unsigned int nonptr_size = gc_typedesc_weak_ptrs(type);
   const unsigned int num_normptrs = gc_typedesc_weak_ptrs(type);
@@ -1199,9 +1554,9 @@ static inline void gc_thread_process_cluster(gc_closure_t* const
   /* If the object is being collected, copy all its fields.  Objects
    * which are being collected will not have their forwarding pointers
    * set to "claimed".  Note that the lower two bits of the forwarding
-   * pointer have to be excluded.
+   * pointer have to be excluded.  Large objects are never copied.
    */
-  if(masked_fwd_ptr != masked_claimed) {
+  if(masked_fwd_ptr != masked_claimed && !gc_allocator_large(src)) {
 
     const bool copied = !((unsigned int)raw_fwd_ptr & 0x1);
     void* const restrict dst = (void*)masked_fwd_ptr;
@@ -1256,7 +1611,6 @@ static inline int gc_thread_try_claim_cluster(gc_closure_t* const
 					      const unsigned char max_gen,
 					      const bool do_weak) {
 
-  const bool flipflop = gc_collection_count % 2;
   void* array = gc_thread_array_list.value;
   int out = -1;
 
@@ -1264,6 +1618,7 @@ static inline int gc_thread_try_claim_cluster(gc_closure_t* const
 
     INVARIANT(gc_header_array_len(array) > GC_ARRAY_MIN_COUNT);
 
+    const bool flipflop = gc_thread_flipflop(gc_header_curr_gen(array));
     const unsigned int num = gc_header_array_len(array);
     const unsigned int bitmap_size = gc_thread_array_bitmap_size(num);
     const unsigned int bitmap_bits = gc_thread_array_bitmap_bits(num);
@@ -1410,86 +1765,465 @@ static inline bool gc_thread_claim_globals(gc_closure_t* const restrict closure,
 }
 
 
-/* Possibly allocate the new object, mark the current object as having
- * been claimed, initialize the object to be collected, then add the
- * object to the queues.
+/* Find the frame descriptor for a return address, or NULL if there
+ * is none.
  */
-static inline volatile void* gc_thread_claim(gc_closure_t* const
-					     restrict closure,
-					     volatile void* const restrict obj,
-					     const unsigned char max_gen,
-					     const bool copy) {
+static inline const gc_framedesc_t* gc_thread_frame_desc(const void* const
+							 retaddr) {
 
-  const bool flipflop = gc_collection_count % 2;
-  void* const claimed = flipflop ? (void*)~0 : (void*)0;
-  void* const unclaimed = flipflop ? (void*)0 : (void*)~0;
-  void* const restrict fwd_ptr = gc_header_fwd_ptr(obj);
-  const unsigned int* const restrict type = gc_header_type(obj);
-  const gc_typedesc_class_t class = gc_typedesc_class(type);
-  const unsigned int nonptr_size = gc_typedesc_nonptr_size(type);
-  const unsigned int num_normptrs = gc_typedesc_normal_ptrs(type);
-  const unsigned int num_weakptrs = gc_typedesc_weak_ptrs(type);
-  const unsigned int len =
-    GC_TYPEDESC_NORMAL == class ? 1 : gc_header_array_len(obj);
-  const unsigned int flags = gc_header_flags(obj);
-  const unsigned int obj_size =
-    gc_thread_obj_size(nonptr_size, num_normptrs, num_weakptrs);
-  const unsigned int raw_size = obj_size * len;
-  const unsigned int aligned_size = GC_TYPEDESC_NORMAL == class ?
-    gc_thread_aligned_normal_size(raw_size) :
-    gc_thread_aligned_array_size(raw_size, len);
-  const unsigned char curr_gen = gc_header_curr_gen(obj);
-  const unsigned char next_gen = gc_header_next_gen(obj);
-  const unsigned char count = gc_header_count(obj);
-  const gen_count_t new_gen_count =
-    gc_thread_new_gen_count(curr_gen, next_gen, count);
-  volatile void* out;
+  unsigned int low = 0;
+  unsigned int high = gc_frame_desc_count;
+  const gc_framedesc_t* out = NULL;
 
-  /* If the object is being collected, then allocate a copy and CAS
-   * the pointer into the forwarding pointer, add the object to the
-   * queue if the CAS succeeds 
-   */
-  if(max_gen >= curr_gen) {
+  while(NULL == out && low < high) {
 
-    /* If the object is not claimed, then attempt to claim it */
-    if(unclaimed == fwd_ptr) {
+    const unsigned int mid = low + ((high - low) / 2);
+    const void* const curr = gc_frame_descs[mid].fd_retaddr;
 
-      /* Allocate an object.  If it's an array, skip the prelude */
-      void* const alloc =
-	gc_allocator_gc_prealloc(closure, aligned_size, new_gen_count.gc_gen);
-      void* const newobj = GC_TYPEDESC_NORMAL == class ?
-	alloc : gc_thread_array_header(alloc, len, obj_size);
-      void* const fwd_ptr =
-	!copy ? (void*)((unsigned int)newobj ^ 1) : newobj;
+    if(retaddr < curr)
+      high = mid;
 
-      if(gc_header_compare_and_set_fwd_ptr(unclaimed, newobj, obj)) {
+    else if(retaddr > curr)
+      low = mid + 1;
 
-	out = newobj;
-	gc_allocator_gc_postalloc(closure, aligned_size, new_gen_count.gc_gen);
+    else
+      out = gc_frame_descs + mid;
 
-	/* Initialize the header.  The forwarding pointer gets
-	 * initialized to claimed, because these are reversed at the
-	 * end of collection.
-	 */
-	if(GC_TYPEDESC_NORMAL == class)
-	  gc_header_init_normal(claimed, type, flags,
-				new_gen_count.gc_gen,
-				next_gen,
-				new_gen_count.gc_count,
-				newobj);
+  }
 
-	else {
+  return out;
 
-	  gc_header_init_array(claimed, type, flags,
-			       new_gen_count.gc_gen,
-			       next_gen,
-			       new_gen_count.gc_count,
-			       len, newobj);
+}
 
-	  /* Initialize the bitmap if it exists */
+
+/* Scan up to depth frames of a thread's stack, starting at the given
+ * frame, or all of them if depth is 0.  Frame pointers are
+ * double-pointers, and are handled just like global pointers.  If
+ * frames are left, the return address into the first of them is
+ * replaced with the trampoline, and the barrier is armed.  Otherwise
+ * it is cleared.  Returns true if the barrier was armed.
+ *
+ * The barrier may only be armed on a stopped thread whose top has
+ * been claimed, or by the thread itself at its barrier; anything else
+ * could write the trampoline over a frame the thread is using.
+ */
+static inline bool gc_thread_scan_frames(gc_closure_t* const restrict closure,
+					 thread_t* const restrict thread,
+					 char* frame, const void* retaddr,
+					 const unsigned int depth,
+					 const unsigned char max_gen,
+					 const bool do_weak) {
+
+  const void** slot = NULL;
+  const gc_framedesc_t* desc;
+  bool out = false;
+
+  PRINTD("Scanning %u frames of thread %p, frame %p, return address %p\n",
+	 depth, thread, frame, retaddr);
+
+  for(unsigned int i = 0; (0 == depth || i < depth) && NULL != frame &&
+	NULL != (desc = gc_thread_frame_desc(retaddr)); i++) {
+
+    for(unsigned int j = 0; j < desc->fd_num_ptrs; j++) {
+
+      gc_double_ptr_t* const ptr =
+	(gc_double_ptr_t*)(frame + desc->fd_ptrs[j]);
+
+      gc_thread_process_ptr(closure, *ptr, *ptr, max_gen, do_weak);
+      gc_thread_check_ptr(closure, *ptr, *ptr, max_gen, do_weak);
+
+    }
+
+    slot = (const void**)(frame + desc->fd_retaddr_offset);
+    retaddr = *slot;
+    frame += desc->fd_size;
+
+  }
+
+  if(NULL != slot && NULL != gc_thread_frame_desc(retaddr)) {
+
+    INVARIANT(GC_SCAN_BUSY(gc_thread_scan_pass) == thread->t_gc_scan.value ||
+	      thread == executor_curr_thread(executor_self()));
+    PRINTD("Arming stack barrier for thread %p at frame %p\n",
+	   thread, frame);
+    thread->t_gc_barrier_slot = slot;
+    thread->t_gc_barrier_retaddr = retaddr;
+    thread->t_gc_barrier_frame = frame;
+    *slot = (const void*)gc_stack_trampoline;
+    store_fence();
+    thread->t_gc_barrier.value = GC_BARRIER_ARMED;
+    out = true;
+
+  }
+
+  else {
+
+    store_fence();
+    thread->t_gc_barrier.value = GC_BARRIER_NONE;
+
+  }
+
+  return out;
+
+}
+
+
+static inline bool gc_thread_try_push_stack(thread_t* const restrict thread) {
+
+  thread_t* const top = gc_thread_stack_list.value;
+
+  thread->t_gc_barrier_next = top;
+
+  return atomic_compare_and_set_ptr(top, thread, &gc_thread_stack_list);
+
+}
+
+
+/* Scan the top of a thread's stack.  The thread must be stopped, and
+ * claimed with gc_thread_claim_top.  A trampoline left over from the
+ * last collection is taken out first, since the walk can't see past
+ * it.
+ */
+static inline void gc_thread_scan_stack(gc_closure_t* const restrict closure,
+					thread_t* const restrict thread,
+					const unsigned char max_gen,
+					const bool do_weak) {
+
+  const void* const retaddr =
+    (const void*)*thread_mbox_retaddr(thread->t_mbox);
+  char* const frame = (char*)*thread_mbox_stkptr(thread->t_mbox);
+
+  if(NULL != thread->t_gc_barrier_slot) {
+
+    *(thread->t_gc_barrier_slot) = thread->t_gc_barrier_retaddr;
+    thread->t_gc_barrier_slot = NULL;
+
+  }
+
+  if(gc_thread_scan_frames(closure, thread, frame, retaddr,
+			   GC_STACK_BARRIER_DEPTH, max_gen, do_weak))
+    for(unsigned int i = 1; !gc_thread_try_push_stack(thread); i++)
+      backoff_delay(i);
+
+}
+
+
+/* The top of a thread's stack is scanned once per pass, either by a
+ * collector or by the executor resuming the thread, whichever claims
+ * it first.  Every thread is stopped at a phase change, and a claimed
+ * thread can't be resumed until its scan is done, so stacks are only
+ * ever walked and barriers only ever armed on stopped threads.
+ * Returns true if the stack was claimed, false if it has been or is
+ * being scanned already.
+ */
+static inline bool gc_thread_claim_top(thread_t* const restrict thread,
+				       const unsigned int pass) {
+
+  bool out = false;
+
+  for(unsigned int i = 1;; i++) {
+
+    const unsigned int old = thread->t_gc_scan.value;
+
+    if(GC_SCAN_DONE(pass) <= old)
+      break;
+
+    else if(atomic_compare_and_set_uint(old, GC_SCAN_BUSY(pass),
+					&(thread->t_gc_scan))) {
+
+      out = true;
+      break;
+
+    }
+
+    else
+      backoff_delay(i);
+
+  }
+
+  return out;
+
+}
+
+
+static inline void gc_thread_finish_top(thread_t* const restrict thread,
+					const unsigned int pass) {
+
+  store_fence();
+  thread->t_gc_scan.value = GC_SCAN_DONE(pass);
+
+}
+
+
+/* Scan the stacks of all threads in the given cluster of the thread
+ * table.  Threads which have been resumed already were scanned by
+ * their executors.
+ */
+static inline void gc_thread_process_stacks(gc_closure_t* const
+					    restrict closure,
+					    const unsigned int index,
+					    const unsigned char max_gen,
+					    const bool do_weak) {
+
+  const unsigned int pass = gc_thread_scan_pass;
+  const unsigned int count = thread_tab_count();
+  const unsigned int real_index = index * GC_CLUSTER_SIZE;
+
+  for(unsigned int i = real_index;
+      i < real_index + GC_CLUSTER_SIZE && i < count;
+      i++) {
+
+    thread_t* const thread = thread_tab_get(i);
+
+    if(NULL != thread && gc_thread_claim_top(thread, pass)) {
+
+      gc_thread_scan_stack(closure, thread, max_gen, do_weak);
+      gc_thread_finish_top(thread, pass);
+
+    }
+
+  }
+
+}
+
+
+static inline int gc_thread_try_claim_stacks(gc_closure_t* const
+					     restrict closure,
+					     const unsigned char max_gen,
+					     const bool do_weak) {
+
+  const unsigned int count = thread_tab_count();
+  int out = -1;
+
+  if(0 != count) {
+
+    const bool flipflop = gc_collection_count % 2;
+    const unsigned int bitmap_bits = ((count - 1) / GC_CLUSTER_SIZE) + 1;
+    const int bitmap_index =
+      atomic_bitmap_alloc(gc_thread_stack_bitmap, bitmap_bits, flipflop);
+
+    /* If a legitimate index comes back, then go with it and exit with
+     * success.
+     */
+    if(0 <= bitmap_index) {
+
+      gc_thread_process_stacks(closure, bitmap_index, max_gen, do_weak);
+      out = 1;
+
+    }
+
+    /* If temporary failure comes back, then propogate it */
+    else if(-1 == bitmap_index)
+      out = 0;
+
+  }
+
+  return out;
+
+}
+
+
+/* Claim and process one cluster of thread stacks, return true if one
+ * actually got processed, false otherwise.
+ */
+static inline bool gc_thread_claim_stacks(gc_closure_t* const restrict closure,
+					  const unsigned char max_gen,
+					  const bool do_weak) {
+
+  int res;
+
+  for(unsigned int i = 1;
+      res = gc_thread_try_claim_stacks(closure, max_gen, do_weak);
+      i++)
+    backoff_delay(i);
+
+  return 0 < res;
+
+}
+
+
+static inline thread_t* gc_thread_try_pop_stack(bool* const restrict valid) {
+
+  thread_t* const top = gc_thread_stack_list.value;
+
+  *valid = NULL == top ||
+    atomic_compare_and_set_ptr(top, top->t_gc_barrier_next,
+			       &gc_thread_stack_list);
+
+  return top;
+
+}
+
+
+/* Finish scanning a partly scanned stack.  The thread may be
+ * returning through the trampoline at the same time, in which case it
+ * scans some frames itself and moves the barrier down; keep going
+ * until the barrier is gone.
+ */
+static inline void gc_thread_finish_stack(gc_closure_t* const restrict closure,
+					  thread_t* const restrict thread,
+					  const unsigned char max_gen,
+					  const bool do_weak) {
+
+  for(unsigned int i = 1;; i++) {
+
+    const unsigned int state = thread->t_gc_barrier.value;
+
+    if(GC_BARRIER_NONE == state)
+      break;
+
+    else if(GC_BARRIER_ARMED == state &&
+	    atomic_compare_and_set_uint(GC_BARRIER_ARMED, GC_BARRIER_BUSY,
+					&(thread->t_gc_barrier))) {
+
+      /* The trampoline stays in place, but finds nothing left to do. */
+      gc_thread_scan_frames(closure, thread, thread->t_gc_barrier_frame,
+			    thread->t_gc_barrier_retaddr, 0, max_gen, do_weak);
+      break;
+
+    }
+
+    else
+      backoff_delay(i);
+
+  }
+
+}
+
+
+/* Take one partly scanned stack and finish it, return true if one
+ * actually got processed, false otherwise.
+ */
+static inline bool gc_thread_claim_stack_rest(gc_closure_t* const
+					      restrict closure,
+					      const unsigned char max_gen,
+					      const bool do_weak) {
+
+  thread_t* thread;
+  bool valid;
+
+  for(unsigned int i = 1; thread = gc_thread_try_pop_stack(&valid), !valid;
+      i++)
+    backoff_delay(i);
+
+  if(NULL != thread)
+    gc_thread_finish_stack(closure, thread, max_gen, do_weak);
+
+  return NULL != thread;
+
+}
+
+
+/* Possibly allocate the new object, mark the current object as having
+ * been claimed, initialize the object to be collected, then add the
+ * object to the queues.
+ */
+static inline volatile void* gc_thread_claim(gc_closure_t* const
+					     restrict closure,
+					     volatile void* const restrict obj,
+					     const unsigned char max_gen,
+					     const bool copy) {
+
+  const bool flipflop = gc_thread_flipflop(gc_header_curr_gen(obj));
+  void* const claimed = flipflop ? (void*)~0 : (void*)0;
+  void* const unclaimed = flipflop ? (void*)0 : (void*)~0;
+  void* const restrict fwd_ptr = gc_header_fwd_ptr(obj);
+  const unsigned int* const restrict type = gc_header_type(obj);
+  const gc_typedesc_class_t class = gc_typedesc_class(type);
+  const unsigned int nonptr_size = gc_typedesc_nonptr_size(type);
+  const unsigned int num_normptrs = gc_typedesc_normal_ptrs(type);
+  const unsigned int num_weakptrs = gc_typedesc_weak_ptrs(type);
+  const unsigned int len =
+    GC_TYPEDESC_NORMAL == class ? 1 : gc_header_array_len(obj);
+  const unsigned int flags = gc_header_flags(obj);
+  const unsigned int obj_size =
+    gc_thread_obj_size(nonptr_size, num_normptrs, num_weakptrs);
+  const unsigned int raw_size = obj_size * len;
+  const unsigned int aligned_size = GC_TYPEDESC_NORMAL == class ?
+    gc_thread_aligned_normal_size(raw_size) :
+    gc_thread_aligned_array_size(raw_size, len);
+  const unsigned char curr_gen = gc_header_curr_gen(obj);
+  const unsigned char next_gen = gc_header_next_gen(obj);
+  const unsigned char count = gc_header_count(obj);
+  const gen_count_t new_gen_count =
+    gc_thread_new_gen_count(curr_gen, next_gen, count);
+  volatile void* out;
+
+  /* Large objects are never copied.  They are marked in place, and
+   * their slices are kept by the allocator at the end of the
+   * collection.
+   */
+  if(max_gen >= curr_gen && gc_allocator_large(obj)) {
+
+    out = obj;
+
+    if(unclaimed == fwd_ptr &&
+       gc_header_compare_and_set_fwd_ptr(unclaimed, claimed, obj)) {
+
+      gc_allocator_mark_large(obj);
+
+      if(GC_CARD_MARKING_ON == mm_card_marking)
+	gc_card_note_object(obj);
+
+      gc_thread_add_obj(closure, type, obj);
+
+    }
+
+  }
+
+  /* If the object is being collected, then allocate a copy and CAS
+   * the pointer into the forwarding pointer, add the object to the
+   * queue if the CAS succeeds 
+   */
+  else if(max_gen >= curr_gen) {
+
+    /* If the object is not claimed, then attempt to claim it */
+    if(unclaimed == fwd_ptr) {
+
+      /* Allocate an object.  If it's an array, skip the prelude */
+      void* const alloc =
+	gc_allocator_gc_prealloc(closure, aligned_size, new_gen_count.gc_gen);
+      void* const newobj = GC_TYPEDESC_NORMAL == class ?
+	alloc : gc_thread_array_header(alloc, len, obj_size);
+      void* const fwd_ptr =
+	!copy ? (void*)((unsigned int)newobj ^ 1) : newobj;
+
+      if(gc_header_compare_and_set_fwd_ptr(unclaimed, newobj, obj)) {
+
+	out = newobj;
+	gc_allocator_gc_postalloc(closure, aligned_size, new_gen_count.gc_gen);
+
+	if(GC_CARD_MARKING_ON == mm_card_marking)
+	  gc_card_note_object(newobj);
+
+	/* Initialize the header.  The forwarding pointer gets
+	 * initialized to claimed, because these are reversed at the
+	 * end of collection.  If the new generation won't be, it gets
+	 * unclaimed instead.
+	 */
+	const bool new_flipflop =
+	  !gc_thread_next_flipflop(new_gen_count.gc_gen, max_gen);
+	void* const new_claimed = new_flipflop ? (void*)~0 : (void*)0;
+
+	if(GC_TYPEDESC_NORMAL == class)
+	  gc_header_init_normal(new_claimed, type, flags,
+				new_gen_count.gc_gen,
+				next_gen,
+				new_gen_count.gc_count,
+				newobj);
+
+	else {
+
+	  gc_header_init_array(new_claimed, type, flags,
+			       new_gen_count.gc_gen,
+			       next_gen,
+			       new_gen_count.gc_count,
+			       len, newobj);
+
+	  /* Initialize the bitmap if it exists */
 	  if(gc_thread_array_shared(len, obj_size)) {
 
-	    const unsigned char bitmap_value = flipflop ? 0xff : 0;
+	    const unsigned char bitmap_value = new_flipflop ? 0xff : 0;
 	    const unsigned int bitmap_size =
 	      gc_thread_array_bitmap_size(len) - sizeof(unsigned int);
 
@@ -1514,6 +2248,13 @@ static inline volatile void* gc_thread_claim(gc_closure_t* const
 
   }
 
+  /* With remembered sets, objects which aren't being collected are
+   * left alone.  Anything in them pointing into what is being
+   * collected is found from the cards.
+   */
+  else if(gc_thread_remembered())
+    out = obj;
+
   /* Otherwise CAS the claimed tag into the forwarding pointer, and
    * add the object to the queue if the CAS succeeds.
    */
@@ -1536,6 +2277,48 @@ static inline volatile void* gc_thread_claim(gc_closure_t* const
 
 
 
+/* Process a remembered location in an object which isn't being
+ * collected.  The unused half of the pointer is brought up to date in
+ * place.  Until the halves agree again, the card stays dirty, so the
+ * next collection looks at it whatever it collects.
+ */
+static inline void gc_thread_process_remembered(gc_closure_t* const
+						restrict closure,
+						void* const restrict obj,
+						const unsigned int offset,
+						const unsigned char max_gen,
+						const bool do_weak) {
+
+  const unsigned int* const type = gc_header_type(obj);
+  const unsigned int nonptr_size = gc_typedesc_nonptr_size(type);
+  const unsigned int num_normptrs = gc_typedesc_normal_ptrs(type);
+  const unsigned int num_weakptrs = gc_typedesc_weak_ptrs(type);
+  const unsigned int size =
+    gc_thread_obj_size(nonptr_size, num_normptrs, num_weakptrs);
+  const unsigned int normptr_end =
+    nonptr_size + (num_normptrs * sizeof(gc_double_ptr_t));
+  const unsigned int field = 0 != size ? offset % size : 0;
+  void* volatile* const ptr =
+    (void* volatile*)((char*)obj + sizeof(gc_header_t) + offset);
+
+  if(field >= nonptr_size) {
+
+    if(field < normptr_end)
+      gc_thread_check_ptr(closure, ptr, ptr, max_gen, do_weak);
+
+    else if(do_weak)
+      gc_thread_check_weak_ptr(closure, ptr, ptr);
+
+    /* Weak pointers wait for the weak pass. */
+    if(ptr[0] != ptr[1] ||
+       (!do_weak && field >= normptr_end && NULL != ptr[0]))
+      gc_card_mark(ptr);
+
+  }
+
+}
+
+
 /* Process a single write log entry */
 
 static inline void gc_thread_process_write_entry(gc_closure_t* const
@@ -1545,14 +2328,23 @@ static inline void gc_thread_process_write_entry(gc_closure_t* const
 						 const bool do_weak) {
 
   void* const src = gc_log_entry_objptr(ent);
-  const bool flipflop = gc_collection_count % 2;
+  const unsigned char curr_gen = gc_header_curr_gen(src);
+  const bool flipflop = gc_thread_flipflop(curr_gen);
   void* const unclaimed = flipflop ? (void*)0 : (void*)~0L;
-  volatile void* const dst = gc_header_fwd_ptr(src);
+  const bool large = gc_allocator_large(src);
+  volatile void* const fwd_ptr = gc_header_fwd_ptr(src);
+  volatile void* const dst = large ? src : fwd_ptr;
+
+  /* With remembered sets, objects which aren't being collected are
+   * never claimed.
+   */
+  if(gc_thread_remembered() && max_gen < curr_gen)
+    gc_thread_process_remembered(closure, src, gc_log_entry_offset(ent),
+				 max_gen, do_weak);
 
   /* Unclaimed objects are simply ignored. */
-  if(unclaimed != dst) {
+  else if(unclaimed != fwd_ptr) {
 
-    const unsigned char curr_gen = gc_header_curr_gen(src);
     const unsigned int offset = gc_log_entry_offset(ent);
     const unsigned int real_offset = sizeof(gc_header_t) + offset;
     const unsigned int* const type = gc_header_type((void*)src);
@@ -1562,8 +2354,10 @@ static inline void gc_thread_process_write_entry(gc_closure_t* const
     const unsigned int normptr_end =
       nonptr_size + (num_normptrs * sizeof(gc_double_ptr_t));
 
-    /* If the object is being collected, copy the field entirely */
-    if(max_gen >= curr_gen) {
+    /* If the object is being copied, copy the field entirely.  Large
+     * objects are marked in place, like uncollected ones.
+     */
+    if(max_gen >= curr_gen && !large) {
 
       /* If the offset falls within non-pointer space, simply copy
        * from src to new.
@@ -1622,96 +2416,332 @@ static inline void gc_thread_process_write_entry(gc_closure_t* const
 }
 
 
-static inline
-unsigned int gc_thread_hash_table_index(gc_write_log_hash_node_t* const
-					restrict node) {
+static inline unsigned int gc_thread_dedup_hash(const void* const addr) {
 
-  const unsigned int hash =
-    (unsigned int)(gc_log_entry_objptr(node->wh_log_entry));
+  const unsigned int hash = ((unsigned int)addr >> 2) * 2654435761u;
 
-  return hash % 4091;
+  return (hash >> 16) & (GC_WRITE_LOG_BUCKETS - 1);
 
 }
 
 
-/* Insert only if there is not already something in the table */
+/* Insert an address into the dedup table, returning false if it was
+ * already there.  The table is never more than half full, so this
+ * always finds room.
+ */
+static inline bool gc_thread_dedup_insert(gc_closure_t* const restrict closure,
+					  const void* const addr,
+					  unsigned int* const restrict touched) {
 
-static inline void gc_thread_hash_table_insert(gc_closure_t* const
-					       restrict closure,
-					       gc_write_log_hash_node_t* const
-					       restrict node) {
+  bool out = false;
 
-  void* const addr = gc_log_entry_objptr(node->wh_log_entry);
-  const unsigned int index = gc_thread_hash_table_index(node);
-  gc_write_log_hash_node_t* curr = thread->gth_hash_table[index];
-  bool present = false;
+  for(unsigned int i = gc_thread_dedup_hash(addr);;
+      i = (i + 1) & (GC_WRITE_LOG_BUCKETS - 1)) {
 
-  /* Check to see if it's there */
-  while(NULL != curr)
-    if(addr == gc_log_entry_objptr(curr->wh_log_entry)) {
+    gc_write_log_bucket_t* const bucket = closure->gth_dedup_table + i;
+    unsigned int used = 0;
+    bool found = false;
 
-      present = true;
-      break;
+    /* Look at the whole bucket without branching, so that this can
+     * be done with vector compares.
+     */
+    for(unsigned int j = 0; j < GC_WRITE_LOG_BUCKET_SIZE; j++) {
+
+      used += NULL != bucket->wb_slots[j];
+      found |= addr == bucket->wb_slots[j];
 
     }
 
-    else
-      curr = curr->wh_hash_next;
+    if(found)
+      break;
 
-  /* If not, add it to the table and to the list */
-  if(!present) {
+    else if(used < GC_WRITE_LOG_BUCKET_SIZE) {
 
-    node->wh_hash_next = curr;
-    closure->gth_hash_table[index] = node;
-    node->wh_list_next = closure->gth_unique_list;
-    closure->gth_unique_list = node;
+      /* Remember which buckets were used, to empty them afterward. */
+      if(0 == used)
+	closure->gth_dedup_used[(*touched)++] = i;
+
+      bucket->wb_slots[used] = addr;
+      out = true;
+      break;
+
+    }
 
   }
 
+  return out;
+
 }
 
 
-/* This function makes use of a per-thread hash table and nodes to
- * avoid processing a given location multiple times.
+/* This function makes use of a per-thread hash table to avoid
+ * processing a given location multiple times.
  */
-
 static inline void gc_thread_clear_write_log(gc_closure_t* const
 					     restrict closure,
 					     const unsigned int index,
 					     const unsigned char max_gen,
 					     const bool do_weak) {
 
-  gc_write_log_hash_node_t* curr;
+  volatile gc_log_entry_t* const log = closure->gth_write_log;
+  unsigned int unique = 0;
+  unsigned int touched = 0;
+
+  INVARIANT(index <= GC_WRITE_LOG_MAX_LENGTH);
 
-  /* There is no need to clear the hash table (which would take a long
-   * time), as entries will be wiped out at the end, when the table is
-   * scanned.
-   */
   for(unsigned int i = 0; i < index; i++)
-    /* The hash node at index i is initialized to point to the write
-     * log entry at index i, and this never changes.
-     */
-    gc_thread_hash_table_insert(closure, closure->gth_hash_nodes + i);
+    if(gc_thread_dedup_insert(closure, gc_log_entry_objptr(log + i),
+			      &touched))
+      closure->gth_unique_entries[unique++] = i;
+
+  /* Only the buckets that were used need to be emptied. */
+  for(unsigned int i = 0; i < touched; i++)
+    memset(closure->gth_dedup_table + closure->gth_dedup_used[i], 0,
+	   sizeof(gc_write_log_bucket_t));
+
+  for(unsigned int i = 0; i < unique; i++)
+    gc_thread_process_write_entry(closure,
+				  log + closure->gth_unique_entries[i],
+				  max_gen, do_weak);
+
+}
+
+
+/* Grow the write log if it keeps filling up.  Mutators on this
+ * executor pick up the new limit the next time they are scheduled.
+ */
+static inline void gc_thread_count_write_log(gc_closure_t* const
+					     restrict closure,
+					     const unsigned int index) {
+
+  if(index >= closure->gth_write_log_limit &&
+     GC_WRITE_LOG_GROW_FILLS < ++(closure->gth_write_log_fills) &&
+     GC_WRITE_LOG_MAX_LENGTH > closure->gth_write_log_limit) {
+
+    closure->gth_write_log_limit *= 2;
+    closure->gth_write_log_fills = 0;
+    PRINTD("Growing write log to %u entries\n",
+	   closure->gth_write_log_limit);
+
+  }
+
+}
+
+
+/* Process the part of an object which lies in a card as if every
+ * location there were in the write log.
+ */
+static inline void gc_thread_scan_card_obj(gc_closure_t* const
+					   restrict closure,
+					   void* const restrict obj,
+					   const char* const start,
+					   const char* const end,
+					   const unsigned char max_gen,
+					   const bool do_weak) {
+
+  const unsigned int* const type = gc_header_type(obj);
+  const unsigned int nonptr_size = gc_typedesc_nonptr_size(type);
+  const unsigned int normptrs = gc_typedesc_normal_ptrs(type);
+  const unsigned int weakptrs = gc_typedesc_weak_ptrs(type);
+  const unsigned int size = gc_thread_obj_size(nonptr_size, normptrs, weakptrs);
+  const unsigned int len = GC_TYPEDESC_NORMAL == gc_typedesc_class(type) ?
+    1 : gc_header_array_len(obj);
+  char* const data = (char*)obj + sizeof(gc_header_t);
+  unsigned int offset = start > data ? start - data : 0;
+  const unsigned int limit = min(size * len, (unsigned int)(end - data));
+  gc_log_entry_t entry;
+
+  entry[0] = obj;
+
+  if(0 != size) {
+
+    /* Start on a field boundary. */
+    if(offset % size >= nonptr_size)
+      offset -= ((offset % size) - nonptr_size) % sizeof(gc_double_ptr_t);
+
+    else
+      offset &= ~(sizeof(unsigned int) - 1);
+
+    while(offset < limit) {
+
+      entry[1] = (void*)offset;
+      gc_thread_process_write_entry(closure, entry, max_gen, do_weak);
+      offset += offset % size < nonptr_size ?
+	sizeof(unsigned int) : sizeof(gc_double_ptr_t);
+
+    }
+
+  }
+
+}
+
+
+/* Find the last object starting in a card, or NULL if there isn't
+ * one.
+ */
+static inline void* gc_thread_card_last_obj(gc_card_table_t* const table,
+					    const unsigned int card) {
+
+  const unsigned int bits = table->ct_starts[card];
+
+  return 0 != bits ? (char*)table->ct_slice->s_ptr + (card << GC_CARD_SHIFT) +
+    (bitscan_high(bits) * CACHE_LINE_SIZE) : NULL;
+
+}
+
+
+/* Find the last object starting before a card, or NULL if there
+ * isn't one which could run into the card.  A large object slice
+ * holds one object, right after the card table.  Anything else is
+ * smaller than a large object, so only that many cards need to be
+ * looked at.
+ */
+static inline void* gc_thread_card_prev_obj(gc_card_table_t* const table,
+					    const unsigned int card) {
+
+  char* const base = table->ct_slice->s_ptr;
+  const unsigned int span = GC_LARGE_OBJECT_SIZE >> GC_CARD_SHIFT;
+  const unsigned int first = card > span ? card - span : 0;
+  void* out = NULL;
+
+  if(table->ct_large) {
+
+    char* const obj = base + gc_card_table_size(table->ct_slice->s_size);
+
+    out = obj < base + (card << GC_CARD_SHIFT) ? obj : NULL;
+
+  }
+
+  else
+    for(unsigned int i = card; NULL == out && first != i--;)
+      out = gc_thread_card_last_obj(table, i);
+
+  return out;
+
+}
+
+
+static inline void gc_thread_scan_card(gc_closure_t* const restrict closure,
+				       gc_card_table_t* const table,
+				       const unsigned int card,
+				       void* const prev,
+				       const unsigned char max_gen,
+				       const bool do_weak) {
+
+  char* const start = (char*)table->ct_slice->s_ptr + (card << GC_CARD_SHIFT);
+  char* const end = start + GC_CARD_SIZE;
+  const unsigned int bits = table->ct_starts[card];
+
+  /* Clean the card first, so that writes made while it is being
+   * scanned dirty it again.
+   */
+  table->ct_cards[card] = GC_CARD_CLEAN;
+  mem_fence();
+
+  /* The object before the card may run into it. */
+  if(NULL != prev)
+    gc_thread_scan_card_obj(closure, prev, start, end, max_gen, do_weak);
+
+  for(unsigned int i = 0; i < GC_CARD_SIZE / CACHE_LINE_SIZE; i++)
+    if(bits & (1 << i))
+      gc_thread_scan_card_obj(closure, start + (i * CACHE_LINE_SIZE),
+			      start, end, max_gen, do_weak);
+
+}
+
+
+/* Claim and scan one range of cards, return true if one actually got
+ * processed, false otherwise.
+ */
+static inline bool gc_thread_claim_cards(gc_closure_t* const restrict closure,
+					 const unsigned char max_gen,
+					 const bool do_weak) {
+
+  const unsigned int pass = gc_thread_scan_pass;
+  const unsigned int count = gc_card_table_count();
+  unsigned int first;
+  bool out = false;
+
+  if(GC_CARD_MARKING_ON == mm_card_marking)
+    for(unsigned int i = 0; !out && i < count; i++) {
+
+      gc_card_table_t* const table = gc_card_table_get(i);
+
+      if(NULL != table && gc_card_claim(table, pass, &first)) {
+
+	const unsigned int last =
+	  min(first + GC_CARD_CLUSTER_SIZE, table->ct_num_cards);
+	void* prev = gc_thread_card_prev_obj(table, first);
+
+	/* Only look at cards in the remembered sets of what is being
+	 * collected.  The object running into each card is carried
+	 * along from the one before.
+	 */
+	for(unsigned int j = first; j < last; j++) {
+
+	  const unsigned char card = table->ct_cards[j];
+	  void* const obj = gc_thread_card_last_obj(table, j);
+
+	  if(GC_CARD_CLEAN != card && GC_CARD_REMEMBERED(max_gen) >= card)
+	    gc_thread_scan_card(closure, table, j, prev, max_gen, do_weak);
+
+	  if(NULL != obj)
+	    prev = obj;
+
+	}
+
+	out = true;
+
+      }
+
+    }
+
+  return out;
+
+}
+
+
+/* Scan the cards which were dirtied again after their last claim, and
+ * finish off anything this turns up.  This is only called from the
+ * final barrier's sequential code, when no program is running, so any
+ * card still dirty holds a write which no collector has replayed.
+ */
+static inline void gc_thread_rescan_cards(gc_closure_t* const
+					  restrict closure,
+					  const unsigned char max_gen) {
+
+  const unsigned int count = gc_card_table_count();
+  volatile void* gray;
+
+  for(unsigned int i = 0; i < count; i++) {
+
+    gc_card_table_t* const table = gc_card_table_get(i);
+
+    if(NULL != table) {
+
+      void* prev = NULL;
+
+      for(unsigned int j = 0; j < table->ct_num_cards; j++) {
 
-  /* The hash table aspect is only used to spot duplicates.  At this
-   * point, the unique list is the only thing that matters.
-   */
-  curr = closure->gth_unique_list;
+	void* const obj = gc_thread_card_last_obj(table, j);
 
-  while(NULL != curr) {
+	if(GC_CARD_DIRTY == table->ct_cards[j])
+	  gc_thread_scan_card(closure, table, j,
+			      NULL != prev ? prev :
+			      gc_thread_card_prev_obj(table, j),
+			      max_gen, true);
 
-    /* Calculate the index from the address, and clear that slot in
-     * the hash table.
-     */
-    const unsigned int index = gc_thread_hash_table_index(curr);
+	if(NULL != obj)
+	  prev = obj;
+
+      }
 
-    closure->gth_hash_table[index] = NULL;
-    gc_thread_process_write_entry(closure, curr->wh_log_entry, max_gen, do_weak);
-    curr = curr->wh_list_next;
+    }
 
   }
 
-  closure->gth_unique_list = NULL;
+  while(NULL != (gray = gc_thread_next_prefetched(closure)))
+    gc_thread_process(closure, gray, max_gen, true);
 
 }
 
@@ -1755,86 +2785,6 @@ static inline unsigned int gc_thread_get_gen(void) {
 }
 
 
-/* Attempt the start barrier.  All collector threads will enter and
- * halt at this barrier until the collector has been turned on.  Once
- * the collector is turned on, this will act as a normal barrier
- * requiring all executors to acknowledge that the collector is now
- * on.
- */
-static void gc_thread_initial_barrier(void) {
-
-  if(os_thread_barrier_enter(&gc_thread_initial_barrier_value)) {
-
-    /* Start barrier sequential code: Turn the collector on. */
-    const unsigned int old_state = gc_state.value;
-    const unsigned int gen = gc_thread_get_gen();
-    const unsigned int new_state =
-      (old_state & ~(GC_STATE_PHASE | GC_STATE_GEN)) | GC_STATE_NORMAL | gen;
-
-    gc_state.value = new_state;
-    os_thread_barrier_release(&gc_thread_initial_barrier_value);
-
-  }
-
-}
-
-
-static inline void gc_thread_middle_barrier(void) {
-
-  if(os_thread_barrier_enter(&gc_thread_middle_barrier_value)) {
-
-    /* Middle barrier sequential code: switch to weak pointer
-     * preservation mode.
-     */
-    const unsigned int old_state = gc_state.value;
-    const unsigned int new_state =
-      (old_state & ~GC_STATE_PHASE) | GC_STATE_WEAK;
-
-    gc_state.value = new_state;
-    os_thread_barrier_release(&gc_thread_middle_barrier_value);
-
-  }
-
-}
-
-
-/* Attempt the final barrier, possibly having to abort and clear more
- * derived values.  If this succeeds, the collector will be disabled,
- * and execution status will return to normal.  Again, the entire root
- * set must have been touched prior to calling this, and a
- * GC_STATE_CHANGE signal must have been sent via executor mailboxes.
- */
-static inline void gc_thread_final_barrier(gc_closure_t* const restrict closure,
-					   volatile gc_allocator_t*
-					   const allocators) {
-
-  if(os_thread_barrier_enter(&gc_thread_final_barrier_value)) {
-
-    /* Middle barrier sequential code: turn off the collector and free
-     * all the memory.
-     */
-    const unsigned int old_state = gc_state.value;
-    const unsigned int gen = old_state & GC_STATE_GEN;
-    const unsigned int new_state =
-      (old_state & ~(GC_STATE_PHASE | GC_STATE_GEN)) | GC_STATE_INACTIVE;
-
-    gc_thread_peak_gen = gen;
-    gc_collection_count++;
-    gc_state.value = new_state;
-    gc_allocator_release_slices(gen);
-    os_thread_barrier_release(&gc_thread_final_barrier_value);
-
-  }
- 
-  /* Allocator 0 is uncollected space, so skip it, but copy all the
-   * other allocators over to the executor's space.
-   */
-  memcpy(allocators + 1, closure->gth_allocators + 1,
-	 gc_num_generations * sizeof(gc_allocator_t));
-
-}
-
-
 /* Remember for both of these functions that cc_safepoint expects that
  * state will have already been saved into the mailbox, so by simply
  * failing to save it, we correctly do the safepoint_without_save
@@ -1868,19 +2818,27 @@ static inline void gc_safepoint(gc_closure_t* const restrict closure,
 }
 
 
-static inline bool gc_thread_push(gc_closure_t* const restrict closure,
-				  const unsigned int exec) {
+/* Acknowledge the current epoch, if this executor hasn't already,
+ * and if the state is still in the phase the epoch ends.  Returns true
+ * if this executor was the last, and must perform the phase change.
+ *
+ * The phase change is stored before the epoch is advanced, so reading
+ * the epoch first means a stale epoch is always caught by the phase
+ * having moved on.
+ */
+static inline bool gc_thread_acknowledge(gc_closure_t* const restrict closure,
+					 const unsigned int epoch,
+					 const unsigned int phase) {
 
-  void* const obj = gc_thread_dequeue(closure);
-  bool out;
+  bool out = false;
 
-  if(out = lf_object_queue_enqueue(gc_workshare, obj, exec))
-    PRINTD("Executor %d successfully enqueued\n", exec);
+  load_fence();
 
-  else {
+  if(closure->gth_epoch != epoch &&
+     phase == (gc_state.value & GC_STATE_PHASE)) {
 
-    PRINTD("Executor %d failed to enqueue\n", exec);
-    gc_thread_enqueue(closure, obj);
+    closure->gth_epoch = epoch;
+    out = gc_thread_count == atomic_fetch_inc_uint(&gc_thread_epoch_acks);
 
   }
 
@@ -1889,99 +2847,169 @@ static inline bool gc_thread_push(gc_closure_t* const restrict closure,
 }
 
 
-static inline bool gc_thread_pull(gc_closure_t* const restrict closure,
-				  const unsigned int exec) {
-
-  void* const obj = lf_object_queue_dequeue(gc_workshare, exec);
-  bool out;
+static inline void gc_thread_advance_epoch(const unsigned int epoch) {
 
-  if(bool = (NULL != obj)) {
+  PRINTD("Advancing GC epoch from %u\n", epoch);
+  gc_thread_epoch_acks.value = 0;
+  store_fence();
+  gc_thread_epoch.value = epoch + 1;
 
-    PRINTD("Executor %d successfully dequeued\n", exec);
-    gc_thread_enqueue(closure, obj);
+}
 
-  }
 
-  else
-    PRINTD("Executor %d failed to dequeue\n", exec);
+/* Wait for the epoch to advance.  This does not go through a
+ * safepoint, so the executor can't switch back to the program while
+ * the sequential code runs.  That code moves the slice stacks around
+ * and frees the old heap, so nothing may allocate or write until it
+ * is done.  The executors which haven't acknowledged yet are still
+ * running the program, and get here at their own next safepoint.
+ */
+static inline void gc_thread_wait_epoch(const unsigned int epoch) {
 
-  return out;
+  for(unsigned int i = 1; epoch == gc_thread_epoch.value; i++)
+    backoff_delay(i);
 
 }
 
 
-static inline void gc_thread_balance(gc_closure_t* const restrict closure,
-				     const unsigned int exec) {
-
-  const unsigned int local = closure->gth_queue_size;
-  const int count = closure->gth_workshare_count;
-  const int intent = count + (moderator - local);
+/* Attempt the start barrier.  All collector threads wait at this
+ * barrier until the collector has been turned on.  Once the collector
+ * is turned on, this acts as a normal barrier requiring all executors
+ * to acknowledge that the collector is now on.
+ */
+static void gc_thread_initial_barrier(gc_closure_t* const restrict closure,
+				      volatile gc_allocator_t*
+				      const allocators,
+				      const unsigned int exec) {
 
-  PRINTD("Executor %u balancing.  Count is %d, size is %u\n",
-	 exec, count, local);
+  const unsigned int epoch = gc_thread_epoch.value;
 
-  if(0 < intent) {
+  /* Collectors scan the cards of every slice, so anything left over
+   * from the last collection must be released before this one starts.
+   */
+  while(0 != gc_allocator_release_deferred(GC_RELEASE_BATCH))
+    gc_safepoint(closure, allocators, exec);
 
-    PRINTD("Executor %u intends to push\n", exec);
+  if(gc_thread_acknowledge(closure, epoch, GC_STATE_INITIAL)) {
 
-    if(0 < count) {
+    /* Start barrier sequential code: Turn the collector on. */
+    const unsigned int old_state = gc_state.value;
+    const unsigned int gen = gc_thread_get_gen();
+    const unsigned int new_state =
+      (old_state & ~(GC_STATE_PHASE | GC_STATE_GEN)) | GC_STATE_NORMAL | gen;
 
-      if(gc_thread_push(closure, exec)) {
+    gc_thread_scan_pass++;
+    gc_state.value = new_state;
+    gc_thread_advance_epoch(epoch);
 
-	PRINTD("Executor %u push succeeded\n", exec);
-	closure->gth_workshare_count--;
+  }
 
-      }
+  gc_thread_wait_epoch(epoch);
 
-      else {
+}
 
-	PRINTD("Executor %u push failed\n", exec);
-	closure->gth_workshare_count = -moderator;
 
-      }
+static inline void gc_thread_middle_barrier(gc_closure_t* const
+					    restrict closure) {
 
-    }
+  const unsigned int epoch = gc_thread_epoch.value;
 
-    else {
+  if(gc_thread_acknowledge(closure, epoch, GC_STATE_NORMAL)) {
 
-      PRINTD("Executor %u deferring push\n", exec);
-      closure->gth_workshare_count--;
+    /* Middle barrier sequential code: switch to weak pointer
+     * preservation mode.
+     */
+    const unsigned int old_state = gc_state.value;
+    const unsigned int new_state =
+      (old_state & ~GC_STATE_PHASE) | GC_STATE_WEAK;
 
-    }
+    gc_thread_scan_pass++;
+    gc_state.value = new_state;
+    gc_thread_advance_epoch(epoch);
 
   }
 
-  else {
+  gc_thread_wait_epoch(epoch);
+
+}
 
-    PRINTD("Executor %u intends to pull\n", exec);
 
-    if(0 > count) {
+/* Attempt the final barrier, possibly having to abort and clear more
+ * derived values.  If this succeeds, the collector will be disabled,
+ * and execution status will return to normal.  Again, the entire root
+ * set must have been touched prior to calling this, and a
+ * GC_STATE_CHANGE signal must have been sent via executor mailboxes.
+ */
+static inline void gc_thread_final_barrier(gc_closure_t* const restrict closure,
+					   volatile gc_allocator_t*
+					   const allocators,
+					   const unsigned int exec) {
 
-      if(gc_thread_push(closure, exec)) {
+  const unsigned int epoch = gc_thread_epoch.value;
 
-	PRINTD("Executor %u pull succeeded\n", exec);
-	closure->gth_workshare_count++;
+  /* The executor releasing slices needs exact space counters */
+  gc_allocator_fold_deltas();
 
-      }
+  thread_t* dead = NULL;
 
-      else {
+  if(gc_thread_acknowledge(closure, epoch, GC_STATE_WEAK)) {
 
-	PRINTD("Executor %u pull failed\n", exec);
-	closure->gth_workshare_count = moderator;
+    /* Final barrier sequential code: turn off the collector and free
+     * all the memory.
+     */
+    const unsigned int old_state = gc_state.value;
+    const unsigned int gen = old_state & GC_STATE_GEN;
+    const unsigned int new_state =
+      (old_state & ~(GC_STATE_PHASE | GC_STATE_GEN)) | GC_STATE_INACTIVE;
 
-      }
+    /* Stores into cards which had already been scanned aren't in any
+     * write log.  Copying anything they reach changes this executor's
+     * space counters again, so fold those in as well.
+     */
+    if(GC_CARD_MARKING_ON == mm_card_marking) {
+
+      gc_thread_rescan_cards(closure, gc_thread_last_gen);
+      gc_allocator_fold_deltas();
 
     }
 
-    else {
+    gc_thread_peak_gen = gen;
 
-      PRINTD("Executor %u deferring pull\n", exec);
-      closure->gth_workshare_count++;
+    for(unsigned int i = 0; i <= gc_num_generations; i++)
+      gc_thread_gen_parity[i] = gc_thread_next_flipflop(i, gc_thread_last_gen);
 
-    }
+    gc_collection_count++;
+    gc_state.value = new_state;
+    gc_allocator_release_slices(gen);
+    dead = gc_thread_dead_list.value;
+    gc_thread_dead_list.value = NULL;
+    gc_thread_advance_epoch(epoch);
+
+  }
+
+  gc_thread_wait_epoch(epoch);
+  closure->gth_write_log_fills = 0;
+  gc_allocator_release_deferred(GC_RELEASE_BATCH);
+
+  /* No collector looks at threads any more, so the ones which died
+   * during the collection can go.  The next collection can't start
+   * scanning stacks until this executor passes its initial barrier.
+   */
+  while(NULL != dead) {
+
+    thread_t* const next = dead->t_gc_dead_next;
+
+    thread_destroy(dead);
+    dead = next;
 
   }
 
+  /* Allocator 0 is uncollected space, so skip it, but copy all the
+   * other allocators over to the executor's space.
+   */
+  memcpy(allocators + 1, closure->gth_allocators + 1,
+	 gc_num_generations * sizeof(gc_allocator_t));
+
 }
 
 
@@ -2024,8 +3052,9 @@ static void gc_thread(gc_closure_t* const restrict closure,
     /* Remember, gc_thread_last_gen will hold the current generation
      * at this point, if I get here.
      */
-    gc_thread_clear_write_log(closure, gc_thread_last_gen, write_log_index,
-			      GC_STATE_WEAK == state);
+    gc_thread_clear_write_log(closure, write_log_index, gc_thread_last_gen,
+			      GC_STATE_WEAK == (state & GC_STATE_PHASE));
+    gc_thread_count_write_log(closure, write_log_index);
     *write_log_index_ptr = 0;
 
   }
@@ -2043,7 +3072,7 @@ static void gc_thread(gc_closure_t* const restrict closure,
      * otherwise go for the barrier.
      */
     if(GC_STATE_INITIAL == state & GC_STATE_PHASE)
-      gc_thread_initial_barrier();
+      gc_thread_initial_barrier(closure, allocators, exec);
 
     /* Once the initial barrier is passed, gc_thread_last_gen holds
      * the current generation, paradoxically enough
@@ -2055,27 +3084,34 @@ static void gc_thread(gc_closure_t* const restrict closure,
     /* In the normal state, try to copy the memory graph */
     if(GC_STATE_NORMAL == state & GC_STATE_PHASE) {
 
-      /* XXX need to scan all threads as well */
+      /* Threads have all entered the runtime and saved their frames
+       * by the time the initial barrier is passed.  Any resumed since
+       * then have been scanned by their executors.
+       */
       for(unsigned int i = 1;
-	  gc_thread_claim_cluster(closure, gc_thread_last_gen, false) ||
-	    gc_thread_claim_globals(closure, gc_thread_last_gen, false);)
-	while(NULL != closure->gth_head) {
+	  gc_thread_has_local(closure) ||
+	    gc_thread_claim_cluster(closure, gc_thread_last_gen, false) ||
+	    gc_thread_claim_globals(closure, gc_thread_last_gen, false) ||
+	    gc_thread_claim_stacks(closure, gc_thread_last_gen, false) ||
+	    gc_thread_claim_cards(closure, gc_thread_last_gen, false) ||
+	    gc_thread_claim_stack_rest(closure, gc_thread_last_gen, false) ||
+	    gc_thread_steal(closure, exec);) {
+
+	volatile void* obj;
 
-	  volatile void* const obj = gc_thread_dequeue(closure);
+	while(NULL != (obj = gc_thread_next_prefetched(closure))) {
 
 	  gc_thread_process(closure, obj, gc_thread_last_gen, false);
 	  i = (i + 1) % 16;
 
-	  if(0 == i) {
-
-	    gc_thread_balance(closure);
+	  if(0 == i)
 	    gc_safepoint(closure, allocators, exec);
 
-	  }
-
 	}
 
-      gc_thread_middle_barrier();
+      }
+
+      gc_thread_middle_barrier(closure);
 
     }
 
@@ -2085,25 +3121,29 @@ static void gc_thread(gc_closure_t* const restrict closure,
     INVARIANT(gc_state.value & GC_STATE_PHASE == GC_STATE_WEAK);
 
     for(unsigned int i = 1;
-	gc_thread_claim_cluster(closure, gc_thread_last_gen, true) ||
-	  gc_thread_claim_globals(closure, gc_thread_last_gen, true);)
-      while(NULL != closure->gth_head) {
+	gc_thread_has_local(closure) ||
+	  gc_thread_claim_cluster(closure, gc_thread_last_gen, true) ||
+	  gc_thread_claim_globals(closure, gc_thread_last_gen, true) ||
+	  gc_thread_claim_stacks(closure, gc_thread_last_gen, true) ||
+	  gc_thread_claim_cards(closure, gc_thread_last_gen, true) ||
+	  gc_thread_claim_stack_rest(closure, gc_thread_last_gen, true) ||
+	  gc_thread_steal(closure, exec);) {
+
+      volatile void* obj;
 
-	volatile void* const obj = gc_thread_dequeue(closure);
+      while(NULL != (obj = gc_thread_next_prefetched(closure))) {
 
 	gc_thread_process(closure, obj, gc_thread_last_gen, true);
 	i = (i + 1) % 16;
 
-	if(0 == i) {
-
-	  gc_thread_balance(closure);
+	if(0 == i)
 	  gc_safepoint(closure, allocators, exec);
 
-	}
-
       }
 
-    gc_thread_final_barrier(closure, allocators);
+    }
+
+    gc_thread_final_barrier(closure, allocators, exec);
 
     /* Yield the processor if another GC cycle beginning hasn't intervened */
     if(GC_STATE_INACTIVE == gc_state.value) {
@@ -2116,3 +3156,212 @@ static void gc_thread(gc_closure_t* const restrict closure,
   }
 
 }
+
+
+/* This is called by the trampoline when a thread returns into a
+ * frame that hasn't been scanned yet.  It runs on the thread's own
+ * stack, scans the next few frames itself (unless a collector is
+ * already doing it), and gives back the real return address.
+ */
+const void* gc_stack_barrier(void) {
+
+  const unsigned int exec = executor_self();
+  thread_t* const thread = executor_curr_thread(exec);
+  gc_closure_t* const closure = executor_gc_closure(exec);
+  volatile gc_allocator_t* const allocators =
+    *thread_mbox_allocators(thread->t_mbox);
+  const void* out;
+
+  PRINTD("Thread %p hit its stack barrier\n", thread);
+
+  for(unsigned int i = 1;; i++) {
+
+    const unsigned int state = thread->t_gc_barrier.value;
+
+    if(GC_BARRIER_NONE == state) {
+
+      out = thread->t_gc_barrier_retaddr;
+      thread->t_gc_barrier_slot = NULL;
+      break;
+
+    }
+
+    else if(GC_BARRIER_ARMED == state &&
+	    atomic_compare_and_set_uint(GC_BARRIER_ARMED, GC_BARRIER_BUSY,
+					&(thread->t_gc_barrier))) {
+
+      char* const frame = thread->t_gc_barrier_frame;
+      const bool do_weak =
+	GC_STATE_WEAK == (gc_state.value & GC_STATE_PHASE);
+
+      /* Scanning may move the barrier further down, so take
+       * everything needed out of the thread first.
+       */
+      out = thread->t_gc_barrier_retaddr;
+      thread->t_gc_barrier_slot = NULL;
+      memcpy(closure->gth_allocators, allocators, sizeof(gc_allocator_t));
+      gc_thread_scan_frames(closure, thread, frame, out,
+			    GC_STACK_BARRIER_DEPTH, gc_thread_last_gen,
+			    do_weak);
+      memcpy(allocators, closure->gth_allocators, sizeof(gc_allocator_t));
+      break;
+
+    }
+
+    else
+      backoff_delay(i);
+
+  }
+
+  return out;
+
+}
+
+
+/* Running threads are never scanned by collectors.  Instead, an
+ * executor resuming a thread during a collection scans the top of its
+ * stack first, unless a collector got there first.
+ */
+internal void gc_thread_resume(thread_t* const restrict thread,
+			       volatile gc_allocator_t* const allocators,
+			       const unsigned int exec) {
+
+  const unsigned int phase = gc_state.value & GC_STATE_PHASE;
+  const unsigned int pass = gc_thread_scan_pass;
+
+  if(GC_STATE_NORMAL == phase || GC_STATE_WEAK == phase) {
+
+    if(gc_thread_claim_top(thread, pass)) {
+
+      gc_closure_t* const closure = executor_gc_closure(exec);
+
+      PRINTD("Executor %u scanning thread %p before resuming it\n",
+	     exec, thread);
+      memcpy(closure->gth_allocators, allocators, sizeof(gc_allocator_t));
+      gc_thread_scan_stack(closure, thread, gc_thread_last_gen,
+			   GC_STATE_WEAK == phase);
+      memcpy(allocators, closure->gth_allocators, sizeof(gc_allocator_t));
+      gc_thread_finish_top(thread, pass);
+
+    }
+
+    /* A collector may be scanning it; wait until it's done. */
+    else
+      for(unsigned int i = 1; GC_SCAN_BUSY(pass) == thread->t_gc_scan.value;
+	  i++)
+	backoff_delay(i);
+
+  }
+
+}
+
+
+static inline bool gc_thread_try_push_dead(thread_t* const restrict thread) {
+
+  thread_t* const top = gc_thread_dead_list.value;
+
+  thread->t_gc_dead_next = top;
+
+  return atomic_compare_and_set_ptr(top, thread, &gc_thread_dead_list);
+
+}
+
+
+/* Collectors only look at threads after the initial barrier, which
+ * the destroying executor can't have passed yet if the collector is
+ * still in the initial phase.
+ */
+internal bool gc_thread_keep_dead(thread_t* const restrict thread) {
+
+  const unsigned int phase = gc_state.value & GC_STATE_PHASE;
+  const bool out = GC_STATE_NORMAL == phase || GC_STATE_WEAK == phase;
+
+  if(out) {
+
+    PRINTD("Keeping dead thread %p until the collection is done\n",
+	   thread);
+
+    for(unsigned int i = 1; !gc_thread_try_push_dead(thread); i++)
+      backoff_delay(i);
+
+  }
+
+  return out;
+
+}
+
+
+/* Approximate the work of processing an object by its size. */
+static inline unsigned int gc_thread_obj_work(volatile void* const obj) {
+
+  const unsigned int* const type = gc_header_type(obj);
+  const unsigned int nonptr_size = gc_typedesc_nonptr_size(type);
+  const unsigned int normptrs = gc_typedesc_normal_ptrs(type);
+  const unsigned int weakptrs = gc_typedesc_weak_ptrs(type);
+  const unsigned int size = gc_thread_obj_size(nonptr_size, normptrs, weakptrs);
+
+  return GC_TYPEDESC_NORMAL == gc_typedesc_class(type) ?
+    size : size * gc_header_array_len((void*)obj);
+
+}
+
+
+/* Assists run on the executor's own closure, like the stack barrier.
+ * The collector on the same executor can't be running at the same
+ * time, so its deque can be used as-is.  Anything left in the deque
+ * is picked up by the collector, but only if it hasn't already
+ * acknowledged the end of the phase, so don't assist if it has.
+ */
+internal void gc_thread_assist(const unsigned int work) {
+
+  const unsigned int exec = executor_self();
+  thread_t* const thread = executor_curr_thread(exec);
+  gc_closure_t* const closure = executor_gc_closure(exec);
+  volatile gc_allocator_t* const allocators =
+    *thread_mbox_allocators(thread->t_mbox);
+  const unsigned int epoch = gc_thread_epoch.value;
+  unsigned int phase;
+  bool do_weak;
+  unsigned int done = 0;
+  volatile void* rest;
+
+  /* As with acknowledging, read the epoch before the phase. */
+  load_fence();
+  phase = gc_state.value & GC_STATE_PHASE;
+  do_weak = GC_STATE_WEAK == phase;
+
+  if((GC_STATE_NORMAL == phase || GC_STATE_WEAK == phase) &&
+     closure->gth_epoch != epoch) {
+
+    PRINTD("Thread %p assisting the collector with 0x%x bytes\n",
+	   thread, work);
+    memcpy(closure->gth_allocators, allocators, sizeof(gc_allocator_t));
+
+    while(done < work &&
+	  (gc_thread_claim_cluster(closure, gc_thread_last_gen, do_weak) ||
+	   gc_thread_steal(closure, exec))) {
+
+      volatile void* obj;
+
+      while(done < work &&
+	    NULL != (obj = gc_thread_next_prefetched(closure))) {
+
+	done += gc_thread_obj_work(obj) + sizeof(gc_header_t);
+	gc_thread_process(closure, obj, gc_thread_last_gen, do_weak);
+
+      }
+
+    }
+
+    /* Nobody else can get at the blocks left in the prefetch ring, so
+     * finish them off rather than leave them until this executor's
+     * collector runs again.
+     */
+    while(NULL != (rest = gc_thread_take_prefetched(closure)))
+      gc_thread_process(closure, rest, gc_thread_last_gen, do_weak);
+
+    memcpy(allocators, closure->gth_allocators, sizeof(gc_allocator_t));
+
+  }
+
+}
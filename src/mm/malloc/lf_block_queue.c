@@ -52,7 +52,8 @@ static inline malloc_node_opt_t lf_block_queue_try_alloc_node(void) {
 
     /* XXX do a two-level slice allocation */
     slice_t* const slice = slice_alloc(SLICE_TYPE_MALLOC,
-				      SLICE_PROT_RWX, 0x10000);
+				      SLICE_PROT_RWX, 0x10000,
+				      SLICE_EXEC_NONE);
 
     if(slice != NULL) {
 
@@ -70,7 +71,7 @@ static inline malloc_node_opt_t lf_block_queue_try_alloc_node(void) {
 	out.o_block = ptr;
 
       else
-	slice_free(slice);
+	slice_free(slice, SLICE_EXEC_NONE);
 
     }
 
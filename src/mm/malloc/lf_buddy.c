@@ -0,0 +1,239 @@
+/* Copyright (c) 2008 Eric McCorkle.  All rights reserved. */
+
+#include <stdbool.h>
+
+#include "definitions.h"
+#include "atomic.h"
+#include "bitops.h"
+#include "mm/slice.h"
+#include "mm/lf_buddy.h"
+
+/* Lock-free buddy allocator for large malloc blocks.  Each arena is a
+ * single large slice, with a complete binary tree of blocks.  A block
+ * is claimed by setting LF_BUDDY_OCC on its node (which must be zero,
+ * meaning neither it nor any descendant is in use), then incrementing
+ * the descendant count of each of its ancestors.  If any ancestor
+ * turns out to be claimed as a whole, the claim is rolled back.
+ * Freeing a block clears its node and decrements the ancestors, so
+ * free buddies coalesce simply by their parent's count dropping back
+ * to zero.
+ */
+
+#define LF_BUDDY_OCC 0x80000000
+
+static volatile atomic_ptr_t lf_buddy_arenas;
+
+
+internal pure unsigned int lf_buddy_node_size(const unsigned int node) {
+
+  INVARIANT(node != 0 && node < (1 << LF_BUDDY_LEVELS));
+
+  return LF_BUDDY_ARENA_SIZE >> bitscan_high(node);
+
+}
+
+
+static inline void* lf_buddy_node_addr(lf_buddy_arena_t* const arena,
+				       const unsigned int node) {
+
+  const unsigned int depth = bitscan_high(node);
+  const unsigned int index = node - (1 << depth);
+
+  return (char*)arena + (index << (LF_BUDDY_ARENA_SHIFT - depth));
+
+}
+
+
+/* Drop the descendant counts of all ancestors of node, up to but not
+ * including stop.
+ */
+static inline void lf_buddy_release_ancestors(lf_buddy_arena_t* const arena,
+					      const unsigned int node,
+					      const unsigned int stop) {
+
+  for(unsigned int i = node >> 1; i != stop; i >>= 1)
+    atomic_decrement_uint(arena->ba_tree + i);
+
+}
+
+
+static inline bool lf_buddy_try_claim(lf_buddy_arena_t* const arena,
+				      const unsigned int node) {
+
+  bool out = false;
+
+  if(atomic_compare_and_set_uint(0, LF_BUDDY_OCC, arena->ba_tree + node)) {
+
+    unsigned int i;
+
+    out = true;
+
+    for(i = node >> 1; 0 != i; i >>= 1) {
+
+      for(unsigned int j = 1;; j++) {
+
+	const unsigned int old = arena->ba_tree[i].value;
+
+	if(LF_BUDDY_OCC & old) {
+
+	  out = false;
+	  break;
+
+	}
+
+	else if(atomic_compare_and_set_uint(old, old + 1, arena->ba_tree + i))
+	  break;
+
+	else
+	  backoff_delay(j);
+
+      }
+
+      if(!out)
+	break;
+
+    }
+
+    if(!out) {
+
+      PRINTD("Ancestor %u of buddy node %u is claimed, rolling back\n",
+	     i, node);
+      lf_buddy_release_ancestors(arena, node, i);
+      arena->ba_tree[node].value = 0;
+      store_fence();
+
+    }
+
+  }
+
+  return out;
+
+}
+
+
+static inline void* lf_buddy_arena_alloc(lf_buddy_arena_t* const arena,
+					 const unsigned int depth,
+					 unsigned int* const node) {
+
+  const unsigned int first = 1 << depth;
+  const unsigned int last = first << 1;
+  void* out = NULL;
+
+  for(unsigned int i = first; i < last; i++)
+    if(0 == arena->ba_tree[i].value &&
+       0 == (LF_BUDDY_OCC & arena->ba_tree[i >> 1].value) &&
+       lf_buddy_try_claim(arena, i)) {
+
+      *node = i;
+      out = lf_buddy_node_addr(arena, i);
+      break;
+
+    }
+
+  return out;
+
+}
+
+
+static inline lf_buddy_arena_t* lf_buddy_arena_create(void) {
+
+  slice_t* const slice =
+    slice_alloc(SLICE_TYPE_MALLOC, SLICE_PROT_RWX, LF_BUDDY_ARENA_SIZE,
+		SLICE_EXEC_NONE);
+  lf_buddy_arena_t* out;
+
+  if(NULL != slice) {
+
+    const unsigned int header = 1 << (LF_BUDDY_LEVELS - 1);
+
+    PRINTD("Creating buddy arena in slice %p\n", slice);
+    out = slice->s_ptr;
+    out->ba_slice = slice;
+
+    for(unsigned int i = 0; i < (1 << LF_BUDDY_LEVELS); i++)
+      out->ba_tree[i].value = 0;
+
+    /* The first minimum-sized block holds the arena header. */
+    out->ba_tree[header].value = LF_BUDDY_OCC;
+
+    for(unsigned int i = header >> 1; 0 != i; i >>= 1)
+      out->ba_tree[i].value = 1;
+
+  }
+
+  else
+    out = NULL;
+
+  return out;
+
+}
+
+
+static inline bool lf_buddy_try_arena_push(lf_buddy_arena_t* const arena) {
+
+  lf_buddy_arena_t* const head = lf_buddy_arenas.value;
+
+  arena->ba_next = head;
+  store_fence();
+
+  return atomic_compare_and_set_ptr(head, arena, &lf_buddy_arenas);
+
+}
+
+
+internal void* lf_buddy_alloc(const unsigned int size,
+			      lf_buddy_arena_t** const arena,
+			      unsigned int* const node) {
+
+  INVARIANT(size != 0 && size <= LF_BUDDY_MAX_SIZE);
+
+  const unsigned int shift = size <= (1 << LF_BUDDY_MIN_SHIFT) ?
+    LF_BUDDY_MIN_SHIFT : bitscan_high(size - 1) + 1;
+  const unsigned int depth = LF_BUDDY_ARENA_SHIFT - shift;
+  void* out = NULL;
+
+  PRINTD("Allocating buddy block of size %u for request %u\n",
+	 1 << shift, size);
+
+  for(lf_buddy_arena_t* curr = lf_buddy_arenas.value;
+      NULL == out && NULL != curr; curr = curr->ba_next)
+    if(NULL != (out = lf_buddy_arena_alloc(curr, depth, node)))
+      *arena = curr;
+
+  if(NULL == out) {
+
+    lf_buddy_arena_t* const newarena = lf_buddy_arena_create();
+
+    if(NULL != newarena) {
+
+      /* Nobody else can see the arena yet, so this cannot fail. */
+      out = lf_buddy_arena_alloc(newarena, depth, node);
+      INVARIANT(out != NULL);
+      *arena = newarena;
+
+      for(unsigned int i = 1; !lf_buddy_try_arena_push(newarena); i++)
+	backoff_delay(i);
+
+    }
+
+  }
+
+  PRINTD("Buddy allocation returned %p\n", out);
+
+  return out;
+
+}
+
+
+internal void lf_buddy_free(lf_buddy_arena_t* const arena,
+			    const unsigned int node) {
+
+  INVARIANT(arena != NULL);
+  INVARIANT(LF_BUDDY_OCC == arena->ba_tree[node].value);
+
+  PRINTD("Freeing buddy node %u in arena %p\n", node, arena);
+  arena->ba_tree[node].value = 0;
+  store_fence();
+  lf_buddy_release_ancestors(arena, node, 0);
+
+}
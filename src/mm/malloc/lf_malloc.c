@@ -11,6 +11,8 @@
 #include "mm/slice.h"
 #include "mm/lf_malloc_data.h"
 #include "mm/lf_block_queue.h"
+#include "mm/lf_buddy.h"
+#include "mm/lf_region.h"
 #include "mm/mm_malloc.h"
 
 /* Scalable Lock-Free Dynamic Memory Allocation, by Maged D. Michael */
@@ -18,12 +20,14 @@
 typedef struct descriptor_t descriptor_t;
 typedef struct procheap_t procheap_t;
 typedef struct sizeclass_t sizeclass_t;
+typedef struct malloc_cache_t malloc_cache_t;
 
 struct descriptor_t {
 
   volatile atomic_uint64_t des_anchor;
   descriptor_t* des_next;
-  slice_t* des_slice;
+  void* des_sb;
+  lf_region_t* des_region;
   procheap_t* des_heap;
   unsigned int des_size;
   unsigned int des_maxcount;
@@ -34,7 +38,9 @@ struct procheap_t {
 
   volatile atomic_ptr_t ph_partial;
   volatile atomic_uint64_t ph_active;
+  volatile atomic_ptr_t ph_remote;
   sizeclass_t* ph_sizeclass;
+  unsigned int ph_exec;
 
 };
 
@@ -42,144 +48,112 @@ struct sizeclass_t {
 
   unsigned int sc_size;
   unsigned int sc_block_size;
+  unsigned int sc_maxcount;
   lf_block_queue_t* sc_partial;
+  volatile atomic_uint64_t sc_reserve;
+  volatile atomic_uint_t sc_reserve_count;
 
 };
 
-static const unsigned int ANC_ACTIVE = 0;
-static const unsigned int ANC_FULL = 1;
-static const unsigned int ANC_PARTIAL= 2;
-static const unsigned int ANC_EMPTY = 3;
-
-static inline unsigned int malloc_big_size_class(const unsigned int size,
-						 const unsigned int base) {
-
-  INVARIANT(size <= 0x4000);
-
-  const unsigned int size_div128 =
-    size >> 6;
-  unsigned int out = 0;
-
-  if(4 > size_div128)
-    out = base + size_div128;
-
-  else {
+/* Header written into an empty superblock while it sits in its size
+ * class's reserve.
+ */
+typedef struct reserve_sb_t reserve_sb_t;
 
-    const unsigned int size_div256 =
-      (size_div128 - 4) >> 1;
+struct reserve_sb_t {
 
-    if(4 > size_div256)
-      out = base + 4 + size_div256;
+  reserve_sb_t* rs_next;
+  lf_region_t* rs_region;
 
-    else {
-
-      const unsigned int size_div512 =
-	(size_div256 - 4) >> 1;
+};
 
-      if(4 > size_div512)
-	out = base + 8 + size_div512;
+/* Magazine of free blocks for one executor and one size class.  Only
+ * the owning executor ever touches this, so none of it is atomic.
+ */
+struct malloc_cache_t {
 
-      else {
+  unsigned int mc_count;
+  unsigned int mc_hits;
+  unsigned int mc_misses;
+  void* mc_blocks[MALLOC_CACHE_DEPTH];
 
-	const unsigned int size_div1024 =
-	  (size_div512 - 4) >> 1;
+};
 
-	if(4 > size_div1024)
-	  out = base + 12 + size_div1024;
+/* Small blocks have no prefix; their descriptor is the owner of the
+ * region unit holding them.  Large blocks have a prefix of
+ * CACHE_LINE_SIZE, and the low bits of its first word hold these
+ * tags.  Large blocks are either a whole slice, in which case the
+ * word points to the slice_t, or a buddy block, in which case it
+ * points to the arena and the second word holds the block's tree
+ * node.
+ */
+#define MALLOC_TAG_LARGE 0x1
+#define MALLOC_TAG_BUDDY 0x2
+#define MALLOC_TAG_MASK 0x3
 
-	else {
+/* The number of empty superblocks each size class keeps in reserve,
+ * rather than returning them to their regions.
+ */
+#define MALLOC_SB_RESERVE 4
 
-	  const unsigned int size_div2048 =
-	    (size_div1024 - 4) >> 1;
+/* The anchor's avail and count fields are 10 bits wide, which limits
+ * the number of blocks in a superblock.
+ */
+#define MALLOC_SB_MAX_BLOCKS 0x3ff
 
-	  if(4 > size_div2048)
-	    out = base + 16 + size_div2048;
+#define MALLOC_MIN_SIZE (1 << MALLOC_MIN_SHIFT)
+#define MALLOC_MAX_SMALL_SIZE (1 << MALLOC_MAX_SMALL_SHIFT)
 
-	  else {
+/* Sizes up to MALLOC_MIN_SIZE << MALLOC_SPLIT_SHIFT go up in steps of
+ * MALLOC_MIN_SIZE.  Past that, each doubling is split evenly into
+ * 1 << MALLOC_SPLIT_SHIFT classes.
+ */
+#define NUM_SIZE_CLASSES						\
+  ((1 << MALLOC_SPLIT_SHIFT) +						\
+   ((MALLOC_MAX_SMALL_SHIFT - (MALLOC_MIN_SHIFT + MALLOC_SPLIT_SHIFT)) <<	\
+    MALLOC_SPLIT_SHIFT))
 
-	    const unsigned int size_div4096 =
-	      (size_div2048 - 4) >> 1;
+#if (NUM_SIZE_CLASSES > 0x100)
+#error "Too many malloc size classes"
+#endif
 
-	    out = base + 20 + size_div4096;
+static const unsigned int ANC_ACTIVE = 0;
+static const unsigned int ANC_FULL = 1;
+static const unsigned int ANC_PARTIAL= 2;
+static const unsigned int ANC_EMPTY = 3;
 
-	  }
+static sizeclass_t malloc_sizeclasses[NUM_SIZE_CLASSES];
 
-	}
+/* Size class for each multiple of MALLOC_MIN_SIZE, rounding up. */
+static unsigned char
+malloc_size_lookup[(MALLOC_MAX_SMALL_SIZE >> MALLOC_MIN_SHIFT) + 1];
 
-      }
 
-    }
+static inline unsigned int malloc_size_class(const unsigned int size) {
 
-  }
+  INVARIANT(size != 0 && size <= MALLOC_MAX_SMALL_SIZE);
 
-  return out;
+  return malloc_size_lookup[(size + (MALLOC_MIN_SIZE - 1)) >>
+			    MALLOC_MIN_SHIFT];
 
 }
 
-#if (CACHE_LINE_SIZE <= 16)
-#define NUM_SIZE_CLASSES 36
-
-static sizeclass_t malloc_sizeclasses[NUM_SIZE_CLASSES] = {
-  { .sc_size = 0x10, .sc_block_size = 0x10000 },
-  { .sc_size = 0x20, .sc_block_size = 0x10000 },
-  { .sc_size = 0x30, .sc_block_size = 0x10000 },
-  { .sc_size = 0x40, .sc_block_size = 0x10000 },
-  { .sc_size = 0x50, .sc_block_size = 0x10000 },
-  { .sc_size = 0x60, .sc_block_size = 0x10000 },
-  { .sc_size = 0x70, .sc_block_size = 0x10000 },
-  { .sc_size = 0x80, .sc_block_size = 0x10000 },
-  { .sc_size = 0xa0, .sc_block_size = 0x10000 },
-  { .sc_size = 0xc0, .sc_block_size = 0x10000 },
-  { .sc_size = 0xe0, .sc_block_size = 0x10000 },
-  { .sc_size = 0x100, .sc_block_size = 0x10000 },
-  { .sc_size = 0x140, .sc_block_size = 0x10000 },
-  { .sc_size = 0x180, .sc_block_size = 0x10000 },
-  { .sc_size = 0x1c0, .sc_block_size = 0x10000 },
-  { .sc_size = 0x200, .sc_block_size = 0x10000 },
-  { .sc_size = 0x280, .sc_block_size = 0x10000 },
-  { .sc_size = 0x300, .sc_block_size = 0x10000 },
-  { .sc_size = 0x380, .sc_block_size = 0x10000 },
-  { .sc_size = 0x400, .sc_block_size = 0x10000 },
-  { .sc_size = 0x500, .sc_block_size = 0x10000 },
-  { .sc_size = 0x600, .sc_block_size = 0x10000 },
-  { .sc_size = 0x700, .sc_block_size = 0x10000 },
-  { .sc_size = 0x800, .sc_block_size = 0x10000 },
-  { .sc_size = 0xa00, .sc_block_size = 0x10000 },
-  { .sc_size = 0xc00, .sc_block_size = 0x10000 },
-  { .sc_size = 0xe00, .sc_block_size = 0x10000 },
-  { .sc_size = 0x1000, .sc_block_size = 0x10000 },
-  { .sc_size = 0x1400, .sc_block_size = 0x10000 },
-  { .sc_size = 0x1800, .sc_block_size = 0x10000 },
-  { .sc_size = 0x1c00, .sc_block_size = 0x10000 },
-  { .sc_size = 0x2000, .sc_block_size = 0x10000 },
-  { .sc_size = 0x2800, .sc_block_size = 0x10000 },
-  { .sc_size = 0x3000, .sc_block_size = 0x10000 },
-  { .sc_size = 0x3800, .sc_block_size = 0x10000 },
-  { .sc_size = 0x4000, .sc_block_size = 0x10000 }
-};
-
-
-static inline unsigned int malloc_size_class(const unsigned int size) {
 
-  INVARIANT(size <= 0x4000);
+static inline pure unsigned int malloc_class_size(const unsigned int class) {
 
-  const unsigned int size_div16 =
-    size >> 4;
-  unsigned int out = 0;
+  const unsigned int step = class & ((1 << MALLOC_SPLIT_SHIFT) - 1);
+  const unsigned int group = class >> MALLOC_SPLIT_SHIFT;
+  unsigned int out;
 
-  if(8 > size_div16)
-    out = size_div16;
+  if(0 == group)
+    out = (step + 1) << MALLOC_MIN_SHIFT;
 
   else {
 
-    const unsigned int size_div32 =
-      (size_div16 - 8) >> 1;
+    const unsigned int shift = MALLOC_MIN_SHIFT + MALLOC_SPLIT_SHIFT +
+      group - 1;
 
-    if(4 > size_div32)
-      out = 8 + size_div32;
-
-    else
-      out = malloc_big_size_class(size, 12);
+    out = (1 << shift) + ((step + 1) << (shift - MALLOC_SPLIT_SHIFT));
 
   }
 
@@ -188,120 +162,49 @@ static inline unsigned int malloc_size_class(const unsigned int size) {
 }
 
 
-#elif (CACHE_LINE_SIZE <= 32)
-#define NUM_SIZE_CLASSES 32
-
-static sizeclass_t malloc_sizeclasses[NUM_SIZE_CLASSES] = {
-  { .sc_size = 0x20, .sc_block_size = 0x10000 },
-  { .sc_size = 0x40, .sc_block_size = 0x10000 },
-  { .sc_size = 0x60, .sc_block_size = 0x10000 },
-  { .sc_size = 0x80, .sc_block_size = 0x10000 },
-  { .sc_size = 0xa0, .sc_block_size = 0x10000 },
-  { .sc_size = 0xc0, .sc_block_size = 0x10000 },
-  { .sc_size = 0xe0, .sc_block_size = 0x10000 },
-  { .sc_size = 0x100, .sc_block_size = 0x10000 },
-  { .sc_size = 0x140, .sc_block_size = 0x10000 },
-  { .sc_size = 0x180, .sc_block_size = 0x10000 },
-  { .sc_size = 0x1c0, .sc_block_size = 0x10000 },
-  { .sc_size = 0x200, .sc_block_size = 0x10000 },
-  { .sc_size = 0x280, .sc_block_size = 0x10000 },
-  { .sc_size = 0x300, .sc_block_size = 0x10000 },
-  { .sc_size = 0x380, .sc_block_size = 0x10000 },
-  { .sc_size = 0x400, .sc_block_size = 0x10000 },
-  { .sc_size = 0x500, .sc_block_size = 0x10000 },
-  { .sc_size = 0x600, .sc_block_size = 0x10000 },
-  { .sc_size = 0x700, .sc_block_size = 0x10000 },
-  { .sc_size = 0x800, .sc_block_size = 0x10000 },
-  { .sc_size = 0xa00, .sc_block_size = 0x10000 },
-  { .sc_size = 0xc00, .sc_block_size = 0x10000 },
-  { .sc_size = 0xe00, .sc_block_size = 0x10000 },
-  { .sc_size = 0x1000, .sc_block_size = 0x10000 },
-  { .sc_size = 0x1400, .sc_block_size = 0x10000 },
-  { .sc_size = 0x1800, .sc_block_size = 0x10000 },
-  { .sc_size = 0x1c00, .sc_block_size = 0x10000 },
-  { .sc_size = 0x2000, .sc_block_size = 0x10000 },
-  { .sc_size = 0x2800, .sc_block_size = 0x10000 },
-  { .sc_size = 0x3000, .sc_block_size = 0x10000 },
-  { .sc_size = 0x3800, .sc_block_size = 0x10000 },
-  { .sc_size = 0x4000, .sc_block_size = 0x10000 }
-};
-
-static inline unsigned int malloc_size_class(const unsigned int size) {
-
-  INVARIANT(size <= 0x4000);
-
-  const unsigned int size_div32 =
-    size >> 5;
-  unsigned int out = 0;
-
-  if(8 > size_div32)
-    out = size_div32;
-
-  else
-    out = malloc_big_size_class(size, 8);
-
-  return out;
-
-}
+/* Fill in the size classes and the lookup table.  Each class gets the
+ * smallest superblock (in region units) holding at least
+ * MALLOC_SB_MIN_BLOCKS blocks.
+ */
+static inline void malloc_sizeclass_init(void) {
 
-#else
-#define NUM_SIZE_CLASSES 28
-
-static sizeclass_t malloc_sizeclasses[NUM_SIZE_CLASSES] = {
-  { .sc_size = 0x40, .sc_block_size = 0x10000 },
-  { .sc_size = 0x80, .sc_block_size = 0x10000 },
-  { .sc_size = 0xc0, .sc_block_size = 0x10000 },
-  { .sc_size = 0x100, .sc_block_size = 0x10000 },
-  { .sc_size = 0x140, .sc_block_size = 0x10000 },
-  { .sc_size = 0x180, .sc_block_size = 0x10000 },
-  { .sc_size = 0x1c0, .sc_block_size = 0x10000 },
-  { .sc_size = 0x200, .sc_block_size = 0x10000 },
-  { .sc_size = 0x280, .sc_block_size = 0x10000 },
-  { .sc_size = 0x300, .sc_block_size = 0x10000 },
-  { .sc_size = 0x380, .sc_block_size = 0x10000 },
-  { .sc_size = 0x400, .sc_block_size = 0x10000 },
-  { .sc_size = 0x500, .sc_block_size = 0x10000 },
-  { .sc_size = 0x600, .sc_block_size = 0x10000 },
-  { .sc_size = 0x700, .sc_block_size = 0x10000 },
-  { .sc_size = 0x800, .sc_block_size = 0x10000 },
-  { .sc_size = 0xa00, .sc_block_size = 0x10000 },
-  { .sc_size = 0xc00, .sc_block_size = 0x10000 },
-  { .sc_size = 0xe00, .sc_block_size = 0x10000 },
-  { .sc_size = 0x1000, .sc_block_size = 0x10000 },
-  { .sc_size = 0x1400, .sc_block_size = 0x10000 },
-  { .sc_size = 0x1800, .sc_block_size = 0x10000 },
-  { .sc_size = 0x1c00, .sc_block_size = 0x10000 },
-  { .sc_size = 0x2000, .sc_block_size = 0x10000 },
-  { .sc_size = 0x2800, .sc_block_size = 0x10000 },
-  { .sc_size = 0x3000, .sc_block_size = 0x10000 },
-  { .sc_size = 0x3800, .sc_block_size = 0x10000 },
-  { .sc_size = 0x4000, .sc_block_size = 0x10000 }
-};
+  unsigned int index = 0;
 
-static inline unsigned int malloc_size_class(const unsigned int size) {
+  for(unsigned int i = 0; i < NUM_SIZE_CLASSES; i++) {
 
-  INVARIANT(size <= 0x4000);
+    const unsigned int size = malloc_class_size(i);
+    unsigned int units = 1;
 
-  const unsigned int size_div64 =
-    size >> 6;
-  unsigned int out = 0;
+    while(units < LF_REGION_MAX_UNITS &&
+	  (units << LF_REGION_UNIT_SHIFT) / size < MALLOC_SB_MIN_BLOCKS)
+      units <<= 1;
 
-  if(4 > size_div64)
-    out = size_div64;
+    malloc_sizeclasses[i].sc_size = size;
+    malloc_sizeclasses[i].sc_block_size = units << LF_REGION_UNIT_SHIFT;
+    malloc_sizeclasses[i].sc_maxcount =
+      min((units << LF_REGION_UNIT_SHIFT) / size, MALLOC_SB_MAX_BLOCKS);
+    malloc_sizeclasses[i].sc_reserve.value = 0;
+    malloc_sizeclasses[i].sc_reserve_count.value = 0;
+    PRINTD("Size class %u: size %u, superblock %u, %u blocks\n",
+	   i, size, malloc_sizeclasses[i].sc_block_size,
+	   malloc_sizeclasses[i].sc_maxcount);
 
-  else
-      out = malloc_big_size_class(size, 4);
+    for(; index <= size >> MALLOC_MIN_SHIFT; index++)
+      malloc_size_lookup[index] = i;
 
-  return out;
+  }
 
 }
 
-#endif
-
-static volatile atomic_ptr_t malloc_desc_avail;
+/* Free descriptors.  This is a tagged pointer, as descriptors are
+ * reused constantly.
+ */
+static volatile atomic_uint64_t malloc_desc_avail;
 
 static procheap_t (*malloc_procheaps)[NUM_SIZE_CLASSES];
 
+static malloc_cache_t (*malloc_caches)[NUM_SIZE_CLASSES];
+
 
 internal unsigned int mm_malloc_request(const unsigned int execs) {
 
@@ -320,13 +223,19 @@ internal unsigned int mm_malloc_request(const unsigned int execs) {
     ((one_blockqueue_size - 1) & ~(CACHE_LINE_SIZE - 1)) + CACHE_LINE_SIZE;
   const unsigned int blockqueues_aligned_size =
     one_blockqueue_aligned_size * NUM_SIZE_CLASSES;
+  const unsigned int caches_size =
+    sizeof(malloc_cache_t) * execs * NUM_SIZE_CLASSES;
+  const unsigned int caches_aligned_size =
+    ((caches_size - 1) & ~(CACHE_LINE_SIZE - 1)) + CACHE_LINE_SIZE;
   const unsigned int total_size =
-    procheap_aligned_size + blockqueues_aligned_size;
+    procheap_aligned_size + blockqueues_aligned_size + caches_aligned_size;
 
   PRINTD("    Reserving 0x%x bytes for processor heaps.\n",
 	 procheap_size);
   PRINTD("    Reserving 0x%x bytes for block queues.\n",
 	 blockqueues_aligned_size);
+  PRINTD("    Reserving 0x%x bytes for executor caches.\n",
+	 caches_aligned_size);
   PRINTD("  Malloc system total static size is 0x%x bytes.\n", total_size);
 
   return total_size;
@@ -349,19 +258,27 @@ internal void* mm_malloc_init(const unsigned int execs, void* const mem) {
     sizeof(lf_block_queue_t) + (execs * sizeof(lf_block_queue_hazard_ptrs_t));
   const unsigned int one_blockqueue_aligned_size =
     ((one_blockqueue_size - 1) & ~(CACHE_LINE_SIZE - 1)) + CACHE_LINE_SIZE;
+  const unsigned int caches_size =
+    sizeof(malloc_cache_t) * execs * NUM_SIZE_CLASSES;
+  const unsigned int caches_aligned_size =
+    ((caches_size - 1) & ~(CACHE_LINE_SIZE - 1)) + CACHE_LINE_SIZE;
   procheap_t (* const procheaps_ptr)[NUM_SIZE_CLASSES] = mem;
   char* const queues_ptr = (char*)mem + procheap_aligned_size;
-  char* const out = queues_ptr +
+  char* const caches_ptr = queues_ptr +
     (one_blockqueue_aligned_size * NUM_SIZE_CLASSES);
+  char* const out = caches_ptr + caches_aligned_size;
 
   PRINTD("Malloc system memory:\n");
   PRINTD("\tprocessor heaps at 0x%p\n", mem);
   PRINTD("\tblock queues at 0x%p\n", queues_ptr);
+  PRINTD("\texecutor caches at 0x%p\n", caches_ptr);
   PRINTD("\tend at 0x%p\n", out);
 
   PRINTD("Initializing malloc system with %u executors and memory at %p\n",
 	 execs, mem);
+  malloc_sizeclass_init();
   malloc_procheaps = procheaps_ptr;
+  malloc_caches = (malloc_cache_t (*)[NUM_SIZE_CLASSES])caches_ptr;
 
   for(unsigned int i = 0; i < execs; i++)
     for(unsigned int j = 0; j < NUM_SIZE_CLASSES; j++) {
@@ -370,7 +287,12 @@ internal void* mm_malloc_init(const unsigned int execs, void* const mem) {
 	     j, i, malloc_procheaps[i] + j);
       malloc_procheaps[i][j].ph_partial.value = NULL;
       malloc_procheaps[i][j].ph_active.value = 0;
+      malloc_procheaps[i][j].ph_remote.value = NULL;
+      malloc_procheaps[i][j].ph_exec = i;
       malloc_procheaps[i][j].ph_sizeclass = malloc_sizeclasses + j;
+      malloc_caches[i][j].mc_count = 0;
+      malloc_caches[i][j].mc_hits = 0;
+      malloc_caches[i][j].mc_misses = 0;
 
     }
 
@@ -390,67 +312,80 @@ internal void* mm_malloc_init(const unsigned int execs, void* const mem) {
 }
 
 
+static inline bool try_desc_push(descriptor_t* const restrict first,
+				 descriptor_t* const restrict last) {
+
+  const tagged_t oldhead = atomic_read_uint64(&malloc_desc_avail);
+  const tagged_t newhead =
+    tagged_create(first, tagged_get_tag(oldhead) + 1);
+
+  last->des_next = tagged_get_ptr(oldhead);
+  store_fence();
+
+  return atomic_compare_and_set_uint64(oldhead, newhead, &malloc_desc_avail);
+
+}
+
+
 static inline descriptor_t* try_desc_alloc(void) {
 
-  descriptor_t* const desc = malloc_desc_avail.value;
+  const tagged_t oldhead = atomic_read_uint64(&malloc_desc_avail);
+  descriptor_t* const desc = tagged_get_ptr(oldhead);
   descriptor_t* out = NULL;
 
   PRINTD("Attempting to allocate a descriptor\n");
 
   if(NULL != desc) {
 
-    descriptor_t* const next = desc->des_next;
+    /* Descriptor memory is never released, so this is safe even if
+     * desc was popped in the meantime; the tag catches that case.
+     */
+    const tagged_t newhead =
+      tagged_create(desc->des_next, tagged_get_tag(oldhead) + 1);
 
     PRINTD("Descriptors are already available\n");
 
-    if(atomic_compare_and_set_ptr(desc, next, &malloc_desc_avail))
+    if(atomic_compare_and_set_uint64(oldhead, newhead, &malloc_desc_avail))
       out = desc;
 
   }
 
   else {
 
-    /* XXX do a two-level slice allocation */
-    slice_t* const slice =
-      slice_alloc(SLICE_TYPE_MALLOC, SLICE_PROT_RWX, 0x10000);
+    lf_region_t* region;
+    void* const unit = lf_region_alloc(1, &region);
 
     PRINTD("No descriptors exist, allocating more\n");
 
-    if(NULL != slice) {
+    if(NULL != unit) {
 
       const unsigned int dessize =
 	sizeof(descriptor_t) < 64 ? 64 : sizeof(descriptor_t);
-      const unsigned int count = slice->s_size / dessize;
-      descriptor_t* addr = slice->s_ptr;
-      descriptor_t* newlist = (void*)((char*)addr + dessize);
+      const unsigned int count = LF_REGION_UNIT_SIZE / dessize;
+      descriptor_t* const first = unit;
+      descriptor_t* const newlist = (void*)((char*)unit + dessize);
+      descriptor_t* addr = newlist;
 
       PRINTD("Arranging descriptors in a list\n");
 
-      /* organize descriptors in a list */
-      for(unsigned int i = 0; i < count - 1; i++) {
+      /* organize all but the first descriptor in a list; the first
+       * one is the one being allocated.
+       */
+      for(unsigned int i = 1; i < count - 1; i++) {
 
 	addr->des_next = (void*)((char*)addr + dessize);
 	addr = (void*)((char*)addr + dessize);
 
       }
 
-      addr = (void*)((char*)addr - dessize);
-      addr->des_next = NULL;
-      store_fence();
-
-      if(atomic_compare_and_set_ptr(NULL, newlist, &malloc_desc_avail)) {
-
-	PRINTD("Succeded in setting available descriptors\n");
-	out = addr;
-
-      }
-
-      else {
-
-	PRINTD("Someone else created descriptors\n");
-	slice_free(slice);
+      /* If someone else created descriptors in the meantime, this
+       * just adds to them.
+       */
+      for(unsigned int i = 1; !try_desc_push(newlist, addr); i++)
+	backoff_delay(i);
 
-      }
+      PRINTD("Succeded in setting available descriptors\n");
+      out = first;
 
     }
 
@@ -481,14 +416,9 @@ static inline descriptor_t* desc_alloc(void) {
 
 static inline bool malloc_try_desc_retire(descriptor_t* const desc) {
 
-  descriptor_t* const oldhead = malloc_desc_avail.value;
-
   PRINTD("Trying to retire malloc descriptor %p\n", desc);
 
-  desc->des_next = oldhead;
-  store_fence();
-
-  return atomic_compare_and_set_ptr(oldhead, desc, &malloc_desc_avail);
+  return try_desc_push(desc, desc);
 
 }
 
@@ -501,6 +431,102 @@ static inline void malloc_desc_retire(descriptor_t* const desc) {
 }
 
 
+static inline bool try_sb_push(sizeclass_t* const restrict sizeclass,
+			       reserve_sb_t* const restrict sb) {
+
+  const tagged_t oldhead = atomic_read_uint64(&(sizeclass->sc_reserve));
+  const tagged_t newhead = tagged_create(sb, tagged_get_tag(oldhead) + 1);
+
+  sb->rs_next = tagged_get_ptr(oldhead);
+  store_fence();
+
+  return atomic_compare_and_set_uint64(oldhead, newhead,
+				       &(sizeclass->sc_reserve));
+
+}
+
+
+/* Put an empty superblock in its size class's reserve, or return it
+ * to its region if the reserve is full.  The memory in the reserve is
+ * marked unused, so the OS can reclaim it under pressure, but the
+ * superblock remains mapped for quick reuse.
+ */
+static inline void sb_retire(sizeclass_t* const restrict sizeclass,
+			     lf_region_t* const restrict region,
+			     void* const restrict sb) {
+
+  if(atomic_fetch_inc_uint(&(sizeclass->sc_reserve_count)) <=
+     MALLOC_SB_RESERVE) {
+
+    reserve_sb_t* const rsb = sb;
+
+    PRINTD("Placing superblock %p in reserve\n", sb);
+    slice_range_set_usage(region->r_slice, sb, sizeclass->sc_block_size,
+			  SLICE_USAGE_UNUSED);
+    rsb->rs_region = region;
+
+    for(unsigned int i = 1; !try_sb_push(sizeclass, rsb); i++)
+      backoff_delay(i);
+
+  }
+
+  else {
+
+    PRINTD("Reserve is full, releasing superblock %p\n", sb);
+    atomic_decrement_uint(&(sizeclass->sc_reserve_count));
+    lf_region_free(region, sb,
+		   sizeclass->sc_block_size >> LF_REGION_UNIT_SHIFT);
+
+  }
+
+}
+
+
+/* Take an empty superblock from a size class's reserve, if there are
+ * any.
+ */
+static inline void* sb_reuse(sizeclass_t* const restrict sizeclass,
+			     lf_region_t** const restrict region) {
+
+  reserve_sb_t* out;
+
+  for(unsigned int i = 1;; i++) {
+
+    const tagged_t oldhead = atomic_read_uint64(&(sizeclass->sc_reserve));
+
+    if(NULL != (out = tagged_get_ptr(oldhead))) {
+
+      /* Superblocks are never unmapped, so reading this is safe even
+       * if someone else took out in the meantime.
+       */
+      const tagged_t newhead =
+	tagged_create(out->rs_next, tagged_get_tag(oldhead) + 1);
+
+      if(atomic_compare_and_set_uint64(oldhead, newhead,
+				       &(sizeclass->sc_reserve))) {
+
+	PRINTD("Reusing superblock %p from reserve\n", out);
+	atomic_decrement_uint(&(sizeclass->sc_reserve_count));
+	*region = out->rs_region;
+	break;
+
+      }
+
+      else
+	backoff_delay(i);
+
+    }
+
+    else
+      break;
+
+  }
+
+  return out;
+
+}
+
+
 /* Get a procheap structure for this executor and size class. */
 static inline procheap_t* find_heap(const unsigned int size,
 				    const unsigned int exec) {
@@ -509,7 +535,7 @@ static inline procheap_t* find_heap(const unsigned int size,
 
   PRINTD("Finding heap for size %u for executor %u\n", size, exec);
 
-  if(size <= 0x40000) {
+  if(size <= MALLOC_MAX_SMALL_SIZE) {
 
     const unsigned int size_class = malloc_size_class(size);
 
@@ -639,6 +665,250 @@ static inline void update_active(procheap_t* const restrict heap,
 }
 
 
+static inline void remove_empty_desc(procheap_t* const heap,
+				     descriptor_t* const desc,
+				     const unsigned int exec) {
+
+  PRINTD("Executor %d attempting to release empty descriptor %p.\n",
+	 exec, desc);
+
+  if(atomic_compare_and_set_ptr(desc, NULL, &(heap->ph_partial)))
+    malloc_desc_retire(desc);
+
+  else {
+
+    lf_block_queue_t* const queue = heap->ph_sizeclass->sc_partial;
+    descriptor_t* first = NULL;
+    descriptor_t* curr;
+    unsigned int nonempty = 0;
+
+    /* Retire any empty descriptors at the front of the queue.  Stop
+     * after putting back a couple of non-empty ones, or seeing one
+     * twice.
+     */
+    while(NULL != (curr = lf_block_queue_dequeue(queue, exec))) {
+
+      if(ANC_EMPTY ==
+	 anchor_get_state(atomic_read_uint64(&(curr->des_anchor)))) {
+
+	PRINTD("Executor %d retiring empty descriptor %p.\n", exec, curr);
+	malloc_desc_retire(curr);
+
+      }
+
+      else {
+
+	lf_block_queue_enqueue(queue, curr, exec);
+
+	if(curr == first || 2 <= ++nonempty)
+	  break;
+
+	else if(NULL == first)
+	  first = curr;
+
+      }
+
+    }
+
+  }
+
+}
+
+
+/* Free a run of blocks from the same descriptor with one anchor
+ * update.  The blocks from first up to last must already be linked
+ * together by their avail indexes; only last is linked to the
+ * anchor's current avail block here.  A single free is just a run of
+ * one.
+ */
+static inline bool try_free(descriptor_t* const desc,
+			    unsigned int* const first,
+			    unsigned int* const last,
+			    const unsigned int count,
+			    const unsigned int exec) {
+
+  INVARIANT(desc != NULL);
+  INVARIANT(first != NULL);
+  INVARIANT(last != NULL);
+  INVARIANT(count != 0);
+
+  const anchor_t oldanchor = atomic_read_uint64(&(desc->des_anchor));
+  const unsigned int offset =
+    ((char*)first - (char*)desc->des_sb) / desc->des_size;
+  anchor_t newanchor =
+    anchor_set_avail(ANC_FULL == anchor_get_state(oldanchor) ?
+		     anchor_set_state(oldanchor, ANC_PARTIAL) : oldanchor,
+		     offset);
+  procheap_t* heap = NULL;
+  bool out;
+
+  PRINTD("Block is at offset %d\n", offset);
+  PRINTD("Anchor is %llx\nBlock %x next, slice pointer is %p, "
+	 "size is %x, %d credits.\n",
+	 oldanchor, anchor_get_avail(oldanchor),
+	 desc->des_sb, desc->des_size,
+	 anchor_get_credits(oldanchor));
+  PRINTD("Executor %d attempting to free %u blocks at %p, descriptor %p.\n",
+	 exec, count, first, desc);
+
+  *last = anchor_get_avail(oldanchor);
+
+  if(anchor_get_credits(oldanchor) + count == desc->des_maxcount) {
+
+    heap = desc->des_heap;
+    load_fence();
+    newanchor = anchor_set_state(newanchor, ANC_EMPTY);
+    PRINTD("Executor %d set anchor to empty.\n", exec);
+
+  }
+
+  else {
+
+    newanchor =
+      anchor_set_credits(newanchor, anchor_get_credits(newanchor) + count);
+    PRINTD("Executor %d setting anchor's credits to %d.\n",
+	   exec, anchor_get_credits(newanchor));
+
+
+  }
+
+  store_fence();
+
+  if(out = atomic_compare_and_set_uint64(oldanchor, newanchor,
+					 &(desc->des_anchor))) {
+
+    PRINTD("Executor %d installed new anchor.\n", exec);
+
+    if(ANC_EMPTY == anchor_get_state(newanchor)) {
+
+      PRINTD("Executor %d releasing empty slice.\n", exec);
+      sb_retire(heap->ph_sizeclass, desc->des_region, desc->des_sb);
+      remove_empty_desc(heap, desc, exec);
+
+    }
+
+    else if(ANC_FULL == anchor_get_state(oldanchor)) {
+
+      PRINTD("Executor %d inserting partially full slice.\n", exec);
+      heap_put_partial(desc, exec);
+
+    }
+
+  }
+
+  return out;
+
+}
+
+
+static inline void free_run(descriptor_t* const desc,
+			    unsigned int* const first,
+			    unsigned int* const last,
+			    const unsigned int count,
+			    const unsigned int exec) {
+
+  for(unsigned int i = 1; !try_free(desc, first, last, count, exec); i++)
+    backoff_delay(i);
+
+}
+
+
+/* Blocks freed by an executor other than the owner of their heap are
+ * pushed onto the heap's remote list instead of going to the anchor.
+ * The remote list is linked through the first word of the blocks'
+ * user data.  Since the list is only ever pushed to or taken whole,
+ * there is no ABA problem.
+ */
+static inline bool try_remote_push(procheap_t* const restrict heap,
+				   void** const restrict block) {
+
+  void* const head = heap->ph_remote.value;
+
+  *block = head;
+  store_fence();
+
+  return atomic_compare_and_set_ptr(head, block, &(heap->ph_remote));
+
+}
+
+
+static inline void remote_push(procheap_t* const restrict heap,
+			       void* const restrict block) {
+
+  PRINTD("Pushing %p onto remote list for heap %p\n", block, heap);
+
+  for(unsigned int i = 1; !try_remote_push(heap, block); i++)
+    backoff_delay(i);
+
+}
+
+
+/* Take the entire remote list for a heap, and return it to the
+ * anchors.  Consecutive blocks from the same descriptor (the common
+ * case when one executor frees what another allocated in order) are
+ * released with a single anchor update.
+ */
+static inline void heap_reconcile_remote(procheap_t* const restrict heap,
+					 const unsigned int exec) {
+
+  void** block;
+
+  INVARIANT(heap->ph_exec == exec);
+
+  for(unsigned int i = 1;; i++) {
+
+    block = heap->ph_remote.value;
+
+    if(NULL == block ||
+       atomic_compare_and_set_ptr(block, NULL, &(heap->ph_remote)))
+      break;
+
+    else
+      backoff_delay(i);
+
+  }
+
+  if(NULL != block) {
+
+    descriptor_t* desc = NULL;
+    unsigned int* first = NULL;
+    unsigned int* last = NULL;
+    unsigned int count = 0;
+
+    PRINTD("Executor %u reconciling remote frees for heap %p\n", exec, heap);
+
+    while(NULL != block) {
+
+      void** const next = *block;
+      descriptor_t* const blockdesc = lf_region_owner(block);
+
+      if(blockdesc != desc) {
+
+	if(NULL != desc)
+	  free_run(desc, first, last, count, exec);
+
+	desc = blockdesc;
+	first = (unsigned int*)block;
+	count = 0;
+
+      }
+
+      else
+	*last = ((char*)block - (char*)desc->des_sb) / desc->des_size;
+
+      last = (unsigned int*)block;
+      count++;
+      block = next;
+
+    }
+
+    free_run(desc, first, last, count, exec);
+
+  }
+
+}
+
+
 static inline void* pop_from_active(procheap_t* const restrict procheap,
 				    const active_t active,
 				    const unsigned int exec) {
@@ -654,10 +924,10 @@ static inline void* pop_from_active(procheap_t* const restrict procheap,
   PRINTD("Anchor is %llx\nBlock %x next, slice pointer is %p, "
 	 "size is %x, %d credits.\n",
 	 oldanchor, anchor_get_avail(oldanchor),
-	 desc->des_slice->s_ptr, desc->des_size,
+	 desc->des_sb, desc->des_size,
 	 anchor_get_credits(oldanchor));
 
-  void* const addr = (char*)desc->des_slice->s_ptr +
+  void* const addr = (char*)desc->des_sb +
     (anchor_get_avail(oldanchor) * desc->des_size);
 
   PRINTD("Address is %p\n", addr);
@@ -688,13 +958,10 @@ static inline void* pop_from_active(procheap_t* const restrict procheap,
   if(atomic_compare_and_set_uint64(oldanchor, newanchor,
 				   &(desc->des_anchor))) {
 
-    void** const store_addr = addr;
-
     if(0 == active_get_credits(active) && 0 < anchor_get_credits(oldanchor))
       update_active(procheap, desc, morecredits, exec);
 
-    *store_addr = desc;
-    out = (char*)addr + CACHE_LINE_SIZE;
+    out = addr;
 
   }
 
@@ -709,9 +976,14 @@ static inline void* pop_from_active(procheap_t* const restrict procheap,
 static inline void* malloc_from_active(procheap_t* const restrict heap,
 				       const unsigned int exec) {
 
-  const active_t active = reserve_from_active(heap);
+  active_t active;
   void* out;
 
+  if(heap->ph_exec == exec && NULL != heap->ph_remote.value)
+    heap_reconcile_remote(heap, exec);
+
+  active = reserve_from_active(heap);
+
   if(NULL != active_get_ptr(active)) {
 
     for(unsigned int i = 1;
@@ -771,7 +1043,7 @@ static inline descriptor_t* heap_get_partial(procheap_t* const restrict heap,
 static inline void* pop_from_partial(descriptor_t* const restrict desc) {
 
   const anchor_t oldanchor = atomic_read_uint64(&(desc->des_anchor));
-  void* const addr = (char*)desc->des_slice->s_ptr +
+  void* const addr = (char*)desc->des_sb +
     (anchor_get_avail(oldanchor) * desc->des_size);
   const anchor_t avail = anchor_set_avail(oldanchor, *(unsigned int*)addr);
   const anchor_t newanchor =
@@ -789,7 +1061,6 @@ static inline void* malloc_from_partial(procheap_t* const restrict heap,
 
   descriptor_t* desc;
   unsigned int morecredits;
-  void** addr;
   void* out;
   bool retry = true;
 
@@ -803,7 +1074,7 @@ static inline void* malloc_from_partial(procheap_t* const restrict heap,
 	PRINTD("Anchor is %llx\nBlock %x next, slice pointer is %p, "
 	       "size is %x, %d credits.\n",
 	       oldanchor, anchor_get_avail(oldanchor),
-	       desc->des_slice->s_ptr, desc->des_size,
+	       desc->des_sb, desc->des_size,
 	       anchor_get_credits(oldanchor));
 
 	if(ANC_EMPTY != anchor_get_state(oldanchor)) {
@@ -822,6 +1093,7 @@ static inline void* malloc_from_partial(procheap_t* const restrict heap,
 					   &(desc->des_anchor))) {
 
 	    PRINTD("Succeeded in claiming a partial descriptor\n");
+	    desc->des_heap = heap;
 	    morecredits = credits;
 	    retry = false;
 	    break;
@@ -836,6 +1108,7 @@ static inline void* malloc_from_partial(procheap_t* const restrict heap,
 	else {
 
 	  PRINTD("Partial heap was actually empty, retrying\n");
+	  malloc_desc_retire(desc);
 	  backoff_delay(i);
 	  break;
 
@@ -852,15 +1125,12 @@ static inline void* malloc_from_partial(procheap_t* const restrict heap,
 
     PRINTD("Attempting to take a block from partial descriptor %p\n", desc);
 
-    for(unsigned int i = 1; NULL == (addr = pop_from_partial(desc)); i++)
+    for(unsigned int i = 1; NULL == (out = pop_from_partial(desc)); i++)
       backoff_delay(i);
 
     if(morecredits > 0)
       update_active(heap, desc, morecredits, exec);
 
-    *addr = desc;
-
-    out = (char*)addr + CACHE_LINE_SIZE;
     PRINTD("Executor %u allocated %p from partial descriptor %p\n",
 	   exec, out, desc);
 
@@ -880,48 +1150,49 @@ static inline void* malloc_from_partial(procheap_t* const restrict heap,
 /* XXX need to do a retry */
 static inline void* malloc_from_new_sb(procheap_t* const restrict heap) {
 
-  /* XXX do a two-level slice allocation */
-  slice_t* const slice = slice_alloc(SLICE_TYPE_MALLOC, SLICE_PROT_RWX,
-				     heap->ph_sizeclass->sc_block_size);
+  sizeclass_t* const sizeclass = heap->ph_sizeclass;
+  const unsigned int units = sizeclass->sc_block_size >> LF_REGION_UNIT_SHIFT;
+  lf_region_t* region;
+  void* sb = sb_reuse(sizeclass, &region);
   void* out;
 
-  if(NULL != slice) {
+  if(NULL == sb)
+    sb = lf_region_alloc(units, &region);
+
+  if(NULL != sb) {
 
     PRINTD("Allocated a new superblock\n");
 
     descriptor_t* const desc = desc_alloc();
-    const unsigned int maxcount =
-      heap->ph_sizeclass->sc_block_size / heap->ph_sizeclass->sc_size;
+    const unsigned int maxcount = sizeclass->sc_maxcount;
     const unsigned int credits = min(maxcount - 1, MAX_CREDITS) - 1;
     const active_t newactive = active_create(desc, credits);
-    void* const addr = slice->s_ptr;
 
     PRINTD("Arranging blocks in a list\n");
     /* setup blocks in a list */
     for(unsigned int i = 1; i < maxcount - 1; i++) {
 
-      const unsigned int offset = heap->ph_sizeclass->sc_size * i;
-      unsigned int* const ptr = (unsigned int*)((char*)addr + offset);
+      const unsigned int offset = sizeclass->sc_size * i;
+      unsigned int* const ptr = (unsigned int*)((char*)sb + offset);
 
       *ptr = i + 1;
 
     }
 
-    desc->des_slice = slice;
+    desc->des_sb = sb;
+    desc->des_region = region;
     desc->des_heap = heap;
-    desc->des_size = heap->ph_sizeclass->sc_size;
+    desc->des_size = sizeclass->sc_size;
     desc->des_maxcount = maxcount;
     desc->des_anchor.value = anchor_create(1, (maxcount - 1) -
 					   (credits + 1), ANC_ACTIVE);
+    lf_region_set_owner(region, sb, units, desc);
     store_fence();
 
     if(atomic_compare_and_set_uint64(0, newactive, &(heap->ph_active))) {
 
-      void** const slice_ptr = slice->s_ptr;
-
       PRINTD("Succeeded in setting the active to the new block\n");
-      *slice_ptr = desc;
-      out = (char*)slice_ptr + CACHE_LINE_SIZE;
+      out = sb;
       PRINTD("Allocated %p from a new superblock\n", out);
 
     }
@@ -929,7 +1200,7 @@ static inline void* malloc_from_new_sb(procheap_t* const restrict heap) {
     else {
 
       PRINTD("Failed to set the active to the new block");
-      slice_free(slice);
+      sb_retire(sizeclass, region, sb);
       malloc_desc_retire(desc);
       out = NULL;
 
@@ -976,112 +1247,125 @@ static inline void* try_alloc(procheap_t* const restrict heap,
 }
 
 
-static inline void remove_empty_desc(procheap_t* const heap,
-				     descriptor_t* const desc,
-				     const unsigned int exec) {
+static inline void block_free(descriptor_t* const desc,
+			      void* const ptr,
+			      const unsigned int exec) {
 
-  PRINTD("Executor %d attempting to release empty descriptor %p.\n",
-	 exec, desc);
+  procheap_t* const heap = desc->des_heap;
 
-  if(atomic_compare_and_set_ptr(desc, NULL, &(heap->ph_partial)))
-    malloc_desc_retire(desc);
+  if(heap->ph_exec == exec)
+    free_run(desc, ptr, ptr, 1, exec);
 
-  else {
 
-    lf_block_queue_t* const queue = heap->ph_sizeclass->sc_partial;
-    descriptor_t* curr;
+  else
+    remote_push(heap, ptr);
+
+}
 
-    while(NULL != (curr = lf_block_queue_dequeue(queue, exec)) &&
-	  ANC_EMPTY !=
-	  anchor_get_state(atomic_read_uint64(&(curr->des_anchor))));
 
-    if(NULL != curr)
-      lf_block_queue_enqueue(queue, curr, exec);
+static inline malloc_cache_t* find_cache(const procheap_t* const heap,
+					 const unsigned int exec) {
 
-  }
+  return malloc_caches[exec] + (heap->ph_sizeclass - malloc_sizeclasses);
 
 }
 
 
-static inline bool try_free(descriptor_t* const desc,
-			    unsigned int* const ptr,
-			    const unsigned int exec) {
+static inline procheap_t* find_cache_heap(const malloc_cache_t* const cache,
+					  const unsigned int exec) {
 
-  INVARIANT(desc != NULL);
-  INVARIANT(ptr != NULL);
+  return malloc_procheaps[exec] + (cache - malloc_caches[exec]);
 
-  const anchor_t oldanchor = atomic_read_uint64(&(desc->des_anchor));
-  const unsigned int offset =
-    ((char*)ptr - (char*)desc->des_slice->s_ptr) / desc->des_size;
-  anchor_t newanchor =
-    anchor_set_avail(ANC_FULL == anchor_get_state(oldanchor) ?
-		     anchor_set_state(oldanchor, ANC_PARTIAL) : oldanchor,
-		     offset);
-  procheap_t* heap = NULL;
-  bool out;
+}
 
-  PRINTD("Block is at offset %d\n", offset);
-  PRINTD("Anchor is %llx\nBlock %x next, slice pointer is %p, "
-	 "size is %x, %d credits.\n",
-	 oldanchor, anchor_get_avail(oldanchor),
-	 desc->des_slice->s_ptr, desc->des_size,
-	 anchor_get_credits(oldanchor));
-  PRINTD("Executor %d attempting to free block %p, descriptor %p.\n",
-	 exec, ptr, desc);
 
-  *ptr = anchor_get_avail(oldanchor);
+/* Refill an empty cache with half its depth in blocks.  The first
+ * block is returned, the rest go into the cache.
+ */
+static inline void* cache_refill(malloc_cache_t* const restrict cache,
+				 procheap_t* const restrict heap,
+				 const unsigned int exec) {
 
-  if(anchor_get_credits(oldanchor) == desc->des_maxcount - 1) {
+  void* out;
 
-    heap = desc->des_heap;
-    load_fence();
-    newanchor = anchor_set_state(newanchor, ANC_EMPTY);
-    PRINTD("Executor %d set anchor to empty.\n", exec);
+  INVARIANT(0 == cache->mc_count);
 
-  }
+  PRINTD("Executor %u refilling cache %p\n", exec, cache);
 
-  else {
+  /* Original algorithm modified to do exponential backoff */
+  for(unsigned int i = 1; NULL == (out = try_alloc(heap, exec)); i++)
+    backoff_delay(i);
 
-    newanchor =
-      anchor_set_credits(newanchor, anchor_get_credits(newanchor) + 1);
-    PRINTD("Executor %d setting anchor's credits to %d.\n",
-	   exec, anchor_get_credits(newanchor));
+  /* Only take the rest if they can be had without contention */
+  for(unsigned int i = 1; i < MALLOC_CACHE_DEPTH / 2; i++) {
+
+    void* const block = try_alloc(heap, exec);
 
+    if(NULL != block)
+      cache->mc_blocks[cache->mc_count++] = block;
+
+    else
+      break;
 
   }
 
-  store_fence();
+  PRINTD("Executor %u cache %p refilled with %u blocks\n",
+	 exec, cache, cache->mc_count);
 
-  if(out = atomic_compare_and_set_uint64(oldanchor, newanchor,
-					 &(desc->des_anchor))) {
+  return out;
 
-    PRINTD("Executor %d installed new anchor.\n", exec);
+}
 
-    if(ANC_EMPTY == anchor_get_state(newanchor)) {
 
-      PRINTD("Executor %d releasing empty slice.\n", exec);
-      slice_free(desc->des_slice);
-      remove_empty_desc(heap, desc, exec);
+/* Return the oldest half of a full cache to the shared superblocks. */
+static inline void cache_drain(malloc_cache_t* const restrict cache,
+			       procheap_t* const restrict heap,
+			       const unsigned int exec) {
 
-    }
+  const unsigned int count = MALLOC_CACHE_DEPTH / 2;
 
-    else if(ANC_FULL == anchor_get_state(oldanchor)) {
+  INVARIANT(MALLOC_CACHE_DEPTH == cache->mc_count);
 
-      PRINTD("Executor %d inserting partially full slice.\n", exec);
-      heap_put_partial(desc, exec);
+  PRINTD("Executor %u draining cache %p\n", exec, cache);
 
-    }
+  if(NULL != heap->ph_remote.value)
+    heap_reconcile_remote(heap, exec);
+
+  for(unsigned int i = 0; i < count; i++) {
+
+    void* const block = cache->mc_blocks[i];
+
+    block_free(lf_region_owner(block), block, exec);
 
   }
 
-  return out;
+  memmove(cache->mc_blocks, cache->mc_blocks + count,
+	  (MALLOC_CACHE_DEPTH - count) * sizeof(void*));
+  cache->mc_count = MALLOC_CACHE_DEPTH - count;
+
+}
+
+
+internal void malloc_cache_stats(const unsigned int exec,
+				 unsigned int* const hits,
+				 unsigned int* const misses) {
+
+  unsigned int hitcount = 0;
+  unsigned int misscount = 0;
+
+  for(unsigned int i = 0; i < NUM_SIZE_CLASSES; i++) {
+
+    hitcount += malloc_caches[exec][i].mc_hits;
+    misscount += malloc_caches[exec][i].mc_misses;
+
+  }
+
+  *hits = hitcount;
+  *misses = misscount;
 
 }
 
 
-/* XXX reposition descriptor and don't add a cache line for objects
- * smaller than CACHE_LINE_SIZE - sizeof(void*)
- */
 extern void* malloc_lf(const unsigned int req_size, const unsigned int exec) {
 
   void* out;
@@ -1090,24 +1374,61 @@ extern void* malloc_lf(const unsigned int req_size, const unsigned int exec) {
 
   if(0 != req_size) {
 
+    /* Only large blocks have a prefix */
     const unsigned int size = req_size + CACHE_LINE_SIZE;
-    procheap_t* const restrict heap = find_heap(size, exec);
+    procheap_t* const restrict heap = find_heap(req_size, exec);
 
-    PRINTD("Full size %u\n", size);
     PRINTD("Allocating from heap %p\n", heap);
 
-    /* Original algorithm modified to do exponential backoff */
-    if(NULL != heap)
-      for(unsigned int i = 1; NULL == (out = try_alloc(heap, exec)); i++)
-	backoff_delay(i);
+    if(NULL != heap) {
+
+      malloc_cache_t* const cache = find_cache(heap, exec);
+
+      if(0 != cache->mc_count) {
+
+	PRINTD("Executor %u allocating from cache %p\n", exec, cache);
+	cache->mc_hits++;
+	out = cache->mc_blocks[--cache->mc_count];
+
+      }
+
+      else {
+
+	cache->mc_misses++;
+	out = cache_refill(cache, heap, exec);
+
+      }
+
+    }
+
+    else if(size <= LF_BUDDY_MAX_SIZE) {
+
+      lf_buddy_arena_t* arena;
+      unsigned int node;
+      unsigned int* const ptr = lf_buddy_alloc(size, &arena, &node);
+
+      PRINTD("Request was too big, allocated a buddy block at %p\n", ptr);
+
+      if(NULL != ptr) {
+
+	ptr[0] = (unsigned int)arena | MALLOC_TAG_LARGE | MALLOC_TAG_BUDDY;
+	ptr[1] = node;
+	out = (char*)ptr + CACHE_LINE_SIZE;
+
+      }
+
+      else
+	out = NULL;
+
+    }
 
     else {
 
-      const unsigned int slice_size = ((size - 1) % PAGE_SIZE) + PAGE_SIZE;
-      /* XXX Go to a lock-free buddy-system allocator */
-      const slice_t* const slice =
+      const unsigned int slice_size =
+	((size - 1) & ~(PAGE_SIZE - 1)) + PAGE_SIZE;
+      slice_t* const slice =
 	slice_alloc(SLICE_TYPE_MALLOC, SLICE_PROT_RWX,
-		    slice_size);
+		    slice_size, exec);
 
       PRINTD("Request was too big, allocated a whole slice of size %u\n",
 	     slice_size);
@@ -1116,9 +1437,8 @@ extern void* malloc_lf(const unsigned int req_size, const unsigned int exec) {
       if(NULL != slice) {
 
 	unsigned int* const ptr = slice->s_ptr;
-	const unsigned int ptr_val = (unsigned int)(slice->s_ptr) | 0x1;
 
-	*(ptr) = ptr_val;
+	*(ptr) = (unsigned int)slice | MALLOC_TAG_LARGE;
 	out = (char*)ptr + CACHE_LINE_SIZE;
 
       }
@@ -1146,21 +1466,40 @@ extern void free_lf(void* const ptr, const unsigned int exec) {
 
   if(NULL != ptr) {
 
-    void* const prefix = (char*)ptr - CACHE_LINE_SIZE;
-    const unsigned int tag_val = *((unsigned int*)prefix);
-    const bool large_block = tag_val & 0x1;
-    void* const tag_ptr = (void*)(tag_val & ~0x1);
+    descriptor_t* const desc = lf_region_owner(ptr);
 
-    PRINTD("Prefix is at %p\n", prefix);
-    PRINTD("Block %s large\n", large_block ? "is" : "is not");
-    PRINTD("Tag pointer is %p\n", tag_ptr);
+    PRINTD("Block %s large\n", NULL == desc ? "is" : "is not");
 
-    if(!large_block)
-      for(int i = 0; !try_free(tag_ptr, prefix, exec); i++)
-	backoff_delay(i);
+    if(NULL != desc) {
 
-    else
-      slice_free(tag_ptr);
+      malloc_cache_t* const cache = find_cache(desc->des_heap, exec);
+
+      if(MALLOC_CACHE_DEPTH == cache->mc_count)
+	cache_drain(cache, find_cache_heap(cache, exec), exec);
+
+      PRINTD("Executor %u returning %p to cache %p\n", exec, ptr, cache);
+      cache->mc_blocks[cache->mc_count++] = ptr;
+
+    }
+
+    else {
+
+      void* const prefix = (char*)ptr - CACHE_LINE_SIZE;
+      const unsigned int tag_val = *((unsigned int*)prefix);
+      void* const tag_ptr = (void*)(tag_val & ~MALLOC_TAG_MASK);
+
+      INVARIANT(tag_val & MALLOC_TAG_LARGE);
+
+      PRINTD("Prefix is at %p\n", prefix);
+      PRINTD("Tag pointer is %p\n", tag_ptr);
+
+      if(tag_val & MALLOC_TAG_BUDDY)
+	lf_buddy_free(tag_ptr, ((unsigned int*)prefix)[1]);
+
+      else
+	slice_free(tag_ptr, exec);
+
+    }
 
   }
 
@@ -1201,14 +1540,103 @@ extern void* calloc(const unsigned long size, const unsigned long num) {
 }
 
 
+/* Try to satisfy a realloc without moving the block.  If this
+ * returns NULL, then oldsize holds the usable size of the old block.
+ */
+static inline void* realloc_in_place(void* const ptr,
+				     const unsigned int req_size,
+				     unsigned int* const oldsize,
+				     const unsigned int exec) {
+
+  const descriptor_t* const desc = lf_region_owner(ptr);
+  unsigned int* const prefix = (unsigned int*)((char*)ptr - CACHE_LINE_SIZE);
+  const unsigned int size = req_size + CACHE_LINE_SIZE;
+  void* out = NULL;
+
+  if(NULL != desc) {
+
+    const procheap_t* const heap = find_heap(req_size, exec);
+
+    PRINTD("Reallocating small block %p of size %u to size %u\n",
+	   ptr, desc->des_size, req_size);
+
+    /* Keep the block if the new size maps to the same size class. */
+    if(NULL != heap && heap->ph_sizeclass == desc->des_heap->ph_sizeclass)
+      out = ptr;
+
+    *oldsize = desc->des_size;
+
+  }
+
+  else if(*prefix & MALLOC_TAG_BUDDY) {
+
+    const unsigned int blocksize = lf_buddy_node_size(prefix[1]);
+
+    PRINTD("Reallocating buddy block %p of size %u to size %u\n",
+	   ptr, blocksize, size);
+
+    /* Keep the block if a smaller buddy block wouldn't do. */
+    if(size <= blocksize && (size > blocksize >> 1 ||
+			     blocksize == 1 << LF_BUDDY_MIN_SHIFT))
+      out = ptr;
+
+    *oldsize = blocksize - CACHE_LINE_SIZE;
+
+  }
+
+  else {
+
+    slice_t* const slice = (slice_t*)(*prefix & ~MALLOC_TAG_MASK);
+    const unsigned int slice_size =
+      ((size - 1) & ~(PAGE_SIZE - 1)) + PAGE_SIZE;
+
+    PRINTD("Reallocating slice block %p of size %u to size %u\n",
+	   ptr, slice->s_size, size);
+
+    /* Whole slices are resized by the OS, which may move the mapping
+     * without copying.  Blocks which shrink enough to go to the buddy
+     * allocator are copied instead.
+     */
+    if(size > LF_BUDDY_MAX_SIZE && slice_resize(slice, slice_size, exec))
+      out = (char*)slice->s_ptr + CACHE_LINE_SIZE;
+
+    *oldsize = slice->s_size - CACHE_LINE_SIZE;
+
+  }
+
+  return out;
+
+}
+
+
 extern void* realloc(void* const ptr, const unsigned long size) {
 
-  void* const out = malloc(size);
+  unsigned int id;
+  void* out;
+
+  cc_executor_id(&id);
+
+  if(NULL == ptr)
+    out = malloc_lf(size, id);
+
+  else if(0 == size) {
+
+    free_lf(ptr, id);
+    out = NULL;
 
-  if(NULL != out) {
+  }
+
+  else {
+
+    unsigned int oldsize;
 
-    memcpy(out, ptr, size);
-    free(ptr);
+    if(NULL == (out = realloc_in_place(ptr, size, &oldsize, id)) &&
+       NULL != (out = malloc_lf(size, id))) {
+
+      memcpy(out, ptr, min(oldsize, size));
+      free_lf(ptr, id);
+
+    }
 
   }
 
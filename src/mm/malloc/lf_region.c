@@ -0,0 +1,334 @@
+/* Copyright (c) 2008 Eric McCorkle.  All rights reserved. */
+
+#include <stdbool.h>
+
+#include "definitions.h"
+#include "atomic.h"
+#include "bitops.h"
+#include "mm/slice.h"
+#include "mm/lf_region.h"
+
+/* Two-level allocation for malloc superblocks.  Large slices are
+ * mapped once as regions, and handed out in runs of units by claiming
+ * bits in the region's bitmap.  Regions live in a static table, so
+ * they can be scanned without any reclamation problems.  Since every
+ * region needs a slice, the table can be no larger than the slice
+ * table.  A region is found from any address in it through the slice
+ * page map, which lets malloc find a block's owner without any
+ * header.
+ */
+
+static lf_region_t lf_regions[SLICE_TAB_SIZE];
+
+static volatile atomic_uint_t lf_region_count;
+
+/* Where the last successful allocation happened.  This is only a
+ * hint, so races on it are harmless.
+ */
+static unsigned int lf_region_hint;
+
+
+static inline pure unsigned int lf_region_mask(const unsigned int units) {
+
+  return LF_REGION_MAX_UNITS == units ? ~0 : (1 << units) - 1;
+
+}
+
+
+static inline pure unsigned int lf_region_index(const lf_region_t* const region,
+						const void* const ptr) {
+
+  return ((const char*)ptr - (const char*)region->r_slice->s_ptr) >>
+    LF_REGION_UNIT_SHIFT;
+
+}
+
+
+/* Add to the used count.  Returns true if the region was empty. */
+static inline bool lf_region_add_used(lf_region_t* const region,
+				      const unsigned int units) {
+
+  unsigned int old;
+
+  for(unsigned int i = 1;; i++) {
+
+    old = region->r_used.value;
+
+    if(atomic_compare_and_set_uint(old, old + units, &(region->r_used)))
+      break;
+
+    else
+      backoff_delay(i);
+
+  }
+
+  return 0 == old;
+
+}
+
+
+/* Subtract from the used count.  Returns true if the region is now
+ * empty.
+ */
+static inline bool lf_region_sub_used(lf_region_t* const region,
+				      const unsigned int units) {
+
+  unsigned int old;
+
+  for(unsigned int i = 1;; i++) {
+
+    old = region->r_used.value;
+    INVARIANT(old >= units);
+
+    if(atomic_compare_and_set_uint(old, old - units, &(region->r_used)))
+      break;
+
+    else
+      backoff_delay(i);
+
+  }
+
+  return units == old;
+
+}
+
+
+static inline void* lf_region_try_alloc_in(lf_region_t* const region,
+					   const unsigned int units) {
+
+  slice_t* const slice = region->r_slice;
+  const unsigned int mask = lf_region_mask(units);
+  void* out = NULL;
+
+  if(NULL != slice)
+    for(unsigned int i = 0; NULL == out && i < LF_REGION_BITMAP_SIZE; i++)
+      for(unsigned int j = 0, k = 1; j < WORD_SIZE * 8;) {
+
+	const unsigned int old = region->r_bitmap[i].value;
+	const unsigned int bits = mask << j;
+
+	if(0 != (old & bits))
+	  j += units;
+
+	else if(atomic_compare_and_set_uint(old, old | bits,
+					    region->r_bitmap + i)) {
+
+	  const unsigned int index = (i * WORD_SIZE * 8) + j;
+
+	  /* The first units allocated from an empty region bring it
+	   * back into use.
+	   */
+	  if(lf_region_add_used(region, units))
+	    slice_set_usage(slice, SLICE_USAGE_USED);
+
+	  out = (char*)slice->s_ptr + (index << LF_REGION_UNIT_SHIFT);
+	  break;
+
+	}
+
+	else
+	  backoff_delay(k++);
+
+      }
+
+  return out;
+
+}
+
+
+static inline void* lf_region_create(const unsigned int units,
+				     lf_region_t** const region) {
+
+  /* Aligning regions to their size keeps superblocks, which are
+   * aligned to their size within the region, from straddling large
+   * pages.
+   */
+  slice_t* const slice =
+    slice_alloc_aligned(SLICE_TYPE_MALLOC, SLICE_PROT_RWX,
+			LF_REGION_SIZE, LF_REGION_SIZE, SLICE_EXEC_NONE);
+  void* out = NULL;
+
+  if(NULL != slice) {
+
+    const unsigned int index = atomic_fetch_inc_uint(&lf_region_count) - 1;
+
+    if(index < SLICE_TAB_SIZE) {
+
+      lf_region_t* const newregion = lf_regions + index;
+
+      PRINTD("Creating malloc region %u in slice %p\n", index, slice);
+
+      /* Claim the first units before anyone else can see the region. */
+      newregion->r_used.value = units;
+      newregion->r_bitmap[0].value = lf_region_mask(units);
+
+      for(unsigned int i = 1; i < LF_REGION_BITMAP_SIZE; i++)
+	newregion->r_bitmap[i].value = 0;
+
+      for(unsigned int i = 0; i < LF_REGION_UNITS; i++)
+	newregion->r_owner[i] = NULL;
+
+      slice_set_usage(slice, SLICE_USAGE_USED);
+      slice->s_data = newregion;
+      store_fence();
+      newregion->r_slice = slice;
+      lf_region_hint = index;
+      *region = newregion;
+      out = slice->s_ptr;
+
+    }
+
+    else {
+
+      PRINTD("Region table is full\n");
+      atomic_decrement_uint(&lf_region_count);
+      slice_free(slice, SLICE_EXEC_NONE);
+
+    }
+
+  }
+
+  return out;
+
+}
+
+
+internal void* lf_region_alloc(const unsigned int units,
+			       lf_region_t** const region) {
+
+  INVARIANT(units != 0 && units <= LF_REGION_MAX_UNITS);
+  INVARIANT((units & (units - 1)) == 0);
+
+  const unsigned int count = min(lf_region_count.value, SLICE_TAB_SIZE);
+  const unsigned int hint = lf_region_hint < count ? lf_region_hint : 0;
+  void* out = NULL;
+
+  for(unsigned int i = 0; NULL == out && i < count; i++) {
+
+    const unsigned int index = (hint + i) % count;
+
+    if(NULL != (out = lf_region_try_alloc_in(lf_regions + index, units))) {
+
+      lf_region_hint = index;
+      *region = lf_regions + index;
+
+    }
+
+  }
+
+  if(NULL == out)
+    out = lf_region_create(units, region);
+
+  PRINTD("Region allocation of %u units returned %p\n", units, out);
+
+  return out;
+
+}
+
+
+/* Try to take every unit in an empty region, so that its memory can
+ * be released without anyone allocating from it.
+ */
+static inline bool lf_region_try_claim_all(lf_region_t* const region) {
+
+  unsigned int i;
+
+  for(i = 0; i < LF_REGION_BITMAP_SIZE; i++)
+    if(!atomic_compare_and_set_uint(0, ~0, region->r_bitmap + i))
+      break;
+
+  if(LF_REGION_BITMAP_SIZE != i) {
+
+    while(0 != i--)
+      region->r_bitmap[i].value = 0;
+
+    store_fence();
+
+  }
+
+  return LF_REGION_BITMAP_SIZE == i;
+
+}
+
+
+internal void lf_region_free(lf_region_t* const region, void* const ptr,
+			     const unsigned int units) {
+
+  INVARIANT(region != NULL);
+  INVARIANT(region->r_slice != NULL);
+  INVARIANT(units != 0 && units <= LF_REGION_MAX_UNITS);
+
+  slice_t* const slice = region->r_slice;
+  const unsigned int index = lf_region_index(region, ptr);
+  const unsigned int word = index / (WORD_SIZE * 8);
+  const unsigned int bits =
+    lf_region_mask(units) << (index % (WORD_SIZE * 8));
+
+  PRINTD("Freeing %u units at %u of region %p\n", units, index, region);
+
+  for(unsigned int i = 1;; i++) {
+
+    const unsigned int old = region->r_bitmap[word].value;
+
+    INVARIANT((old & bits) == bits);
+
+    if(atomic_compare_and_set_uint(old, old & ~bits, region->r_bitmap + word))
+      break;
+
+    else
+      backoff_delay(i);
+
+  }
+
+  /* If this emptied the region, release the memory.  Nothing is
+   * unmapped; the OS takes the pages back whenever it needs them, and
+   * the region is reused as-is.
+   */
+  if(lf_region_sub_used(region, units) && lf_region_try_claim_all(region)) {
+
+    PRINTD("Region %p is empty, releasing its memory\n", region);
+    slice_set_usage(slice, SLICE_USAGE_BLANK);
+    store_fence();
+
+    for(unsigned int i = 0; i < LF_REGION_BITMAP_SIZE; i++)
+      region->r_bitmap[i].value = 0;
+
+  }
+
+}
+
+
+internal void lf_region_set_owner(lf_region_t* const region, void* const ptr,
+				  const unsigned int units,
+				  void* const owner) {
+
+  INVARIANT(region != NULL);
+  INVARIANT(region->r_slice != NULL);
+
+  const unsigned int index = lf_region_index(region, ptr);
+
+  for(unsigned int i = 0; i < units; i++)
+    region->r_owner[index + i] = owner;
+
+}
+
+
+internal void* lf_region_owner(const void* const ptr) {
+
+  const slice_t* const slice = slice_lookup(ptr);
+  void* out = NULL;
+
+  /* Other malloc slices may have their own private data. */
+  if(NULL != slice && NULL != slice->s_data &&
+     (lf_region_t*)slice->s_data >= lf_regions &&
+     (lf_region_t*)slice->s_data < lf_regions + SLICE_TAB_SIZE) {
+
+    lf_region_t* const region = slice->s_data;
+
+    out = region->r_owner[lf_region_index(region, ptr)];
+
+  }
+
+  return out;
+
+}
@@ -12,11 +12,17 @@
 
 #include "arch/lf_malloc_data.c"
 #include "arch/bitops.c"
+#include "arch/gc_barrier.c"
+#include "arch/prefetch.c"
+#include "arch/bulk_copy.c"
 #include "malloc/lf_block_queue.c"
+#include "malloc/lf_buddy.c"
+#include "malloc/lf_region.c"
 #include "malloc/lf_malloc.c"
 #include "gc/gc_desc.c"
+#include "gc/gc_card.c"
 #include "gc/gc_alloc.c"
-#include "gc/lf_object_queue.c"
+#include "gc/gc_deque.c"
 #include "gc/gc_thread.c"
 
 const char* const mm_name = "Parallel Lock-Free Generational";
@@ -26,18 +32,22 @@ unsigned int mm_request(mm_stat_t* const restrict mm_stat,
 
   PRINTD("Reserving space for memory manager\n");
 
+  const unsigned int slice_request_size =
+    slice_request(cc_stat->cc_num_executors);
   const unsigned int malloc_request =
     mm_malloc_request(cc_stat->cc_num_executors);
   const unsigned int gc_request =
     gc_thread_request(cc_stat->cc_num_executors,
-		      mm_stat->mm_num_generations);
+		      mm_stat->mm_num_generations,
+		      cc_stat->cc_max_threads);
 
+  PRINTD("  Reserving 0x%x bytes for slice allocator.\n", slice_request_size);
   PRINTD("  Reserving 0x%x bytes for malloc system.\n", malloc_request);
   PRINTD("  Reserving 0x%x bytes for GC system.\n", gc_request);
   PRINTD("Memory manager total static size is 0x%x bytes.\n",
-	 malloc_request + gc_request);
+	 slice_request_size + malloc_request + gc_request);
 
-  return malloc_request + gc_request;
+  return slice_request_size + malloc_request + gc_request;
 
 }
 
@@ -45,7 +55,10 @@ void* mm_start(const mm_stat_t* const mm_stat,
 	       const cc_stat_t* const cc_stat,
 	       const unsigned int size) {
 
+  /* Explicit huge pages can only be mapped in whole pages. */
   const unsigned int align_request =
+    MM_HUGE_PAGES_EXPLICIT == mm_huge_pages ?
+    ((size - 1) & ~(HUGE_PAGE_SIZE - 1)) + HUGE_PAGE_SIZE :
     slice_min_size > size ? slice_min_size : size;
   const slice_t* static_data;
   void* out = NULL;
@@ -53,19 +66,24 @@ void* mm_start(const mm_stat_t* const mm_stat,
   slice_init(mm_stat->mm_total_limit, mm_stat->mm_slice_size,
 	     mm_stat->mm_malloc_limit, mm_stat->mm_gc_limit);
   PRINTD("Allocating static data slice\n");
-  static_data = slice_alloc(SLICE_TYPE_STATIC, SLICE_PROT_RWX, align_request);
+  static_data = slice_alloc(SLICE_TYPE_STATIC, SLICE_PROT_RWX, align_request,
+			    SLICE_EXEC_NONE);
   PRINTD("Static data starts at %p\n", static_data->s_ptr);
 
   if(NULL != static_data) {
 
     void* const mem = static_data->s_ptr;
-    void* const ptr = mm_malloc_init(cc_stat->cc_num_executors, mem);
+    void* const malloc_mem =
+      slice_executor_init(cc_stat->cc_num_executors, mem);
+    void* const ptr = mm_malloc_init(cc_stat->cc_num_executors, malloc_mem);
 
     out = gc_thread_init(cc_stat->cc_num_executors,
-			 mm_stat->mm_num_generations, ptr);
+			 mm_stat->mm_num_generations,
+			 cc_stat->cc_max_threads, ptr);
 
     PRINTD("Memory system memory:\n");
-    PRINTD("\tmalloc system at 0x%p\n", mem);
+    PRINTD("\tslice allocator at 0x%p\n", mem);
+    PRINTD("\tmalloc system at 0x%p\n", malloc_mem);
     PRINTD("\tGC system at 0x%p\n", ptr);
     PRINTD("\tend at 0x%p\n", out);
 
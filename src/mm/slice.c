@@ -9,9 +9,48 @@
 
 #define SLICE_TAB_BITMAP_SIZE SLICE_TAB_SIZE / bits
 
+/* The free list head holds the index of the first free entry in the
+ * low word, and a tag in the high word which changes on every update.
+ * SLICE_TAB_SIZE stands for the empty list.
+ */
+#define SLICE_LIST_NONE SLICE_TAB_SIZE
+#define SLICE_LIST_TAG_SHIFT 32
+
+/* The page map holds, for every page in the address space, one more
+ * than the index of the slice containing it, or zero.  It is never
+ * written except for pages belonging to slices, so the OS only ever
+ * backs the parts of it covering memory actually in use.
+ */
+#define SLICE_MAP_SIZE (1 << (BITS - PAGE_SHIFT))
+
+#if (SLICE_TAB_SIZE >= 0x10000)
+#error "Slice table too large for the page map"
+#endif
+
 static slice_t slice_tab[SLICE_TAB_SIZE];
 
-static volatile atomic_ptr_t slice_free_list;
+static volatile unsigned short slice_map[SLICE_MAP_SIZE];
+
+/* Each executor's quota holds space already reserved from the global
+ * counters, for each type of slice.  Only the owning executor touches
+ * its quota.
+ */
+typedef union {
+
+  unsigned int _sq_quota[SLICE_TYPE_STATIC + 1];
+  cache_line_t _;
+
+} slice_quota_t;
+
+#define sq_quota _sq_quota
+
+/* The size of quota batches, in units of the default slice size. */
+#define SLICE_QUOTA_SLICES 4
+
+static slice_quota_t* slice_quotas;
+static unsigned int slice_quota_batch;
+
+static volatile atomic_uint64_t slice_free_list;
 static volatile atomic_uint_t total_size;
 static volatile atomic_uint_t malloc_size;
 static volatile atomic_uint_t gc_size;
@@ -21,6 +60,7 @@ static unsigned int malloc_limit;
 static unsigned int gc_limit;
 const unsigned int slice_max_size = SLICE_MAX_SIZE;
 const unsigned int slice_min_size = SLICE_MIN_SIZE;
+unsigned int mm_huge_pages = MM_HUGE_PAGES_NONE;
 
 internal void slice_init(const unsigned int max,
 			 const unsigned int defaultsize,
@@ -32,6 +72,8 @@ internal void slice_init(const unsigned int max,
   malloc_limit = malloc_max;
   gc_limit = gc_max;
   total_size.value = 0;
+  malloc_size.value = 0;
+  gc_size.value = 0;
 
   PRINTD("Initializing slice allocator with maximum size %u,\n"
 	 "    default slice size %u,\n"
@@ -43,21 +85,57 @@ internal void slice_init(const unsigned int max,
     slice_tab[i].s_next = slice_tab + i + 1;
 
   slice_tab[SLICE_TAB_SIZE - 1].s_next = NULL;
-  slice_free_list.value = slice_tab;
+  slice_free_list.value = 0;
+
+}
+
+
+static inline pure uint64_t slice_list_head(const slice_t* const slice,
+					    const uint64_t tag) {
+
+  const uint64_t index = NULL != slice ? slice - slice_tab : SLICE_LIST_NONE;
+
+  return (tag << SLICE_LIST_TAG_SHIFT) | index;
+
+}
+
+
+static inline pure slice_t* slice_list_first(const uint64_t head) {
+
+  const unsigned int index = head & 0xffffffff;
+
+  return SLICE_LIST_NONE != index ? slice_tab + index : NULL;
+
+}
+
+
+static inline pure uint64_t slice_list_tag(const uint64_t head) {
+
+  return head >> SLICE_LIST_TAG_SHIFT;
 
 }
 
 
 static inline slice_opt_t slice_entry_try_alloc(void) {
 
-  slice_t* const oldlist = slice_free_list.value;
+  const uint64_t oldhead = atomic_read_uint64(&slice_free_list);
+  slice_t* const oldlist = slice_list_first(oldhead);
   slice_opt_t out = { .o_value = oldlist, .o_valid = true };
 
   PRINTD("Trying to pop one from the slice entry list\n");
 
-  if(NULL != oldlist)
-    out.o_valid = atomic_compare_and_set_ptr(oldlist, oldlist->s_next,
-					     &slice_free_list);
+  /* Entries live in a static table, so reading s_next is safe even if
+   * oldlist was taken in the meantime; the tag catches that.
+   */
+  if(NULL != oldlist) {
+
+    const uint64_t newhead =
+      slice_list_head(oldlist->s_next, slice_list_tag(oldhead) + 1);
+
+    out.o_valid = atomic_compare_and_set_uint64(oldhead, newhead,
+						&slice_free_list);
+
+  }
 
   return out;
 
@@ -84,6 +162,8 @@ static inline bool slice_try_release_total_space(const unsigned int size) {
 
   const unsigned int oldspace = total_size.value;
 
+  INVARIANT(oldspace >= size);
+
   return atomic_compare_and_set_uint(oldspace, oldspace - size, &total_size);
 
 }
@@ -101,7 +181,6 @@ static inline void slice_release_total_space(const unsigned int size) {
 
 static inline bool slice_reserve_total_space(const unsigned int size) {
 
-  unsigned int failures;
   bool out = false;
 
   PRINTD("Trying to reserve %u bytes of total space\n", size);
@@ -110,7 +189,7 @@ static inline bool slice_reserve_total_space(const unsigned int size) {
 
     const unsigned int oldspace = total_size.value;
 
-    if(oldspace + size >= total_limit) {
+    if(size <= total_limit - oldspace) {
 
       if(out = atomic_compare_and_set_uint(oldspace, oldspace + size,
 					   &total_size)) {
@@ -125,7 +204,7 @@ static inline bool slice_reserve_total_space(const unsigned int size) {
 
     }
 
-    else if(++failures >= 3) {
+    else {
 
       PRINTD("Failed to reserve total space.  Unavailable.\n");
       break;
@@ -143,6 +222,8 @@ static inline bool slice_try_release_gc_space(const unsigned int size) {
 
   const unsigned int oldspace = gc_size.value;
 
+  INVARIANT(oldspace >= size);
+
   return atomic_compare_and_set_uint(oldspace, oldspace - size, &gc_size);
 
 }
@@ -152,7 +233,7 @@ static inline void slice_release_gc_space(const unsigned int size) {
 
   PRINTD("Releasing %u bytes of gc space\n", size);
 
-  for(unsigned int i = 1; !slice_try_release_total_space(size); i++)
+  for(unsigned int i = 1; !slice_try_release_gc_space(size); i++)
     backoff_delay(i);
 
 }
@@ -168,7 +249,7 @@ static inline bool slice_reserve_gc_space(const unsigned int size) {
 
     const unsigned int oldspace = gc_size.value;
 
-    if(oldspace + size >= gc_limit) {
+    if(size <= gc_limit - oldspace) {
 
       if(out = atomic_compare_and_set_uint(oldspace, oldspace + size,
 					   &gc_size)) {
@@ -201,6 +282,8 @@ static inline bool slice_try_release_malloc_space(const unsigned int size) {
 
   const unsigned int oldspace = malloc_size.value;
 
+  INVARIANT(oldspace >= size);
+
   return atomic_compare_and_set_uint(oldspace, oldspace - size, &malloc_size);
 
 }
@@ -210,7 +293,7 @@ static inline void slice_release_malloc_space(const unsigned int size) {
 
   PRINTD("Releasing %u bytes of malloc space\n", size);
 
-  for(unsigned int i = 1; !slice_try_release_total_space(size); i++)
+  for(unsigned int i = 1; !slice_try_release_malloc_space(size); i++)
     backoff_delay(i);
 
 }
@@ -226,7 +309,7 @@ static inline bool slice_reserve_malloc_space(const unsigned int size) {
 
     const unsigned int oldspace = malloc_size.value;
 
-    if(oldspace + size >= malloc_limit) {
+    if(size <= malloc_limit - oldspace) {
 
       if(out = atomic_compare_and_set_uint(oldspace, oldspace + size,
 					   &malloc_size)) {
@@ -255,8 +338,8 @@ static inline bool slice_reserve_malloc_space(const unsigned int size) {
 }
 
 
-static inline bool slice_reserve_space(const unsigned int size,
-				       const slice_type_t type) {
+static inline bool slice_reserve_global_space(const unsigned int size,
+					      const slice_type_t type) {
 
   bool out = false;
 
@@ -299,8 +382,8 @@ static inline bool slice_reserve_space(const unsigned int size,
 }
 
 
-static inline void slice_release_space(const unsigned int size,
-				       const slice_type_t type) {
+static inline void slice_release_global_space(const unsigned int size,
+					      const slice_type_t type) {
 
   PRINTD("Releasing %u bytes of space for type %u\n", size, type);
 
@@ -327,37 +410,238 @@ static inline void slice_release_space(const unsigned int size,
 }
 
 
+/* Reserve space, drawing on the executor's quota if possible.  When
+ * the quota runs short, enough is taken from the global counters to
+ * cover the request and leave a full batch behind.  If that much
+ * isn't available, fall back to taking just what is needed.
+ */
+static inline bool slice_reserve_space(const unsigned int size,
+				       const slice_type_t type,
+				       const unsigned int exec) {
+
+  bool out;
+
+  if(SLICE_EXEC_NONE != exec && NULL != slice_quotas) {
+
+    unsigned int* const quota = slice_quotas[exec].sq_quota + type;
+
+    if(size <= *quota) {
+
+      PRINTD("Executor %u reserving %u bytes from quota\n", exec, size);
+      *quota -= size;
+      out = true;
+
+    }
+
+    else if(slice_reserve_global_space(size - *quota + slice_quota_batch,
+				       type)) {
+
+      PRINTD("Executor %u refilled quota for type %u\n", exec, type);
+      *quota = slice_quota_batch;
+      out = true;
+
+    }
+
+    else if((out = slice_reserve_global_space(size - *quota, type)))
+      *quota = 0;
+
+  }
+
+  else
+    out = slice_reserve_global_space(size, type);
+
+  return out;
+
+}
+
+
+/* Release space to the executor's quota.  Anything beyond two
+ * batches is flushed back to the global counters, which bounds the
+ * space any one executor can hold.
+ */
+static inline void slice_release_space(const unsigned int size,
+				       const slice_type_t type,
+				       const unsigned int exec) {
+
+  if(SLICE_EXEC_NONE != exec && NULL != slice_quotas) {
+
+    unsigned int* const quota = slice_quotas[exec].sq_quota + type;
+
+    *quota += size;
+
+    if(*quota > slice_quota_batch * 2) {
+
+      PRINTD("Executor %u flushing quota for type %u\n", exec, type);
+      slice_release_global_space(*quota - slice_quota_batch, type);
+      *quota = slice_quota_batch;
+
+    }
+
+  }
+
+  else
+    slice_release_global_space(size, type);
+
+}
+
+
+internal unsigned int slice_request(const unsigned int execs) {
+
+  const unsigned int quotas_size = execs * sizeof(slice_quota_t);
+
+  PRINTD("Reserving 0x%x bytes for slice quotas\n", quotas_size);
+
+  return ((quotas_size - 1) & ~(CACHE_LINE_SIZE - 1)) + CACHE_LINE_SIZE;
+
+}
+
+
+internal void* slice_executor_init(const unsigned int execs,
+				   void* const mem) {
+
+  const unsigned int quotas_size = execs * sizeof(slice_quota_t);
+  const unsigned int aligned_quotas_size =
+    ((quotas_size - 1) & ~(CACHE_LINE_SIZE - 1)) + CACHE_LINE_SIZE;
+  const unsigned int batch =
+    min(slice_size * SLICE_QUOTA_SLICES, total_limit / (execs * 4));
+  slice_quota_t* const quotas = mem;
+
+  PRINTD("Initializing slice quotas for %u executors at %p\n", execs, mem);
+
+  for(unsigned int i = 0; i < execs; i++)
+    for(unsigned int j = 0; j < SLICE_TYPE_STATIC + 1; j++)
+      quotas[i].sq_quota[j] = 0;
+
+  /* Batching is pointless if the batch is less than a page. */
+  if(PAGE_SIZE <= batch) {
+
+    slice_quota_batch = batch & ~(PAGE_SIZE - 1);
+    PRINTD("Slice quota batch size is 0x%x\n", slice_quota_batch);
+    store_fence();
+    slice_quotas = quotas;
+
+  }
+
+  return (char*)mem + aligned_quotas_size;
+
+}
+
+
 static inline bool slice_entry_try_free(slice_t* const slice) {
 
-  slice_t* const oldlist = slice_free_list.value;
+  const uint64_t oldhead = atomic_read_uint64(&slice_free_list);
+  const uint64_t newhead =
+    slice_list_head(slice, slice_list_tag(oldhead) + 1);
 
-  slice->s_next = oldlist;
+  slice->s_next = slice_list_first(oldhead);
+  store_fence();
 
-  return atomic_compare_and_set_ptr(oldlist, slice, &slice_free_list);
+  return atomic_compare_and_set_uint64(oldhead, newhead, &slice_free_list);
 
 }
 
 
-internal slice_t* restrict slice_alloc(const slice_type_t type,
-				       const slice_prot_t prot,
-				       const unsigned int size) {
+/* Point every page of a range at a slice, or at nothing if slice is
+ * NULL.
+ */
+static inline void slice_map_set(void* const ptr, const unsigned int size,
+				 const slice_t* const slice) {
+
+  const unsigned int first = (unsigned int)ptr >> PAGE_SHIFT;
+  const unsigned int last = first + (size >> PAGE_SHIFT);
+  const unsigned short value = NULL != slice ? (slice - slice_tab) + 1 : 0;
+
+  PRINTD("Setting page map for %u bytes at %p to %p\n", size, ptr, slice);
+
+  for(unsigned int i = first; i < last; i++)
+    slice_map[i] = value;
+
+  store_fence();
+
+}
+
+
+internal slice_t* slice_lookup(const void* const ptr) {
+
+  const unsigned int index = slice_map[(unsigned int)ptr >> PAGE_SHIFT];
+
+  return 0 != index ? slice_tab + (index - 1) : NULL;
+
+}
+
+
+/* Map memory for a slice, using huge pages as mm_huge_pages directs.
+ * GC and malloc slices large enough to hold a huge page are aligned
+ * to one, so the kernel can back them with huge pages.
+ */
+static inline void* slice_mem_map(const slice_type_t type,
+				  const slice_prot_t prot,
+				  const unsigned int size,
+				  const unsigned int align) {
+
+  void* out = NULL;
+
+  if(MM_HUGE_PAGES_NONE != mm_huge_pages && HUGE_PAGE_SIZE <= size &&
+     (SLICE_TYPE_GC == type || SLICE_TYPE_MALLOC == type)) {
+
+    if(NULL != (out = os_mem_map_aligned(size, max(align, HUGE_PAGE_SIZE),
+					 prot)))
+      os_mem_hugepage(out, size);
+
+  }
+
+  else {
+
+    /* Fall back to normal pages if there are no explicit huge pages. */
+    if(MM_HUGE_PAGES_EXPLICIT == mm_huge_pages &&
+       SLICE_TYPE_STATIC == type && 0 == (size & (HUGE_PAGE_SIZE - 1))) {
+
+      out = os_mem_map_huge(size, prot);
+      PRINTD("Static slice at %p %s explicit huge pages\n", out,
+	     NULL != out ? "uses" : "could not get");
+
+    }
+
+    if(NULL == out && PAGE_SIZE < align)
+      out = os_mem_map_aligned(size, align, prot);
+
+    else if(NULL == out)
+      out = os_mem_map(size, prot);
+
+  }
+
+  return out;
+
+}
+
+
+internal slice_t* restrict slice_alloc_aligned(const slice_type_t type,
+					       const slice_prot_t prot,
+					       const unsigned int size,
+					       const unsigned int align,
+					       const unsigned int exec) {
 
   INVARIANT(size <= slice_max_size && size >= slice_min_size);
   INVARIANT(type == SLICE_TYPE_GC || type == SLICE_TYPE_MALLOC ||
 	    type == SLICE_TYPE_STATIC || type == SLICE_TYPE_CUSTOM);
+  INVARIANT(align >= PAGE_SIZE && (align & (align - 1)) == 0);
 
-  slice_t* out;
+  const bool reserved = slice_reserve_space(size, type, exec);
+  slice_t* out = NULL;
 
-  PRINTD("Allocating slice, size %u, type %u, protection %u\n",
-	 size, type, prot);
+  PRINTD("Allocating slice, size %u, alignment 0x%x, type %u, "
+	 "protection %u\n", size, align, type, prot);
 
-  if(slice_reserve_space(size, type) &&
+  if(reserved &&
      NULL != (out = slice_entry_alloc()) &&
-     NULL != (out->s_ptr = os_mem_map(size, prot))) {
+     NULL != (out->s_ptr = slice_mem_map(type, prot, size, align))) {
 
+    slice_map_set(out->s_ptr, size, out);
     out->s_type = type;
+    out->s_prot = prot;
     out->s_usage = SLICE_USAGE_BLANK;
     out->s_size = size;
+    out->s_data = NULL;
     PRINTD("Slice %p allocated, memory at %p\n", out, out->s_ptr);
 
   }
@@ -366,6 +650,9 @@ internal slice_t* restrict slice_alloc(const slice_type_t type,
 
     PRINTD("Slice allocation failed\n");
 
+    if(reserved)
+      slice_release_space(size, type, exec);
+
     if(NULL != out)
       for(unsigned int i = 1; !slice_entry_try_free(out); i++)
 	backoff_delay(i);
@@ -379,13 +666,26 @@ internal slice_t* restrict slice_alloc(const slice_type_t type,
 }
 
 
-internal void slice_free(slice_t* const restrict slice) {
+internal slice_t* restrict slice_alloc(const slice_type_t type,
+				       const slice_prot_t prot,
+				       const unsigned int size,
+				       const unsigned int exec) {
+
+  return slice_alloc_aligned(type, prot, size, PAGE_SIZE, exec);
+
+}
+
+
+internal void slice_free(slice_t* const restrict slice,
+			 const unsigned int exec) {
 
   INVARIANT(slice != NULL);
   INVARIANT(slice->s_ptr != NULL);
 
   PRINTD("Freeing slice %p\n", slice);
+  slice_map_set(slice->s_ptr, slice->s_size, NULL);
   os_mem_unmap(slice->s_ptr, slice->s_size);
+  slice_release_space(slice->s_size, slice->s_type, exec);
 
   for(unsigned int i = 1; !slice_entry_try_free(slice); i++)
     backoff_delay(i);
@@ -393,6 +693,108 @@ internal void slice_free(slice_t* const restrict slice) {
 }
 
 
+/* The OS may move the mapping, which gives back all of the old pages,
+ * or give back the end of it.  Those pages may be handed to another
+ * slice as soon as they are given back, so none of them can still
+ * point at this slice by then.  The page map is cleared first, and
+ * put back if the resize fails.
+ */
+static inline bool slice_mem_resize(slice_t* const restrict slice,
+				    const unsigned int size) {
+
+  void* ptr;
+
+  slice_map_set(slice->s_ptr, slice->s_size, NULL);
+
+  if(NULL != (ptr = os_mem_resize(slice->s_ptr, slice->s_size, size,
+				  slice->s_prot))) {
+
+    slice_map_set(ptr, size, slice);
+    slice->s_ptr = ptr;
+    slice->s_size = size;
+
+  }
+
+  else
+    slice_map_set(slice->s_ptr, slice->s_size, slice);
+
+  return NULL != ptr;
+
+}
+
+
+internal bool slice_resize(slice_t* const restrict slice,
+			   const unsigned int size,
+			   const unsigned int exec) {
+
+  INVARIANT(slice != NULL);
+  INVARIANT(slice->s_ptr != NULL);
+  INVARIANT(size <= slice_max_size && size >= slice_min_size);
+
+  const unsigned int oldsize = slice->s_size;
+  bool out = false;
+
+  PRINTD("Resizing slice %p from %u to %u\n", slice, oldsize, size);
+
+  if(size == oldsize)
+    out = true;
+
+  else if(size < oldsize) {
+
+    if(slice_mem_resize(slice, size)) {
+
+      slice_release_space(oldsize - size, slice->s_type, exec);
+      out = true;
+
+    }
+
+  }
+
+  else if(slice_reserve_space(size - oldsize, slice->s_type, exec)) {
+
+    if(!(out = slice_mem_resize(slice, size)))
+      slice_release_space(size - oldsize, slice->s_type, exec);
+
+  }
+
+  PRINTD("Slice %p %s resized, memory at %p\n", slice,
+	 out ? "was" : "was not", slice->s_ptr);
+
+  return out;
+
+}
+
+
+static inline void slice_mem_set_usage(void* const restrict ptr,
+				       const unsigned int size,
+				       const slice_usage_t usage) {
+
+  switch(usage) {
+
+  case SLICE_USAGE_USED:
+
+    os_mem_willneed(ptr, size);
+    break;
+
+  case SLICE_USAGE_UNUSED:
+
+    os_mem_dontneed(ptr, size);
+    break;
+
+  case SLICE_USAGE_BLANK:
+
+    os_mem_release(ptr, size);
+    break;
+
+  default:
+
+    break;
+
+  }
+
+}
+
+
 internal void slice_set_usage(slice_t* const restrict slice, 
 			      const slice_usage_t usage) {
 
@@ -406,31 +808,27 @@ internal void slice_set_usage(slice_t* const restrict slice,
   if(slice->s_usage != usage) {
 
     slice->s_usage = usage;
+    slice_mem_set_usage(slice->s_ptr, slice->s_size, usage);
 
-    switch(usage) {
-
-    case SLICE_USAGE_USED:
-
-      os_mem_willneed(slice->s_ptr, slice->s_size);
-      break;
-
-    case SLICE_USAGE_UNUSED:
+  }
 
-      os_mem_dontneed(slice->s_ptr, slice->s_size);
-      break;
+}
 
-    case SLICE_USAGE_BLANK:
 
-      os_mem_release(slice->s_ptr, slice->s_size);
-      break;
+internal void slice_range_set_usage(const slice_t* const restrict slice,
+				    void* const restrict ptr,
+				    const unsigned int size,
+				    const slice_usage_t usage) {
 
-    default:
-
-      break;
-
-    }
+  INVARIANT(slice != NULL);
+  INVARIANT((char*)ptr >= (char*)slice->s_ptr &&
+	    (char*)ptr + size <= (char*)slice->s_ptr + slice->s_size);
+  INVARIANT(usage == SLICE_USAGE_USED || usage == SLICE_USAGE_UNUSED ||
+	    usage == SLICE_USAGE_BLANK);
 
-  }
+  PRINTD("Setting usage of %u bytes at %p in slice %p to %u\n",
+	 size, ptr, slice, usage);
+  slice_mem_set_usage(ptr, size, usage);
 
 }
 
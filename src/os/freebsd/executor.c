@@ -96,7 +96,8 @@ internal void executor_start(unsigned int num, unsigned int stack_size,
   const unsigned int total_space = num * one_executor;
   const unsigned int slice_size = total_space < slice_min_size;
   slice_t* const executors_slice =
-    slice_alloc(SLICE_TYPE_STATIC, SLICE_PROT_RWX, slice_size);
+    slice_alloc(SLICE_TYPE_STATIC, SLICE_PROT_RWX, slice_size,
+		SLICE_EXEC_NONE);
    
   if(NULL != executors_slice) {
 
@@ -36,6 +36,77 @@ internal void* restrict os_mem_map(unsigned int size, slice_prot_t prot) {
 }
 
 
+/*!
+ * This function requests a block of memory backed by explicitly
+ * reserved huge pages.  This fails if the system doesn't support
+ * them, or none are available.
+ *
+ * \brief Request a block of memory backed by huge pages.
+ * \arg size The size of the block.  This must be a multiple of
+ * HUGE_PAGE_SIZE.
+ * \arg prot The protections of the block.
+ * \return The block, or else NULL.
+ */
+internal void* restrict os_mem_map_huge(unsigned int size, slice_prot_t prot) {
+
+  void* restrict out = (void*)-1;
+
+#ifdef MAP_HUGETLB
+  out = mmap(NULL, size, prot_map[prot],
+	     MAP_PRIVATE | MAP_ANON | MAP_HUGETLB, -1, 0);
+
+  PRINTD("mmap(NULL, %u, 0x%x, 0x%x, -1, 0) = %p\n", size, prot_map[prot],
+	 MAP_PRIVATE | MAP_ANON | MAP_HUGETLB, out);
+#endif
+
+  return (void*)-1 != out ? out : NULL;
+
+}
+
+
+/*!
+ * This function requests a block of memory from the operating system
+ * like os_mem_map, but aligned to a given boundary.  This is done by
+ * mapping a larger block and unmapping the excess at either end.
+ *
+ * \brief Request an aligned block of memory.
+ * \arg size The size of the block.
+ * \arg align The alignment of the block.  This must be a power of
+ * two, and a multiple of the page size.
+ * \arg prot The protections of the block.
+ * \return The block, or else NULL.
+ */
+internal void* restrict os_mem_map_aligned(unsigned int size,
+					   unsigned int align,
+					   slice_prot_t prot) {
+
+  const unsigned int mapsize = size + align - PAGE_SIZE;
+  char* const ptr = os_mem_map(mapsize, prot);
+  char* out = NULL;
+
+  if(NULL != ptr) {
+
+    const unsigned int lead =
+      (((unsigned int)ptr + align - 1) & ~(align - 1)) - (unsigned int)ptr;
+    const unsigned int tail = mapsize - (lead + size);
+
+    out = ptr + lead;
+
+    if(0 != lead)
+      munmap(ptr, lead);
+
+    if(0 != tail)
+      munmap(out + size, tail);
+
+    PRINTD("Aligned mapping of %u bytes to 0x%x at %p\n", size, align, out);
+
+  }
+
+  return out;
+
+}
+
+
 /*!
  * This function unmaps a block of memory, removing it entirely from
  * the address space and releasing its memory.
@@ -69,6 +140,75 @@ internal void os_mem_remap(void* restrict ptr, unsigned int size,
 }
 
 
+/*!
+ * This function changes the size of a mapped block of memory,
+ * preserving its contents.  Where the system supports it (mremap),
+ * the block may be moved to a new address to satisfy the request,
+ * which avoids copying the contents.  Otherwise, the block is only
+ * grown if the address range immediately after it is free.
+ *
+ * \brief Resize a block of memory.
+ * \arg ptr Pointer to the block.
+ * \arg oldsize The current size of the block.
+ * \arg newsize The desired size of the block.
+ * \arg prot The protections of the block.
+ * \return The (possibly moved) block, or NULL if it could not be
+ * resized, in which case the original block is unchanged.
+ */
+internal void* restrict os_mem_resize(void* restrict ptr,
+				      unsigned int oldsize,
+				      unsigned int newsize,
+				      slice_prot_t prot) {
+
+  void* out;
+
+#ifdef MREMAP_MAYMOVE
+  out = mremap(ptr, oldsize, newsize, MREMAP_MAYMOVE);
+
+  PRINTD("mremap(%p, %u, %u, MREMAP_MAYMOVE) = %p\n", ptr,
+	 oldsize, newsize, out);
+
+  if((void*)-1 == out)
+    out = NULL;
+#else
+  if(newsize <= oldsize) {
+
+    if(newsize < oldsize)
+      munmap((char*)ptr + newsize, oldsize - newsize);
+
+    out = ptr;
+
+  }
+
+  else {
+
+    void* const end = (char*)ptr + oldsize;
+    void* const tail = mmap(end, newsize - oldsize, prot_map[prot],
+			    MAP_PRIVATE | MAP_ANON, -1, 0);
+
+    PRINTD("mmap(%p, %u, 0x%x, 0x%x, -1, 0) = %p\n", end,
+	   newsize - oldsize, prot_map[prot], MAP_PRIVATE | MAP_ANON, tail);
+
+    if(end == tail)
+      out = ptr;
+
+    else {
+
+      if((void*)-1 != tail)
+	munmap(tail, newsize - oldsize);
+
+      out = NULL;
+
+    }
+
+  }
+#endif
+
+  return out;
+
+}
+
+
 /*!
  * This function informs the kernel that the requested block is
  * immanently needed.
@@ -87,6 +227,27 @@ internal void os_mem_willneed(void* restrict ptr, unsigned int size) {
 }
 
 
+/*!
+ * This function asks the kernel to back a block with transparent huge
+ * pages wherever possible.  The block should be aligned to
+ * HUGE_PAGE_SIZE.
+ *
+ * Note: on systems without transparent huge pages, this does nothing
+ * at all.
+ *
+ * \brief Request huge pages for a block.
+ * \arg ptr Pointer to the block.
+ * \arg size Size of the block.
+ */
+internal void os_mem_hugepage(void* restrict ptr, unsigned int size) {
+
+#ifdef MADV_HUGEPAGE
+  madvise(ptr, size, MADV_HUGEPAGE);
+#endif
+
+}
+
+
 /*!
  * This function informs the kernel that the requested block is not
  * needed in the immediate future.  This preserves the contents of the
@@ -4,10 +4,9 @@
 #include "cc.h"
 #include "program.h"
 #include "atomic.h"
+#include "mm/gc_alloc.h"
 #include "../src/arch/atomic.c"
 
-#define MIN_SLICE_POWER 14
-#define MAX_SLICE_POWER BITS - 1
 #define THREADS 2
 
 typedef struct thread_closure_t {
@@ -52,6 +51,8 @@ const unsigned int default_gc_gens = 3;
 const unsigned int default_gc_array_gen = 2;
 const unsigned int gc_global_ptr_count = 2;
 gc_double_ptr_t* const gc_global_ptrs[0] = { entry, list };
+const gc_framedesc_t gc_frame_descs[0] = {};
+const unsigned int gc_frame_desc_count = 0;
 
 
 static unsigned int get_random(thread_closure_t* const closure) {
@@ -70,41 +71,6 @@ static unsigned int get_random(thread_closure_t* const closure) {
 }
 
 
-static inline unsigned int get_target_size(const unsigned int min) {
-
-  static const unsigned int max_size = 0x1 << MAX_SLICE_POWER;
-  static const unsigned int min_size = 0x1 << MIN_SLICE_POWER;
-  const unsigned int default_size = min * 8;
-  unsigned int out;
-
-  if(max_size / 8 > min) {
-
-    if(min_size < default_size)
-      out = default_size;
-
-    else
-      out = min_size;
-
-  }
-
-  else
-    out = max_size;
-
-  return out;
-
-}
-
-
-static void refresh_alloc(thread_closure_t* const closure,
-			  const unsigned int size,
-			  const unsigned int gen) {
-
-  do_gc_allocator_refresh(closure->tc_allocators, size,
-			  size, gen, closure->tc_exec);
-
-}
-
-
 static void run_gc(thread_closure_t* const closure) {
 
 }
@@ -117,31 +83,6 @@ static inline void safe_point(thread_closure_t* const closure) {
 }
 
 
-static inline void* gc_allocator_alloc(thread_closure_t* const closure,
-				       const unsigned int size,
-				       const unsigned int gen) {
-
-  const unsigned int target = get_target_size(size);
-  char* const newptr = (char*)(allocator[0]) + size;
-  void* out = NULL;
-
-  /* If there is enough memory there already, just allocate it. */
-  if(newptr <= (char*)allocator[1]) {
-
-    out = allocator[0];
-    allocator[0] = newptr;
-
-  }
-
-  /* Otherwise try to get more. */
-  else
-    out = refresh_alloc(closure, size, gen);
-
-  return out;
-
-}
-
-
 static inline void write_barrier(thread_closure_t* const closure,
 				 void* const header,
 				 const unsigned int offset) {
@@ -161,7 +102,9 @@ static inline void write_barrier(thread_closure_t* const closure,
     *header_ptr = header;
     *offset_ptr = offset;
 
-    if(GC_WRITE_LOG_LENGTH == *index)
+    /* The log grows between collections, so go by its current limit */
+    if(*thread_mbox_write_log_limit(closure->tc_thread.t_mbox) ==
+       closure->tc_log_offset)
       run_gc(closure);
 
   }
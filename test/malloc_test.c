@@ -19,6 +19,8 @@ const unsigned int default_gc_gens = 3;
 const unsigned int default_gc_array_gen = 2;
 gc_double_ptr_t* const gc_global_ptrs[0] = {};
 const unsigned int gc_global_ptr_count = 0;
+const gc_framedesc_t gc_frame_descs[0] = {};
+const unsigned int gc_frame_desc_count = 0;
 
 struct block_t {
 
@@ -166,6 +168,76 @@ static struct block_t* create(unsigned int id) {
 }
 
 
+/* Sizes to realloc one block through, in order.  They go through the
+ * small size classes (up to 0x4000), the buddy allocator (up to
+ * 0x400000), and whole slices, growing and then shrinking, with some
+ * changes that should be done in place.
+ */
+static const unsigned int realloc_sizes[] = {
+
+  0x40, 0x48, 0x1000, 0x3000, 0x10000, 0x18000, 0x300000, 0x600000,
+  0x900000, 0x500000, 0x200000, 0x1f0000, 0x8000, 0x100, 0x10
+
+};
+
+#define REALLOC_STEPS (sizeof(realloc_sizes) / sizeof(unsigned int))
+
+
+static unsigned char realloc_content(unsigned int index, unsigned int step) {
+
+  return (index ^ (index >> 8) ^ (index >> 16)) + (step * 0x35);
+
+}
+
+
+static void check_realloc(void) {
+
+  unsigned char* block = NULL;
+  unsigned int size = 0;
+
+  for(unsigned int i = 0; i < REALLOC_STEPS; i++) {
+
+    const unsigned int new_size = realloc_sizes[i];
+
+    PRINTD("Reallocating block %p from size %x to %x\n",
+	   block, size, new_size);
+
+    if(NULL == (block = realloc(block, new_size))) {
+
+      fprintf(stderr, "Reallocating to size %x failed\n", new_size);
+      abort();
+
+    }
+
+    /* Whatever fits must have been kept. */
+    for(unsigned int j = 0; j < size && j < new_size; j++)
+      if(block[j] != realloc_content(j, i - 1)) {
+
+	fprintf(stderr, "Block %p corrupted at index %x after realloc "
+		"from size %x to %x: content was originally %x, but was %x\n",
+		block, j, size, new_size, realloc_content(j, i - 1),
+		block[j]);
+	abort();
+
+      }
+
+    for(unsigned int j = 0; j < new_size; j++)
+      block[j] = realloc_content(j, i);
+
+    size = new_size;
+
+  }
+
+  if(NULL != realloc(block, 0)) {
+
+    fprintf(stderr, "Reallocating to size 0 didn't free the block\n");
+    abort();
+
+  }
+
+}
+
+
 static void process(unsigned int index, unsigned int id) {
 
   struct block_t* orig;
@@ -268,6 +340,7 @@ noreturn void prog_main(thread_t* const restrict thread,
   stat.t_pri = 0;
   stat.t_sched_stat = T_STAT_RUNNABLE;
   behaviors.value = 0x80808080;
+  check_realloc();
 
   for(unsigned int i = 0; i < THREADS; i++) {
 
@@ -14,6 +14,8 @@ const unsigned int default_gc_array_gen = 2;
 const gc_typedesc_t gc_types[0] = {};
 gc_double_ptr_t* const gc_global_ptrs[0] = {};
 const unsigned int gc_global_ptr_count = 0;
+const gc_framedesc_t gc_frame_descs[0] = {};
+const unsigned int gc_frame_desc_count = 0;
 
 noreturn void prog_main(thread_t* const restrict thread,
 			const unsigned int exec,